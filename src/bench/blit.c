@@ -0,0 +1,192 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "../blit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+/**
+ * The width of the frame the functions are timed on
+ */
+#define WIDTH  3840
+
+/**
+ * The height of the frame the functions are timed on
+ */
+#define HEIGHT  2160
+
+/**
+ * The minimum time, in nanoseconds, each function is timed for
+ */
+#define DURATION  500000000LL
+
+
+
+/**
+ * The names of the pixel formats, indexed by their `BLIT_*` values
+ */
+static const char* const format_names[] = { "RGB565", "RGB888", "BGR888", "XRGB8888", "XBGR8888" };
+
+
+
+/**
+ * Get the current time
+ * 
+ * @return  The current time, in nanoseconds
+ */
+static long long int now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long int)(ts.tv_sec) * 1000000000LL + (long long int)(ts.tv_nsec);
+}
+
+
+/**
+ * Print how long a frame took
+ * 
+ * @param  format  The name of the pixel format
+ * @param  what    What was done to the frame
+ * @param  isa     The instruction set that was used
+ * @param  ns      The total time, in nanoseconds
+ * @param  frames  The number of frames
+ */
+static void report(const char* format, const char* what, const char* isa, long long int ns, size_t frames)
+{
+  double ms = (double)ns / (double)frames / (double)1000000;
+  printf("%-8s  %-9s  %-6s  %8.3lf ms/frame  %8.1lf Mpixels/s\n", format, what, isa, ms,
+	 (double)WIDTH * (double)HEIGHT / ms / (double)1000);
+}
+
+
+/**
+ * Time a conversion function on a frame
+ * 
+ * @param   kernel           The function
+ * @param   bytes_per_pixel  The number of bytes per pixel in the destination
+ * @param   dest             The destination frame
+ * @param   src              The source frame
+ * @param   frames           Output parameter for the number of frames converted
+ * @return                   The total time, in nanoseconds
+ */
+static long long int time_kernel(const blit_kernel_t* restrict kernel, size_t bytes_per_pixel,
+				 unsigned char* restrict dest, const unsigned char* restrict src,
+				 size_t* restrict frames)
+{
+  size_t y, stride = kernel->colour ? 3 * WIDTH : WIDTH;
+  long long int start = now(), ns;
+  
+  *frames = 0;
+  do
+    {
+      for (y = 0; y < HEIGHT; y++)
+	kernel->function(dest + y * WIDTH * bytes_per_pixel, src + y * stride, WIDTH);
+      *frames += 1;
+    }
+  while ((ns = now() - start) < DURATION);
+  
+  return ns;
+}
+
+
+/**
+ * Time copying a frame
+ * 
+ * @param   dest       The destination frame
+ * @param   src        The source frame
+ * @param   streaming  Whether to use non-temporal stores
+ * @param   frames     Output parameter for the number of frames copied
+ * @return             The total time, in nanoseconds
+ */
+static long long int time_copy(unsigned char* restrict dest, const unsigned char* restrict src,
+			       int streaming, size_t* restrict frames)
+{
+  long long int start = now(), ns;
+  
+  *frames = 0;
+  do
+    {
+      blit_copy_rows(dest, 4 * WIDTH, src, 4 * WIDTH, 4 * WIDTH, HEIGHT, streaming);
+      *frames += 1;
+    }
+  while ((ns = now() - start) < DURATION);
+  
+  return ns;
+}
+
+
+/**
+ * Time every conversion function the CPU supports, scalar, SSE2,
+ * SSSE3, and AVX2, for every pixel format, and the copying of
+ * frames with and without non-temporal stores
+ * 
+ * @return  0 on success, 1 on error
+ */
+int main(void)
+{
+  blit_kernel_t kernels[BLIT_MAX_KERNELS];
+  unsigned char* src;
+  unsigned char* dest;
+  size_t i, n, frames;
+  int format;
+  long long int ns;
+  
+  src  = malloc(3 * WIDTH * HEIGHT);
+  dest = malloc(4 * WIDTH * HEIGHT);
+  if ((src == NULL) || (dest == NULL))
+    {
+      perror("blit-bench");
+      return 1;
+    }
+  for (i = 0; i < 3 * WIDTH * HEIGHT; i++)
+    src[i] = (unsigned char)(i * 7);
+  memset(dest, 0, 4 * WIDTH * HEIGHT);
+  
+  printf("%zux%zu frames\n", (size_t)WIDTH, (size_t)HEIGHT);
+  for (format = BLIT_RGB565; format <= BLIT_XBGR8888; format++)
+    {
+      n = blit_list_kernels(format, kernels);
+      for (i = 0; i < n; i++)
+	{
+	  ns = time_kernel(kernels + i, format == BLIT_RGB565 ? 2 : format <= BLIT_BGR888 ? 3 : 4,
+			   dest, src, &frames);
+	  report(format_names[format], kernels[i].colour ? "colour" : "greyscale", kernels[i].isa, ns, frames);
+	}
+    }
+  
+  free(src);
+  src = malloc(4 * WIDTH * HEIGHT);
+  if (src == NULL)
+    {
+      perror("blit-bench");
+      return free(dest), 1;
+    }
+  memset(src, 0x55, 4 * WIDTH * HEIGHT);
+  ns = time_copy(dest, src, 0, &frames);
+  report("32-bit", "copy", "memcpy", ns, frames);
+  ns = time_copy(dest, src, 1, &frames);
+  report("32-bit", "copy", "stream", ns, frames);
+  
+  free(src);
+  free(dest);
+  return 0;
+}
@@ -0,0 +1,808 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "blit.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+#endif
+
+#include "crazy.h"
+#include "pnm.h"
+
+
+
+/**
+ * A blit that is split into bands of rows
+ */
+struct blit_job
+{
+  /**
+   * The pixel format of the buffer
+   */
+  const blit_format_t* format;
+  
+  /**
+   * The position in the buffer of the top-left corner of the image
+   */
+  unsigned char* dest;
+  
+  /**
+   * The number of bytes between the start of successive rows in the buffer
+   */
+  size_t line_length;
+  
+  /**
+   * The width of the image
+   */
+  size_t width;
+  
+  /**
+   * The height of the image
+   */
+  size_t height;
+  
+  /**
+   * Lookup table for the image's maxval
+   */
+  const pnm_levels_t* levels;
+  
+  /**
+   * 4: raw lineart, 5: raw greyscale, 6: raw colour
+   */
+  int type;
+  
+  /**
+   * Pixel data of the type described by `type`
+   */
+  const unsigned char* pixeldata;
+  
+  /**
+   * The number of bytes per row in `pixeldata`
+   */
+  size_t stride;
+  
+  /**
+   * The number of rows per band, the last band may have fewer
+   */
+  size_t band_height;
+  
+  /**
+   * The number of bands
+   */
+  size_t bands;
+  
+  /**
+   * The index of the first band no thread has taken
+   */
+  size_t next_band;
+  
+  /**
+   * The number of bands that have been drawn
+   */
+  size_t bands_done;
+  
+  /**
+   * The `errno` of the first band that failed, zero if none
+   */
+  int error;
+};
+
+
+
+/**
+ * The threads in the pool, the thread calling
+ * `blit_image` draws bands too and is not included
+ */
+static pthread_t pool[BLIT_MAX_THREADS];
+
+/**
+ * The number of elements in `pool`
+ */
+static size_t pool_size = 0;
+
+/**
+ * Whether the pool has been started
+ */
+static int pool_started = 0;
+
+/**
+ * Whether the threads in the pool shall exit
+ */
+static int pool_stopping = 0;
+
+/**
+ * Incremented whenever a job is posted
+ */
+static unsigned long int pool_generation = 0;
+
+/**
+ * The current job, `NULL` if none
+ */
+static struct blit_job* pool_job = NULL;
+
+/**
+ * Protects the pool's state and the current job
+ */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Signalled when a job is posted or the pool is stopped
+ */
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Signalled when all bands of the current job have been drawn
+ */
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+
+
+/* Store one pixel. The 24-bit formats are stored little-endian, as the framebuffer does. */
+#define STORE_RGB565(P, R, G, B)    (*(uint16_t*)(P) = (uint16_t)(((R) & 0xF8) << 8 | ((G) & 0xFC) << 3 | (B) >> 3))
+#define STORE_RGB888(P, R, G, B)    ((P)[0] = (B), (P)[1] = (G), (P)[2] = (R))
+#define STORE_BGR888(P, R, G, B)    ((P)[0] = (R), (P)[1] = (G), (P)[2] = (B))
+#define STORE_XRGB8888(P, R, G, B)  (*(uint32_t*)(P) = (uint32_t)(R) << 16 | (uint32_t)(G) << 8 | (uint32_t)(B))
+#define STORE_XBGR8888(P, R, G, B)  (*(uint32_t*)(P) = (uint32_t)(B) << 16 | (uint32_t)(G) << 8 | (uint32_t)(R))
+
+
+/**
+ * Define the conversion functions for a pixel format
+ * 
+ * @param  FORMAT  The name of the format, without the BLIT_ prefix
+ * @param  BPP     The number of bytes per pixel
+ */
+#define KERNELS(FORMAT, BPP)								\
+  static void blit_grey_##FORMAT(void* restrict dest, const unsigned char* restrict src,	\
+				 size_t width)						\
+  {											\
+    unsigned char* d = dest;								\
+    size_t x;										\
+    for (x = 0; x < width; x++, d += BPP)						\
+      STORE_##FORMAT(d, src[x], src[x], src[x]);					\
+  }											\
+											\
+  static void blit_colour_##FORMAT(void* restrict dest, const unsigned char* restrict src,	\
+				   size_t width)					\
+  {											\
+    unsigned char* d = dest;								\
+    size_t x;										\
+    for (x = 0; x < width; x++, d += BPP, src += 3)					\
+      STORE_##FORMAT(d, src[0], src[1], src[2]);					\
+  }
+
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+KERNELS(RGB565, 2)
+KERNELS(RGB888, 3)
+KERNELS(BGR888, 3)
+KERNELS(XRGB8888, 4)
+KERNELS(XBGR8888, 4)
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS
+
+
+/**
+ * Expand greyscale to 32-bit pixels, using SSE2
+ * 
+ * The same function is used for both XRGB8888 and XBGR8888
+ * 
+ * @param  dest   The destination row
+ * @param  src    The source row
+ * @param  width  The number of pixels in the row
+ */
+__attribute__((target("sse2")))
+static void blit_grey_x8888_sse2(void* restrict dest, const unsigned char* restrict src, size_t width)
+{
+  __m128i* d = dest;
+  const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+  __m128i g, lo, hi;
+  size_t x;
+  
+  for (x = 0; x + 16 <= width; x += 16, src += 16, d += 4)
+    {
+      g  = _mm_loadu_si128((const __m128i*)src);
+      lo = _mm_unpacklo_epi8(g, g);
+      hi = _mm_unpackhi_epi8(g, g);
+      _mm_storeu_si128(d + 0, _mm_and_si128(_mm_unpacklo_epi16(lo, lo), mask));
+      _mm_storeu_si128(d + 1, _mm_and_si128(_mm_unpackhi_epi16(lo, lo), mask));
+      _mm_storeu_si128(d + 2, _mm_and_si128(_mm_unpacklo_epi16(hi, hi), mask));
+      _mm_storeu_si128(d + 3, _mm_and_si128(_mm_unpackhi_epi16(hi, hi), mask));
+    }
+  
+  blit_grey_XRGB8888(d, src, width - x);
+}
+
+
+/**
+ * Expand greyscale to 32-bit pixels, using AVX2
+ * 
+ * The same function is used for both XRGB8888 and XBGR8888
+ * 
+ * @param  dest   The destination row
+ * @param  src    The source row
+ * @param  width  The number of pixels in the row
+ */
+__attribute__((target("avx2")))
+static void blit_grey_x8888_avx2(void* restrict dest, const unsigned char* restrict src, size_t width)
+{
+  __m256i* d = dest;
+  __m256i v;
+  size_t x;
+  
+  for (x = 0; x + 8 <= width; x += 8, src += 8, d += 1)
+    {
+      v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+      v = _mm256_or_si256(v, _mm256_or_si256(_mm256_slli_epi32(v, 8), _mm256_slli_epi32(v, 16)));
+      _mm256_storeu_si256(d, v);
+    }
+  
+  blit_grey_XRGB8888(d, src, width - x);
+}
+
+
+/**
+ * Define the function that expands 24-bit colour to 32-bit pixels using SSSE3
+ * 
+ * 16 pixels (48 bytes) are converted per iteration. The fourth load is made
+ * 4 bytes early so that nothing after the 48 bytes is read, so its shuffle
+ * indices are offset by 4.
+ * 
+ * @param  FORMAT          `XRGB8888` or `XBGR8888`
+ * @param  A, B, C         The subpixel order to store, in memory order, as offsets into the source pixel
+ */
+# define COLOUR_SSSE3(FORMAT, A, B, C)							\
+  __attribute__((target("ssse3")))							\
+  static void blit_colour_##FORMAT##_ssse3(void* restrict dest, const unsigned char* restrict src,	\
+					   size_t width)				\
+  {											\
+    __m128i* d = dest;									\
+    const __m128i shuf = _mm_setr_epi8(A, B, C, -1, 3 + A, 3 + B, 3 + C, -1,		\
+				       6 + A, 6 + B, 6 + C, -1, 9 + A, 9 + B, 9 + C, -1);	\
+    const __m128i shuf4 = _mm_add_epi8(shuf, _mm_setr_epi8(4, 4, 4, 0, 4, 4, 4, 0,	\
+							   4, 4, 4, 0, 4, 4, 4, 0));	\
+    size_t x;										\
+    for (x = 0; x + 16 <= width; x += 16, src += 48, d += 4)				\
+      {											\
+	_mm_storeu_si128(d + 0, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src +  0)), shuf));	\
+	_mm_storeu_si128(d + 1, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 12)), shuf));	\
+	_mm_storeu_si128(d + 2, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 24)), shuf));	\
+	_mm_storeu_si128(d + 3, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 32)), shuf4));	\
+      }											\
+    blit_colour_##FORMAT(d, src, width - x);						\
+  }
+
+
+/**
+ * Define the function that expands 24-bit colour to 32-bit pixels using AVX2
+ * 
+ * Like the SSSE3 version, but with two groups of 4 pixels per register,
+ * one in each 128-bit lane since `vpshufb` does not cross lanes.
+ * 
+ * @param  FORMAT          `XRGB8888` or `XBGR8888`
+ * @param  A, B, C         The subpixel order to store, in memory order, as offsets into the source pixel
+ */
+# define COLOUR_AVX2(FORMAT, A, B, C)							\
+  __attribute__((target("avx2")))							\
+  static void blit_colour_##FORMAT##_avx2(void* restrict dest, const unsigned char* restrict src,	\
+					  size_t width)					\
+  {											\
+    __m256i* d = dest;									\
+    const __m128i shuf = _mm_setr_epi8(A, B, C, -1, 3 + A, 3 + B, 3 + C, -1,		\
+				       6 + A, 6 + B, 6 + C, -1, 9 + A, 9 + B, 9 + C, -1);	\
+    const __m128i shuf4 = _mm_add_epi8(shuf, _mm_setr_epi8(4, 4, 4, 0, 4, 4, 4, 0,	\
+							   4, 4, 4, 0, 4, 4, 4, 0));	\
+    const __m256i shuf_lo = _mm256_set_m128i(shuf, shuf);				\
+    const __m256i shuf_hi = _mm256_set_m128i(shuf4, shuf);				\
+    __m256i v;										\
+    size_t x;										\
+    for (x = 0; x + 16 <= width; x += 16, src += 48, d += 2)				\
+      {											\
+	v = _mm256_loadu2_m128i((const __m128i*)(src + 12), (const __m128i*)(src + 0));	\
+	_mm256_storeu_si256(d + 0, _mm256_shuffle_epi8(v, shuf_lo));			\
+	v = _mm256_loadu2_m128i((const __m128i*)(src + 32), (const __m128i*)(src + 24));	\
+	_mm256_storeu_si256(d + 1, _mm256_shuffle_epi8(v, shuf_hi));			\
+      }											\
+    blit_colour_##FORMAT(d, src, width - x);						\
+  }
+
+/* Memory order is B, G, R, X for XRGB8888 and R, G, B, X for XBGR8888. */
+COLOUR_SSSE3(XRGB8888, 2, 1, 0)
+COLOUR_SSSE3(XBGR8888, 0, 1, 2)
+COLOUR_AVX2(XRGB8888, 2, 1, 0)
+COLOUR_AVX2(XBGR8888, 0, 1, 2)
+
+
+/**
+ * Copy rows of bytes, using non-temporal stores so that
+ * the destination is neither read nor cached, using SSE2
+ * 
+ * @param  dest              The first destination row
+ * @param  dest_line_length  The number of bytes between the start of successive rows in `dest`
+ * @param  src               The first source row
+ * @param  src_line_length   The number of bytes between the start of successive rows in `src`
+ * @param  row_size          The number of bytes to copy per row
+ * @param  rows              The number of rows
+ */
+__attribute__((target("sse2")))
+static void blit_copy_rows_sse2(void* restrict dest, size_t dest_line_length, const void* restrict src,
+				size_t src_line_length, size_t row_size, size_t rows)
+{
+  unsigned char* d;
+  const unsigned char* s;
+  size_t n, head;
+  
+  for (; rows--; dest = (char*)dest + dest_line_length, src = (const char*)src + src_line_length)
+    {
+      d = dest, s = src, n = row_size;
+      
+      /* Streaming stores must be aligned. */
+      head = (size_t)(-(uintptr_t)d & 15);
+      head = head < n ? head : n;
+      memcpy(d, s, head);
+      d += head, s += head, n -= head;
+      
+      for (; n >= 64; n -= 64, d += 64, s += 64)
+	{
+	  _mm_stream_si128((__m128i*)d + 0, _mm_loadu_si128((const __m128i*)s + 0));
+	  _mm_stream_si128((__m128i*)d + 1, _mm_loadu_si128((const __m128i*)s + 1));
+	  _mm_stream_si128((__m128i*)d + 2, _mm_loadu_si128((const __m128i*)s + 2));
+	  _mm_stream_si128((__m128i*)d + 3, _mm_loadu_si128((const __m128i*)s + 3));
+	}
+      for (; n >= 16; n -= 16, d += 16, s += 16)
+	_mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+      memcpy(d, s, n);
+    }
+  
+  _mm_sfence();
+}
+
+
+/**
+ * Replace the conversion functions of a pixel format
+ * with the fastest ones the CPU supports
+ * 
+ * @param  format  The pixel format
+ */
+static void select_simd(blit_format_t* restrict format)
+{
+  int avx2, ssse3, sse2;
+  
+  if ((format->format != BLIT_XRGB8888) && (format->format != BLIT_XBGR8888))
+    return;
+  
+  __builtin_cpu_init();
+  avx2  = __builtin_cpu_supports("avx2");
+  ssse3 = __builtin_cpu_supports("ssse3");
+  sse2  = __builtin_cpu_supports("sse2");
+  
+  if (avx2)       format->grey = blit_grey_x8888_avx2;
+  else if (sse2)  format->grey = blit_grey_x8888_sse2;
+  
+  if (format->format == BLIT_XRGB8888)
+    {
+      if (avx2)        format->colour = blit_colour_XRGB8888_avx2;
+      else if (ssse3)  format->colour = blit_colour_XRGB8888_ssse3;
+    }
+  else
+    {
+      if (avx2)        format->colour = blit_colour_XBGR8888_avx2;
+      else if (ssse3)  format->colour = blit_colour_XBGR8888_ssse3;
+    }
+}
+
+
+#endif
+
+
+
+/**
+ * Select the pixel format that matches a pixel layout
+ * 
+ * @param   format          Output parameter for the pixel format
+ * @param   bits_per_pixel  The number of bits per pixel
+ * @param   red_offset      The offset of the red bits in the pixel value
+ * @param   red_length      The number of red bits
+ * @param   green_offset    The offset of the green bits in the pixel value
+ * @param   green_length    The number of green bits
+ * @param   blue_offset     The offset of the blue bits in the pixel value
+ * @param   blue_length     The number of blue bits
+ * @return                  Zero on success, -1 if the layout is not supported
+ */
+int blit_get_format(blit_format_t* restrict format, unsigned int bits_per_pixel,
+		    unsigned int red_offset, unsigned int red_length,
+		    unsigned int green_offset, unsigned int green_length,
+		    unsigned int blue_offset, unsigned int blue_length)
+{
+#define IS(BPP, RO, RL, GO, GL, BO, BL)					\
+  ((bits_per_pixel == BPP) &&						\
+   (red_offset   == RO) && (red_length   == RL) &&			\
+   (green_offset == GO) && (green_length == GL) &&			\
+   (blue_offset  == BO) && (blue_length  == BL))
+#define SELECT(FORMAT, BPP)						\
+  (format->format          = BLIT_##FORMAT,				\
+   format->bytes_per_pixel = BPP,					\
+   format->grey            = blit_grey_##FORMAT,			\
+   format->colour          = blit_colour_##FORMAT)
+  
+  if      (IS(16, 11, 5,  5, 6,  0, 5))  SELECT(RGB565, 2);
+  else if (IS(24, 16, 8,  8, 8,  0, 8))  SELECT(RGB888, 3);
+  else if (IS(24,  0, 8,  8, 8, 16, 8))  SELECT(BGR888, 3);
+  else if (IS(32, 16, 8,  8, 8,  0, 8))  SELECT(XRGB8888, 4);
+  else if (IS(32,  0, 8,  8, 8, 16, 8))  SELECT(XBGR8888, 4);
+  else
+    return errno = ENOTSUP, -1;
+    
+#ifdef HAVE_X86_KERNELS
+  select_simd(format);
+#endif
+  return 0;
+  
+#undef SELECT
+#undef IS
+}
+
+
+/**
+ * List every conversion function for a pixel format that the CPU
+ * supports, not just the fastest ones, so they can be compared
+ * 
+ * @param   format   `BLIT_RGB565`, `BLIT_RGB888`, `BLIT_BGR888`, `BLIT_XRGB8888`, or `BLIT_XBGR8888`
+ * @param   kernels  Output parameter for the functions
+ * @return           The number of functions stored in `kernels`
+ */
+size_t blit_list_kernels(int format, blit_kernel_t kernels[BLIT_MAX_KERNELS])
+{
+#define ADD(ISA, COLOUR, FUNCTION)					\
+  (kernels[n].isa      = ISA,						\
+   kernels[n].colour   = COLOUR,					\
+   kernels[n].function = FUNCTION,					\
+   n++)
+#define SCALAR(FORMAT)							\
+  (ADD("scalar", 0, blit_grey_##FORMAT),				\
+   ADD("scalar", 1, blit_colour_##FORMAT))
+  
+  size_t n = 0;
+  
+  switch (format)
+    {
+    case BLIT_RGB565:    SCALAR(RGB565);    break;
+    case BLIT_RGB888:    SCALAR(RGB888);    break;
+    case BLIT_BGR888:    SCALAR(BGR888);    break;
+    case BLIT_XRGB8888:  SCALAR(XRGB8888);  break;
+    case BLIT_XBGR8888:  SCALAR(XBGR8888);  break;
+    default:
+      return 0;
+    }
+  
+#ifdef HAVE_X86_KERNELS
+  if ((format != BLIT_XRGB8888) && (format != BLIT_XBGR8888))
+    return n;
+  
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    ADD("SSE2", 0, blit_grey_x8888_sse2);
+  if (__builtin_cpu_supports("avx2"))
+    ADD("AVX2", 0, blit_grey_x8888_avx2);
+  if (__builtin_cpu_supports("ssse3"))
+    ADD("SSSE3", 1, format == BLIT_XRGB8888 ? blit_colour_XRGB8888_ssse3 : blit_colour_XBGR8888_ssse3);
+  if (__builtin_cpu_supports("avx2"))
+    ADD("AVX2", 1, format == BLIT_XRGB8888 ? blit_colour_XRGB8888_avx2 : blit_colour_XBGR8888_avx2);
+#endif
+  
+  return n;
+  
+#undef SCALAR
+#undef ADD
+}
+
+
+/**
+ * Draw rows of an PNM image into a pixel buffer
+ * 
+ * @param   format       The pixel format of the buffer
+ * @param   dest         The position in the buffer of the top-left corner of the rows
+ * @param   line_length  The number of bytes between the start of successive rows in the buffer
+ * @param   width        The width of the image
+ * @param   height       The number of rows to draw
+ * @param   levels       Lookup table for the image's maxval
+ * @param   type         4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata    Pixel data of the first row to draw, of the type described by `type`
+ * @return               Zero on success, -1 on error
+ */
+static int blit_rows(const blit_format_t* restrict format, void* restrict dest, size_t line_length,
+		     size_t width, size_t height, const pnm_levels_t* restrict levels, int type,
+		     const unsigned char* restrict pixeldata)
+{
+  unsigned char* d = dest;
+  unsigned char* row = NULL;
+  blit_row_func_t* convert;
+  size_t y, subpixels, stride = pnm_row_size(type, levels->maxval, width);
+  
+  switch (type)
+    {
+    case 4:
+    case 5:  convert = format->grey,    subpixels = width;      break;
+    case 6:  convert = format->colour,  subpixels = 3 * width;  break;
+    default:
+      return errno = EINVAL, -1;
+    }
+  
+  if ((type != 4) && (levels->table == NULL))
+    for (y = 0; y < height; y++, d += line_length, pixeldata += stride)
+      convert(d, pixeldata, width);
+  else
+    {
+      t (row = malloc(subpixels), row == NULL);
+      for (y = 0; y < height; y++, d += line_length, pixeldata += stride)
+	{
+	  if (type == 4)
+	    pnm_unpack_lineart(row, pixeldata, width);
+	  else
+	    pnm_levels_convert(levels, row, pixeldata, subpixels);
+	  convert(d, row, width);
+	}
+      free(row);
+    }
+  
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Draw the bands of a job that no thread has taken yet
+ * 
+ * `pool_mutex` must be held, it is released while drawing
+ * 
+ * @param  job  The job
+ */
+static void blit_take_bands(struct blit_job* restrict job)
+{
+  size_t band, y, rows;
+  int r;
+  
+  while (job->next_band < job->bands)
+    {
+      band = job->next_band++;
+      y = band * job->band_height;
+      rows = job->height - y < job->band_height ? job->height - y : job->band_height;
+      pthread_mutex_unlock(&pool_mutex);
+      r = blit_rows(job->format, job->dest + y * job->line_length, job->line_length, job->width, rows,
+		    job->levels, job->type, job->pixeldata + y * job->stride);
+      pthread_mutex_lock(&pool_mutex);
+      if (r && !job->error)
+	job->error = errno;
+      if (++(job->bands_done) == job->bands)
+	pthread_cond_broadcast(&pool_done);
+    }
+}
+
+
+/**
+ * Draw bands of the current job until the pool is stopped
+ * 
+ * @param   arg  Not used
+ * @return       `NULL`
+ */
+static void* blit_worker(void* arg)
+{
+  unsigned long int seen = 0;
+  
+  (void) arg;
+  
+  pthread_mutex_lock(&pool_mutex);
+  for (;;)
+    {
+      while (!pool_stopping && (pool_generation == seen))
+	pthread_cond_wait(&pool_work, &pool_mutex);
+      if (pool_stopping)
+	break;
+      seen = pool_generation;
+      if (pool_job != NULL)
+	blit_take_bands(pool_job);
+    }
+  pthread_mutex_unlock(&pool_mutex);
+  
+  return NULL;
+}
+
+
+/**
+ * Start the thread pool, one thread per CPU, but at
+ * most `BLIT_MAX_THREADS` including the calling thread
+ */
+static void blit_start_pool(void)
+{
+  long int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t wanted = cpus < 1 ? 0 : (size_t)cpus - 1;
+  
+  pool_started = 1;
+  pool_stopping = 0;
+  wanted = wanted < BLIT_MAX_THREADS - 1 ? wanted : BLIT_MAX_THREADS - 1;
+  for (pool_size = 0; pool_size < wanted; pool_size++)
+    if (pthread_create(pool + pool_size, NULL, blit_worker, NULL))
+      break;
+}
+
+
+/**
+ * Draw an PNM image into a pixel buffer
+ * 
+ * Large images are split into bands of rows that are drawn in
+ * parallel, this function must not be called from multiple
+ * threads at the same time
+ * 
+ * @param   format       The pixel format of the buffer
+ * @param   dest         The position in the buffer of the top-left corner of the image
+ * @param   line_length  The number of bytes between the start of successive rows in the buffer
+ * @param   width        The width of the image
+ * @param   height       The height of the image
+ * @param   levels       Lookup table for the image's maxval
+ * @param   type         4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata    Pixel data of the type described by `type`
+ * @return               Zero on success, -1 on error
+ */
+int blit_image(const blit_format_t* restrict format, void* restrict dest, size_t line_length,
+	       size_t width, size_t height, const pnm_levels_t* restrict levels, int type,
+	       const unsigned char* restrict pixeldata)
+{
+  struct blit_job job;
+  
+  if (width * height >= BLIT_MIN_PARALLEL_PIXELS && !pool_started)
+    blit_start_pool();
+  if ((width * height < BLIT_MIN_PARALLEL_PIXELS) || !pool_size)
+    return blit_rows(format, dest, line_length, width, height, levels, type, pixeldata);
+  
+  job.format      = format;
+  job.dest        = dest;
+  job.line_length = line_length;
+  job.width       = width;
+  job.height      = height;
+  job.levels      = levels;
+  job.type        = type;
+  job.pixeldata   = pixeldata;
+  job.stride      = pnm_row_size(type, levels->maxval, width);
+  job.bands       = 4 * (pool_size + 1);
+  job.band_height = (height + job.bands - 1) / job.bands;
+  job.bands       = (height + job.band_height - 1) / job.band_height;
+  job.next_band   = 0;
+  job.bands_done  = 0;
+  job.error       = 0;
+  
+  pthread_mutex_lock(&pool_mutex);
+  pool_job = &job;
+  pool_generation++;
+  pthread_cond_broadcast(&pool_work);
+  blit_take_bands(&job);
+  while (job.bands_done < job.bands)
+    pthread_cond_wait(&pool_done, &pool_mutex);
+  pool_job = NULL;
+  pthread_mutex_unlock(&pool_mutex);
+  
+  return job.error ? (errno = job.error, -1) : 0;
+}
+
+
+/**
+ * Convert a row of pixels back to 8-bit RGB
+ * 
+ * @param  format  The pixel format of the row
+ * @param  dest    Output buffer for the subpixels, red first, `3 * width` bytes
+ * @param  src     The row of pixels
+ * @param  width   The number of pixels in the row
+ */
+void blit_unpack_row(const blit_format_t* restrict format, unsigned char* restrict dest,
+		     const void* restrict src, size_t width)
+{
+  const unsigned char* s = src;
+  uint_fast32_t v;
+  size_t x;
+  
+  for (x = 0; x < width; x++, dest += 3, s += format->bytes_per_pixel)
+    switch (format->format)
+      {
+      case BLIT_RGB565:
+	v = (uint_fast32_t)s[0] | (uint_fast32_t)s[1] << 8;
+	dest[0] = (unsigned char)((v >> 11 & 0x1F) * 255 / 0x1F);
+	dest[1] = (unsigned char)((v >>  5 & 0x3F) * 255 / 0x3F);
+	dest[2] = (unsigned char)((v >>  0 & 0x1F) * 255 / 0x1F);
+	break;
+      case BLIT_RGB888:
+      case BLIT_XRGB8888:
+	dest[0] = s[2], dest[1] = s[1], dest[2] = s[0];
+	break;
+      default:
+	dest[0] = s[0], dest[1] = s[1], dest[2] = s[2];
+	break;
+      }
+}
+
+
+/**
+ * Copy rows of pixels to the screen
+ * 
+ * @param  dest              The first destination row
+ * @param  dest_line_length  The number of bytes between the start of successive rows in `dest`
+ * @param  src               The first source row
+ * @param  src_line_length   The number of bytes between the start of successive rows in `src`
+ * @param  row_size          The number of bytes to copy per row
+ * @param  rows              The number of rows
+ * @param  streaming         Whether to use non-temporal stores if available, this
+ *                           should only be done if `dest` is uncached or write-combining
+ *                           memory, such as a mapped framebuffer, for ordinary memory
+ *                           that is read soon after, it only makes the reads slower
+ */
+void blit_copy_rows(void* restrict dest, size_t dest_line_length, const void* restrict src,
+		    size_t src_line_length, size_t row_size, size_t rows, int streaming)
+{
+#ifdef HAVE_X86_KERNELS
+  static int sse2 = -1;
+  
+  if (streaming && (sse2 < 0))
+    {
+      __builtin_cpu_init();
+      sse2 = __builtin_cpu_supports("sse2") != 0;
+    }
+  if (streaming && sse2)
+    {
+      blit_copy_rows_sse2(dest, dest_line_length, src, src_line_length, row_size, rows);
+      return;
+    }
+#else
+  (void) streaming;
+#endif
+  
+  for (; rows--; dest = (char*)dest + dest_line_length, src = (const char*)src + src_line_length)
+    memcpy(dest, src, row_size);
+}
+
+
+/**
+ * Stop the thread pool used by `blit_image`,
+ * it is restarted the next time it is needed
+ */
+void blit_terminate(void)
+{
+  size_t i;
+  
+  pthread_mutex_lock(&pool_mutex);
+  pool_stopping = 1;
+  pthread_cond_broadcast(&pool_work);
+  pthread_mutex_unlock(&pool_mutex);
+  
+  for (i = 0; i < pool_size; i++)
+    pthread_join(pool[i], NULL);
+  pool_size = 0;
+  pool_started = 0;
+}
+
@@ -0,0 +1,224 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_BLIT_H
+#define CRAZY_BLIT_H
+
+
+#include <stddef.h>
+
+#include "pnm.h"
+
+
+
+/**
+ * 16 bits per pixel, 5 bits red, 6 bits green, 5 bits blue,
+ * red in the most significant bits
+ */
+#define BLIT_RGB565  0
+
+/**
+ * 24 bits per pixel, red in the most significant byte
+ */
+#define BLIT_RGB888  1
+
+/**
+ * 24 bits per pixel, blue in the most significant byte
+ */
+#define BLIT_BGR888  2
+
+/**
+ * 32 bits per pixel, red in the second most significant byte
+ */
+#define BLIT_XRGB8888  3
+
+/**
+ * 32 bits per pixel, blue in the second most significant byte
+ */
+#define BLIT_XBGR8888  4
+
+
+
+/**
+ * The maximum number of threads `blit_image` uses, including the calling thread
+ */
+#ifndef BLIT_MAX_THREADS
+# define BLIT_MAX_THREADS  4
+#endif
+
+/**
+ * The number of pixels an image must have for `blit_image` to use multiple threads
+ */
+#ifndef BLIT_MIN_PARALLEL_PIXELS
+# define BLIT_MIN_PARALLEL_PIXELS  (512UL * 512UL)
+#endif
+
+/**
+ * The maximum number of conversion functions `blit_list_kernels` lists
+ */
+#define BLIT_MAX_KERNELS  6
+
+
+
+/**
+ * Convert one row of pixels into a pixel format
+ * 
+ * @param  dest   The destination row
+ * @param  src    The source row
+ * @param  width  The number of pixels in the row
+ */
+typedef void blit_row_func_t(void* restrict dest, const unsigned char* restrict src, size_t width);
+
+
+/**
+ * A conversion function, as listed by `blit_list_kernels`
+ */
+typedef struct blit_kernel
+{
+  /**
+   * The instruction set the function uses: "scalar", "SSE2", "SSSE3", or "AVX2"
+   */
+  const char* isa;
+  
+  /**
+   * Whether the function converts colour, otherwise it converts greyscale
+   */
+  int colour;
+  
+  /**
+   * The function
+   */
+  blit_row_func_t* function;
+  
+} blit_kernel_t;
+
+
+/**
+ * Pixel format, with conversion functions
+ */
+typedef struct blit_format
+{
+  /**
+   * `BLIT_RGB565`, `BLIT_RGB888`, `BLIT_BGR888`, `BLIT_XRGB8888`, or `BLIT_XBGR8888`
+   */
+  int format;
+  
+  /**
+   * The number of bytes per pixel
+   */
+  size_t bytes_per_pixel;
+  
+  /**
+   * Convert greyscale, 8 bits per pixel
+   */
+  blit_row_func_t* grey;
+  
+  /**
+   * Convert colour, 8 bits per subpixel, red first
+   */
+  blit_row_func_t* colour;
+  
+} blit_format_t;
+
+
+
+/**
+ * Select the pixel format that matches a pixel layout
+ * 
+ * @param   format          Output parameter for the pixel format
+ * @param   bits_per_pixel  The number of bits per pixel
+ * @param   red_offset      The offset of the red bits in the pixel value
+ * @param   red_length      The number of red bits
+ * @param   green_offset    The offset of the green bits in the pixel value
+ * @param   green_length    The number of green bits
+ * @param   blue_offset     The offset of the blue bits in the pixel value
+ * @param   blue_length     The number of blue bits
+ * @return                  Zero on success, -1 if the layout is not supported
+ */
+int blit_get_format(blit_format_t* restrict format, unsigned int bits_per_pixel,
+		    unsigned int red_offset, unsigned int red_length,
+		    unsigned int green_offset, unsigned int green_length,
+		    unsigned int blue_offset, unsigned int blue_length);
+
+/**
+ * List every conversion function for a pixel format that the CPU
+ * supports, not just the fastest ones, so they can be compared
+ * 
+ * @param   format   `BLIT_RGB565`, `BLIT_RGB888`, `BLIT_BGR888`, `BLIT_XRGB8888`, or `BLIT_XBGR8888`
+ * @param   kernels  Output parameter for the functions
+ * @return           The number of functions stored in `kernels`
+ */
+size_t blit_list_kernels(int format, blit_kernel_t kernels[BLIT_MAX_KERNELS]);
+
+/**
+ * Draw an PNM image into a pixel buffer
+ * 
+ * Large images are split into bands of rows that are drawn in
+ * parallel, this function must not be called from multiple
+ * threads at the same time
+ * 
+ * @param   format       The pixel format of the buffer
+ * @param   dest         The position in the buffer of the top-left corner of the image
+ * @param   line_length  The number of bytes between the start of successive rows in the buffer
+ * @param   width        The width of the image
+ * @param   height       The height of the image
+ * @param   levels       Lookup table for the image's maxval
+ * @param   type         4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata    Pixel data of the type described by `type`
+ * @return               Zero on success, -1 on error
+ */
+int blit_image(const blit_format_t* restrict format, void* restrict dest, size_t line_length,
+	       size_t width, size_t height, const pnm_levels_t* restrict levels, int type,
+	       const unsigned char* restrict pixeldata);
+
+/**
+ * Convert a row of pixels back to 8-bit RGB
+ * 
+ * @param  format  The pixel format of the row
+ * @param  dest    Output buffer for the subpixels, red first, `3 * width` bytes
+ * @param  src     The row of pixels
+ * @param  width   The number of pixels in the row
+ */
+void blit_unpack_row(const blit_format_t* restrict format, unsigned char* restrict dest,
+		     const void* restrict src, size_t width);
+
+/**
+ * Copy rows of pixels to the screen
+ * 
+ * @param  dest              The first destination row
+ * @param  dest_line_length  The number of bytes between the start of successive rows in `dest`
+ * @param  src               The first source row
+ * @param  src_line_length   The number of bytes between the start of successive rows in `src`
+ * @param  row_size          The number of bytes to copy per row
+ * @param  rows              The number of rows
+ * @param  streaming         Whether to use non-temporal stores if available, this
+ *                           should only be done if `dest` is uncached or write-combining
+ *                           memory, such as a mapped framebuffer, for ordinary memory
+ *                           that is read soon after, it only makes the reads slower
+ */
+void blit_copy_rows(void* restrict dest, size_t dest_line_length, const void* restrict src,
+		    size_t src_line_length, size_t row_size, size_t rows, int streaming);
+
+/**
+ * Stop the thread pool used by `blit_image`,
+ * it is restarted the next time it is needed
+ */
+void blit_terminate(void);
+
+
+#endif
+
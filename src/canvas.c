@@ -0,0 +1,325 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "canvas.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * Compute the bounding box of two rectangles
+ * 
+ * @param  a  One of the rectangles, output parameter for the bounding box
+ * @param  b  The other rectangle
+ */
+static void rect_union(canvas_rect_t* restrict a, const canvas_rect_t* restrict b)
+{
+  size_t x2 = a->x + a->width, y2 = a->y + a->height;
+  
+  if (b->x + b->width  > x2)  x2 = b->x + b->width;
+  if (b->y + b->height > y2)  y2 = b->y + b->height;
+  if (b->x < a->x)  a->x = b->x;
+  if (b->y < a->y)  a->y = b->y;
+  a->width  = x2 - a->x;
+  a->height = y2 - a->y;
+}
+
+
+/**
+ * Copy areas of a canvas to the screen
+ * 
+ * @param  canvas       The canvas
+ * @param  rects        The areas to copy
+ * @param  n            The number of elements in `rects`
+ * @param  dest         The screen's pixels, in the same format as the canvas
+ * @param  line_length  The number of bytes between the start of successive rows in `dest`
+ */
+static void copy_areas(const canvas_t* restrict canvas, const canvas_rect_t* restrict rects, size_t n,
+		       void* restrict dest, size_t line_length)
+{
+  size_t i, bpp = canvas->format.bytes_per_pixel;
+  const canvas_rect_t* r;
+  
+  for (i = 0; i < n; i++)
+    {
+      r = rects + i;
+      blit_copy_rows((unsigned char*)dest + r->y * line_length + r->x * bpp, line_length,
+		     canvas->pixels + r->y * canvas->line_length + r->x * bpp, canvas->line_length,
+		     r->width * bpp, r->height, canvas->streaming);
+    }
+}
+
+
+/**
+ * Clear an area of a canvas to black, and mark it as modified
+ * 
+ * @param  canvas  The canvas
+ * @param  x       The X-position of the left edge of the area
+ * @param  y       The Y-position of the top edge of the area
+ * @param  width   The width of the area
+ * @param  height  The height of the area
+ */
+static void clear_area(canvas_t* restrict canvas, size_t x, size_t y, size_t width, size_t height)
+{
+  canvas_rect_t rect = { x, y, width, height };
+  unsigned char* p = canvas->pixels + y * canvas->line_length + x * canvas->format.bytes_per_pixel;
+  
+  if (!width || !height)
+    return;
+  
+  for (; height--; p += canvas->line_length)
+    memset(p, 0, width * canvas->format.bytes_per_pixel);
+  
+  canvas_damage(canvas, &rect);
+}
+
+
+/**
+ * Create a canvas, it will be black and wholly damaged
+ * 
+ * @param   canvas  Output parameter for the canvas
+ * @param   width   The width of the canvas, in pixels
+ * @param   height  The height of the canvas, in pixels
+ * @param   format  The pixel format
+ * @return          Zero on success, -1 on error
+ */
+int canvas_initialise(canvas_t* restrict canvas, size_t width, size_t height,
+		      const blit_format_t* restrict format)
+{
+  canvas_rect_t all = { 0, 0, width, height };
+  
+  canvas->width        = width;
+  canvas->height       = height;
+  canvas->format       = *format;
+  canvas->line_length  = width * format->bytes_per_pixel;
+  canvas->streaming    = 0;
+  canvas->damage_count = 0;
+  canvas->last_damage_count = 0;
+  memset(&(canvas->image), 0, sizeof(canvas->image));
+  
+  canvas->pixels = calloc(height, canvas->line_length);
+  if (canvas->pixels == NULL)
+    return -1;
+  canvas->allocated = 1;
+  
+  canvas_damage(canvas, &all);
+  return 0;
+}
+
+
+/**
+ * Create a canvas in memory provided by the display system, such as an
+ * image the display server reads directly, it will be black and wholly
+ * damaged, the damage is then reset with `canvas_commit` rather than
+ * copied with `canvas_flush`
+ * 
+ * @param  canvas       Output parameter for the canvas
+ * @param  width        The width of the canvas, in pixels
+ * @param  height       The height of the canvas, in pixels
+ * @param  format       The pixel format
+ * @param  pixels       The memory, it must remain valid until the canvas is destroyed
+ * @param  line_length  The number of bytes between the start of successive rows in `pixels`
+ */
+void canvas_wrap(canvas_t* restrict canvas, size_t width, size_t height, const blit_format_t* restrict format,
+		 void* restrict pixels, size_t line_length)
+{
+  canvas_rect_t all = { 0, 0, width, height };
+  
+  canvas->width        = width;
+  canvas->height       = height;
+  canvas->format       = *format;
+  canvas->line_length  = line_length;
+  canvas->streaming    = 0;
+  canvas->damage_count = 0;
+  canvas->last_damage_count = 0;
+  memset(&(canvas->image), 0, sizeof(canvas->image));
+  
+  canvas->pixels = pixels;
+  canvas->allocated = 0;
+  memset(canvas->pixels, 0, height * line_length);
+  
+  canvas_damage(canvas, &all);
+}
+
+
+/**
+ * Release the resources of a canvas
+ * 
+ * @param  canvas  The canvas
+ */
+void canvas_destroy(canvas_t* restrict canvas)
+{
+  if (canvas->allocated)
+    free(canvas->pixels);
+  canvas->pixels = NULL;
+}
+
+
+/**
+ * Mark an area of a canvas as modified
+ * 
+ * @param  canvas  The canvas
+ * @param  rect    The modified area, must be inside the canvas
+ */
+void canvas_damage(canvas_t* restrict canvas, const canvas_rect_t* restrict rect)
+{
+  size_t i;
+  
+  if (!rect->width || !rect->height)
+    return;
+  
+  if (canvas->damage_count == CANVAS_MAX_DAMAGE)
+    {
+      for (i = 1; i < canvas->damage_count; i++)
+	rect_union(canvas->damage, canvas->damage + i);
+      canvas->damage_count = 1;
+      rect_union(canvas->damage, rect);
+      return;
+    }
+  
+  canvas->damage[canvas->damage_count++] = *rect;
+}
+
+
+/**
+ * Start drawing an PNM image onto a canvas, row by row, and clear the area
+ * the previously drawn image covered that the new image does not cover
+ * 
+ * @param  canvas  The canvas
+ * @param  xoff    The where onto the canvas the top-left corner of the image is drawn on the X-axis
+ * @param  yoff    The where onto the canvas the top-left corner of the image is drawn on the Y-axis
+ * @param  width   The width of the image
+ * @param  height  The height of the image
+ */
+void canvas_begin_image(canvas_t* restrict canvas, size_t xoff, size_t yoff, size_t width, size_t height)
+{
+  canvas_rect_t old = canvas->image;
+  canvas_rect_t new = { xoff, yoff, width, height };
+  size_t ix1, iy1, ix2, iy2;
+  
+  /* Clear the parts of the previous image that will not be overdrawn,
+   * the rest of the letterbox is already black. */
+  ix1 = old.x > new.x ? old.x : new.x;
+  iy1 = old.y > new.y ? old.y : new.y;
+  ix2 = old.x + old.width  < new.x + new.width  ? old.x + old.width  : new.x + new.width;
+  iy2 = old.y + old.height < new.y + new.height ? old.y + old.height : new.y + new.height;
+  if ((ix1 >= ix2) || (iy1 >= iy2))
+    clear_area(canvas, old.x, old.y, old.width, old.height);
+  else
+    {
+      clear_area(canvas, old.x, old.y, old.width, iy1 - old.y);
+      clear_area(canvas, old.x, iy2, old.width, old.y + old.height - iy2);
+      clear_area(canvas, old.x, iy1, ix1 - old.x, iy2 - iy1);
+      clear_area(canvas, ix2, iy1, old.x + old.width - ix2, iy2 - iy1);
+    }
+  
+  canvas->image = new;
+}
+
+
+/**
+ * Draw rows of the image started with `canvas_begin_image`
+ * 
+ * @param   canvas     The canvas
+ * @param   first_row  The index of the first row to draw
+ * @param   count      The number of rows to draw
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data, of the type described by `type`, of the first row to draw
+ * @return             Zero on success, -1 on error
+ */
+int canvas_draw_rows(canvas_t* restrict canvas, size_t first_row, size_t count,
+		     const pnm_levels_t* restrict levels, int type, const unsigned char* restrict pixeldata)
+{
+  canvas_rect_t band = { canvas->image.x, canvas->image.y + first_row, canvas->image.width, count };
+  
+  canvas_damage(canvas, &band);
+  
+  return blit_image(&(canvas->format),
+		    canvas->pixels + band.y * canvas->line_length + band.x * canvas->format.bytes_per_pixel,
+		    canvas->line_length, band.width, count, levels, type, pixeldata);
+}
+
+
+/**
+ * Draw an PNM image onto a canvas, and clear the area the previously
+ * drawn image covered that the new image does not cover
+ * 
+ * @param   canvas     The canvas
+ * @param   xoff       The where onto the canvas the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the canvas the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
+ */
+int canvas_draw_image(canvas_t* restrict canvas, size_t xoff, size_t yoff, size_t width, size_t height,
+		      const pnm_levels_t* restrict levels, int type, const unsigned char* restrict pixeldata)
+{
+  canvas_begin_image(canvas, xoff, yoff, width, height);
+  return canvas_draw_rows(canvas, 0, height, levels, type, pixeldata);
+}
+
+
+/**
+ * Copy the modified areas of a canvas to the screen
+ * 
+ * @param  canvas       The canvas, its damage will be reset
+ * @param  dest         The screen's pixels, in the same format as the canvas
+ * @param  line_length  The number of bytes between the start of successive rows in `dest`
+ */
+void canvas_flush(canvas_t* restrict canvas, void* restrict dest, size_t line_length)
+{
+  copy_areas(canvas, canvas->damage, canvas->damage_count, dest, line_length);
+  canvas_commit(canvas);
+}
+
+
+/**
+ * Reset the damage of a canvas that is itself the screen, the
+ * areas that were modified are kept in `canvas->last_damage`
+ * 
+ * @param  canvas  The canvas
+ */
+void canvas_commit(canvas_t* restrict canvas)
+{
+  memcpy(canvas->last_damage, canvas->damage, canvas->damage_count * sizeof(*(canvas->damage)));
+  canvas->last_damage_count = canvas->damage_count;
+  canvas->damage_count = 0;
+}
+
+
+/**
+ * Copy the modified areas of a canvas to the hidden page of a
+ * double buffered screen, that is, the areas modified since
+ * the last flush and those modified before it, as the hidden
+ * page was last updated two flushes ago
+ * 
+ * @param  canvas       The canvas, its damage will be reset
+ * @param  dest         The hidden page's pixels, in the same format as the canvas
+ * @param  line_length  The number of bytes between the start of successive rows in `dest`
+ */
+void canvas_flush_page(canvas_t* restrict canvas, void* restrict dest, size_t line_length)
+{
+  copy_areas(canvas, canvas->last_damage, canvas->last_damage_count, dest, line_length);
+  canvas_flush(canvas, dest, line_length);
+}
+
@@ -0,0 +1,255 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_CANVAS_H
+#define CRAZY_CANVAS_H
+
+
+#include <stddef.h>
+
+#include "blit.h"
+#include "pnm.h"
+
+
+
+/**
+ * The maximum number of damaged rectangles tracked separately,
+ * when exceeded they are merged into their bounding box
+ */
+#define CANVAS_MAX_DAMAGE  16
+
+
+
+/**
+ * A rectangle on a canvas
+ */
+typedef struct canvas_rect
+{
+  /**
+   * The X-position of the left edge
+   */
+  size_t x;
+  
+  /**
+   * The Y-position of the top edge
+   */
+  size_t y;
+  
+  /**
+   * The width, zero if the rectangle is empty
+   */
+  size_t width;
+  
+  /**
+   * The height, zero if the rectangle is empty
+   */
+  size_t height;
+  
+} canvas_rect_t;
+
+
+/**
+ * An in-memory back buffer that keeps track of which parts
+ * have been modified since it was last copied to the screen
+ */
+typedef struct canvas
+{
+  /**
+   * The pixels, initially black
+   */
+  unsigned char* pixels;
+  
+  /**
+   * Whether `pixels` was allocated by the canvas, rather
+   * than provided by the display system
+   */
+  int allocated;
+  
+  /**
+   * The width of the canvas, in pixels
+   */
+  size_t width;
+  
+  /**
+   * The height of the canvas, in pixels
+   */
+  size_t height;
+  
+  /**
+   * The number of bytes between the start of successive rows in `pixels`
+   */
+  size_t line_length;
+  
+  /**
+   * The pixel format
+   */
+  blit_format_t format;
+  
+  /**
+   * Whether the screen is uncached or write-combining memory, such as
+   * a mapped framebuffer, so that it is flushed to with non-temporal
+   * stores, zero unless set by the display system
+   */
+  int streaming;
+  
+  /**
+   * The area the last drawn image covers
+   */
+  canvas_rect_t image;
+  
+  /**
+   * The areas modified since the last flush
+   */
+  canvas_rect_t damage[CANVAS_MAX_DAMAGE];
+  
+  /**
+   * The number of elements in `damage`
+   */
+  size_t damage_count;
+  
+  /**
+   * The areas that were modified before the last flush
+   */
+  canvas_rect_t last_damage[CANVAS_MAX_DAMAGE];
+  
+  /**
+   * The number of elements in `last_damage`
+   */
+  size_t last_damage_count;
+  
+} canvas_t;
+
+
+
+/**
+ * Create a canvas, it will be black and wholly damaged
+ * 
+ * @param   canvas  Output parameter for the canvas
+ * @param   width   The width of the canvas, in pixels
+ * @param   height  The height of the canvas, in pixels
+ * @param   format  The pixel format
+ * @return          Zero on success, -1 on error
+ */
+int canvas_initialise(canvas_t* restrict canvas, size_t width, size_t height,
+		      const blit_format_t* restrict format);
+
+/**
+ * Create a canvas in memory provided by the display system, such as an
+ * image the display server reads directly, it will be black and wholly
+ * damaged, the damage is then reset with `canvas_commit` rather than
+ * copied with `canvas_flush`
+ * 
+ * @param  canvas       Output parameter for the canvas
+ * @param  width        The width of the canvas, in pixels
+ * @param  height       The height of the canvas, in pixels
+ * @param  format       The pixel format
+ * @param  pixels       The memory, it must remain valid until the canvas is destroyed
+ * @param  line_length  The number of bytes between the start of successive rows in `pixels`
+ */
+void canvas_wrap(canvas_t* restrict canvas, size_t width, size_t height, const blit_format_t* restrict format,
+		 void* restrict pixels, size_t line_length);
+
+/**
+ * Release the resources of a canvas
+ * 
+ * @param  canvas  The canvas
+ */
+void canvas_destroy(canvas_t* restrict canvas);
+
+/**
+ * Mark an area of a canvas as modified
+ * 
+ * @param  canvas  The canvas
+ * @param  rect    The modified area, must be inside the canvas
+ */
+void canvas_damage(canvas_t* restrict canvas, const canvas_rect_t* restrict rect);
+
+/**
+ * Start drawing an PNM image onto a canvas, row by row, and clear the area
+ * the previously drawn image covered that the new image does not cover
+ * 
+ * @param  canvas  The canvas
+ * @param  xoff    The where onto the canvas the top-left corner of the image is drawn on the X-axis
+ * @param  yoff    The where onto the canvas the top-left corner of the image is drawn on the Y-axis
+ * @param  width   The width of the image
+ * @param  height  The height of the image
+ */
+void canvas_begin_image(canvas_t* restrict canvas, size_t xoff, size_t yoff, size_t width, size_t height);
+
+/**
+ * Draw rows of the image started with `canvas_begin_image`
+ * 
+ * @param   canvas     The canvas
+ * @param   first_row  The index of the first row to draw
+ * @param   count      The number of rows to draw
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data, of the type described by `type`, of the first row to draw
+ * @return             Zero on success, -1 on error
+ */
+int canvas_draw_rows(canvas_t* restrict canvas, size_t first_row, size_t count,
+		     const pnm_levels_t* restrict levels, int type, const unsigned char* restrict pixeldata);
+
+/**
+ * Draw an PNM image onto a canvas, and clear the area the previously
+ * drawn image covered that the new image does not cover
+ * 
+ * @param   canvas     The canvas
+ * @param   xoff       The where onto the canvas the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the canvas the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
+ */
+int canvas_draw_image(canvas_t* restrict canvas, size_t xoff, size_t yoff, size_t width, size_t height,
+		      const pnm_levels_t* restrict levels, int type, const unsigned char* restrict pixeldata);
+
+/**
+ * Copy the modified areas of a canvas to the screen
+ * 
+ * @param  canvas       The canvas, its damage will be reset
+ * @param  dest         The screen's pixels, in the same format as the canvas
+ * @param  line_length  The number of bytes between the start of successive rows in `dest`
+ */
+void canvas_flush(canvas_t* restrict canvas, void* restrict dest, size_t line_length);
+
+/**
+ * Reset the damage of a canvas that is itself the screen, the
+ * areas that were modified are kept in `canvas->last_damage`
+ * 
+ * @param  canvas  The canvas
+ */
+void canvas_commit(canvas_t* restrict canvas);
+
+/**
+ * Copy the modified areas of a canvas to the hidden page of a
+ * double buffered screen, that is, the areas modified since
+ * the last flush and those modified before it, as the hidden
+ * page was last updated two flushes ago
+ * 
+ * @param  canvas       The canvas, its damage will be reset
+ * @param  dest         The hidden page's pixels, in the same format as the canvas
+ * @param  line_length  The number of bytes between the start of successive rows in `dest`
+ */
+void canvas_flush_page(canvas_t* restrict canvas, void* restrict dest, size_t line_length);
+
+
+#endif
+
@@ -0,0 +1,665 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "contact_sheet.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#include "crazy.h"
+#include "images.h"
+#include "manifest.h"
+#include "orientation.h"
+#include "pnm.h"
+#include "resize_cache.h"
+#include "transform.h"
+#include "util.h"
+#include "viewer.h"
+
+
+
+/**
+ * The space between the edge of a cell and its thumbnail, in pixels
+ */
+#define MARGIN  6
+
+/**
+ * The thumbnail has not been started
+ */
+#define THUMBNAIL_PENDING  0
+
+/**
+ * The thumbnail is being created
+ */
+#define THUMBNAIL_WORKING  1
+
+/**
+ * The thumbnail has been created
+ */
+#define THUMBNAIL_DONE  2
+
+/**
+ * The thumbnail could not be created
+ */
+#define THUMBNAIL_FAILED  3
+
+
+
+/**
+ * The thumbnail of a page
+ */
+typedef struct thumbnail
+{
+  /**
+   * The thumbnail, as a PNM image, `NULL` unless done
+   */
+  char* image;
+  
+  /**
+   * The number of bytes stored in `image`
+   */
+  size_t size;
+  
+  /**
+   * `THUMBNAIL_PENDING`, `THUMBNAIL_WORKING`, `THUMBNAIL_DONE`, or `THUMBNAIL_FAILED`
+   */
+  int state;
+  
+} thumbnail_t;
+
+
+
+/**
+ * The directory with the pages
+ */
+static const char* sheet_directory;
+
+/**
+ * The pages in `sheet_directory`
+ */
+static struct manifest sheet_manifest = { .pages = NULL, .count = 0 };
+
+/**
+ * The number of pages
+ */
+static size_t pages;
+
+/**
+ * The thumbnails of the pages, protected by `mutex`
+ */
+static thumbnail_t* thumbnails = NULL;
+
+/**
+ * The index of the first page on the screen, protected by `mutex`
+ */
+static size_t first_visible;
+
+/**
+ * Whether the workers shall stop, protected by `mutex`
+ */
+static int stopping;
+
+/**
+ * Protects the state shared with the workers
+ */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Pipe the workers write a byte to when a thumbnail is done
+ */
+static int notify_pipe[2] = { -1, -1 };
+
+/**
+ * The number of columns in the grid
+ */
+static size_t columns;
+
+/**
+ * The number of rows in the grid
+ */
+static size_t rows;
+
+/**
+ * The width of a cell
+ */
+static size_t cell_width;
+
+/**
+ * The height of a cell
+ */
+static size_t cell_height;
+
+/**
+ * The maximum width of a thumbnail
+ */
+static size_t thumbnail_width;
+
+/**
+ * The maximum height of a thumbnail
+ */
+static size_t thumbnail_height;
+
+
+
+/**
+ * Count the pages in the directory, the directory is
+ * listed once rather than probed page by page
+ * 
+ * @return  The number of pages, 0 on error
+ */
+static size_t count_pages(void)
+{
+  if (manifest_load(sheet_directory, &sheet_manifest))
+    return 0;
+  return manifest_run(&sheet_manifest, 1, 1);
+}
+
+
+/**
+ * Get the size of the thumbnail of a page
+ * 
+ * @param   width       The width of the page
+ * @param   height      The height of the page
+ * @param   corners     The orientation of the page
+ * @param   new_width   Output parameter for the width of the thumbnail, before it is oriented
+ * @param   new_height  Output parameter for the height of the thumbnail, before it is oriented
+ * @return              The return value of `get_resize_dimensions`
+ */
+static int thumbnail_size(size_t width, size_t height, const int corners[4],
+			  size_t* restrict new_width, size_t* restrict new_height)
+{
+  int resize_vertically;
+  
+  /* The orientation is applied to the thumbnail rather than to the page,
+   * so if the page is shown sideways, it is resized to fit sideways. */
+  if ((corners[0] - 1) / 2 != (corners[1] - 1) / 2)
+    resize_vertically = get_resize_dimensions(width, height, thumbnail_height, thumbnail_width,
+					      new_width, new_height);
+  else
+    resize_vertically = get_resize_dimensions(width, height, thumbnail_width, thumbnail_height,
+					      new_width, new_height);
+  *new_width  += !*new_width;
+  *new_height += !*new_height;
+  return resize_vertically;
+}
+
+
+/**
+ * Read a file
+ * 
+ * @param   path  The pathname of the file
+ * @param   data  Output parameter for the content of the file
+ * @param   size  Output parameter for the number of bytes stored in `data`
+ * @param   attr  Output parameter for the attributes of the file
+ * @return        Zero on success, -1 on error
+ */
+static int read_file(const char* path, char** restrict data, size_t* restrict size, struct stat* restrict attr)
+{
+  size_t ptr = 0;
+  ssize_t got;
+  int fd, saved_errno;
+  
+  *data = NULL;
+  t (fd = open(path, O_RDONLY | O_CLOEXEC), fd < 0);
+  t (fstat(fd, attr));
+  *size = (size_t)(attr->st_size);
+  t (*data = malloc(*size + !*size), *data == NULL);
+  while (ptr < *size)
+    {
+      got = read(fd, *data + ptr, *size - ptr);
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      if (got == 0)
+	break;
+      ptr += (size_t)got;
+    }
+  *size = ptr;
+  
+  close(fd);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  free(*data), *data = NULL;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Create the thumbnail of a page, or load it from the disk cache
+ * 
+ * @param   index      The index of the page
+ * @param   thumbnail  Output parameter for the thumbnail
+ * @param   size       Output parameter for the number of bytes stored in `thumbnail`
+ * @return             Zero on success, -1 on error
+ */
+static int make_thumbnail(size_t index, char** restrict thumbnail, size_t* restrict size)
+{
+  char* path = NULL;
+  char* image = NULL;
+  char* oriented = NULL;
+  size_t image_size, width, height, new_width, new_height;
+  int state, comment, type, resize_vertically, saved_errno;
+  int corners[4];
+  unsigned int maxval;
+  struct stat attr;
+  resize_cache_key_t key;
+  const struct manifest_page* page;
+  
+  *thumbnail = NULL;
+  
+  aprintf(&path, "%s/%zu.pnm", sheet_directory, index + 1);
+  t (path == NULL);
+  t (orientation_read(path, corners));
+  
+  /* If the page is as the manifest describes it, its size is known, so
+   * a cached thumbnail can be loaded without reading the page. */
+  page = manifest_find(&sheet_manifest, index + 1);
+  if ((page != NULL) && page->type && page->width && page->height && !stat(path, &attr) &&
+      ((uintmax_t)(attr.st_ino) == page->inode) && ((uintmax_t)(attr.st_size) == page->size) &&
+      (attr.st_mtim.tv_sec == page->mtime.tv_sec) && (attr.st_mtim.tv_nsec == page->mtime.tv_nsec))
+    {
+      thumbnail_size(page->width, page->height, corners, &new_width, &new_height);
+      resize_cache_key(&key, &attr, new_width, new_height, RESIZE_FILTER);
+      if (resize_cache_load_file(&key, thumbnail, size) > 0)
+	goto orient;
+    }
+  
+  t (read_file(path, &image, &image_size, &attr));
+  
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
+  pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, image_size, image);
+  t ((state < 10) || !width || !height ? (errno = EINVAL) : 0);
+  
+  resize_vertically = thumbnail_size(width, height, corners, &new_width, &new_height);
+  resize_cache_key(&key, &attr, new_width, new_height, RESIZE_FILTER);
+  if (resize_cache_load_file(&key, thumbnail, size) <= 0)
+    {
+      t (resize_image(new_width, new_height, resize_vertically, image, image_size, thumbnail, size));
+      resize_cache_store_file(&key, *thumbnail, *size);
+    }
+  
+ orient:
+  if (!orientation_is_identity(corners))
+    {
+      t (transform_image(*thumbnail, *size, corners[0], corners[1], corners[2], corners[3],
+			 &oriented, size));
+      free(*thumbnail), *thumbnail = oriented;
+    }
+  
+  free(image);
+  free(path);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(*thumbnail), *thumbnail = NULL;
+  free(image);
+  free(path);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Get the next page to create a thumbnail for, the pages on
+ * the screen and below it are done first, and then those above it
+ * 
+ * `mutex` must be held
+ * 
+ * @return  The index of the page, `pages` if there is none left
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static size_t next_job(void)
+{
+  size_t i;
+  
+  for (i = first_visible; i < pages; i++)
+    if (thumbnails[i].state == THUMBNAIL_PENDING)
+      return i;
+  for (i = 0; i < first_visible; i++)
+    if (thumbnails[i].state == THUMBNAIL_PENDING)
+      return i;
+  return pages;
+}
+
+
+/**
+ * Create thumbnails until there are none left or the sheet is closed
+ * 
+ * @param   arg  Not used
+ * @return       `NULL`
+ */
+static void* thumbnail_worker(void* arg)
+{
+  char* image;
+  size_t i, size;
+  int r;
+  
+  (void) arg;
+  
+  pthread_mutex_lock(&mutex);
+  while (!stopping && ((i = next_job()) < pages))
+    {
+      thumbnails[i].state = THUMBNAIL_WORKING;
+      pthread_mutex_unlock(&mutex);
+      r = make_thumbnail(i, &image, &size);
+      pthread_mutex_lock(&mutex);
+      thumbnails[i].image = r ? NULL : image;
+      thumbnails[i].size  = r ? 0 : size;
+      thumbnails[i].state = r ? THUMBNAIL_FAILED : THUMBNAIL_DONE;
+      while ((write(notify_pipe[1], "", 1) < 0) && (errno == EINTR));
+    }
+  pthread_mutex_unlock(&mutex);
+  
+  return NULL;
+}
+
+
+/**
+ * Fill a rectangle on the sheet with a grey level
+ * 
+ * @param  sheet   The sheet, in 8-bit RGB
+ * @param  x       The X-position of the left edge
+ * @param  y       The Y-position of the top edge
+ * @param  width   The width of the rectangle
+ * @param  height  The height of the rectangle
+ * @param  value   The grey level
+ */
+static void fill(unsigned char* restrict sheet, size_t x, size_t y, size_t width, size_t height, int value)
+{
+  size_t stride = columns * cell_width * 3;
+  for (sheet += y * stride + x * 3; height--; sheet += stride)
+    memset(sheet, value, width * 3);
+}
+
+
+/**
+ * Draw a thumbnail, centred, onto a cell in the sheet
+ * 
+ * @param   sheet      The sheet, in 8-bit RGB
+ * @param   cell_x     The X-position of the left edge of the cell
+ * @param   cell_y     The Y-position of the top edge of the cell
+ * @param   thumbnail  The thumbnail
+ * @return             Zero on success, -1 on error
+ */
+static int paste_thumbnail(unsigned char* restrict sheet, size_t cell_x, size_t cell_y,
+			   const thumbnail_t* restrict thumbnail)
+{
+  size_t stride = columns * cell_width * 3;
+  size_t offset, width, height, row_size, x, y;
+  int state, comment, type;
+  unsigned int maxval;
+  pnm_levels_t levels = { .maxval = 0, .table = NULL };
+  unsigned char* row = NULL;
+  unsigned char* d;
+  const unsigned char* s;
+  
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
+  offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height,
+			    thumbnail->size, thumbnail->image);
+  if ((state < 10) || (type < 4) || (type > 6) || (maxval < 1) ||
+      (thumbnail->size - offset < pnm_payload_size(type, maxval, width, height)))
+    return errno = EINVAL, -1;
+  row_size = pnm_row_size(type, maxval, width);
+  s = (const unsigned char*)(thumbnail->image) + offset;
+  
+  t (pnm_levels_init(&levels, type == 4 ? 255 : maxval));
+  t (row = malloc(3 * width + !width), row == NULL);
+  
+  width  = width  < thumbnail_width  ? width  : thumbnail_width;
+  height = height < thumbnail_height ? height : thumbnail_height;
+  d = sheet + (cell_y + (cell_height - height) / 2) * stride + (cell_x + (cell_width - width) / 2) * 3;
+  
+  for (y = 0; y < height; y++, s += row_size, d += stride)
+    {
+      if (type == 4)
+	pnm_unpack_lineart(row, s, width);
+      else if (levels.table == NULL)
+	memcpy(row, s, width * (type == 6 ? 3 : 1));
+      else
+	pnm_levels_convert(&levels, row, s, width * (type == 6 ? 3 : 1));
+      if (type == 6)
+	memcpy(d, row, width * 3);
+      else
+	for (x = 0; x < width; x++)
+	  d[3 * x + 0] = d[3 * x + 1] = d[3 * x + 2] = row[x];
+    }
+  
+  free(row);
+  pnm_levels_destroy(&levels);
+  return 0;
+ fail:
+  free(row);
+  pnm_levels_destroy(&levels);
+  return -1;
+}
+
+
+/**
+ * Draw the visible part of the sheet
+ * 
+ * @param   sheet          Buffer for the sheet, in 8-bit RGB
+ * @param   selected       The index of the selected page
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @param   draw           Function that draws the sheet onto the screen
+ * @return                 Zero on success, -1 on error
+ */
+static int render(unsigned char* restrict sheet, size_t selected, size_t screen_width,
+		  size_t screen_height, display_draw_func_t* draw)
+{
+  pnm_levels_t levels = { .maxval = 255, .table = NULL };
+  size_t width = columns * cell_width, height = rows * cell_height;
+  size_t i, r, c, x, y;
+  
+  memset(sheet, 0, width * height * 3);
+  
+  pthread_mutex_lock(&mutex);
+  for (i = first_visible, r = 0; r < rows; r++)
+    for (c = 0; (c < columns) && (i < pages); c++, i++)
+      {
+	x = c * cell_width;
+	y = r * cell_height;
+	if (i == selected)
+	  {
+	    fill(sheet, x + MARGIN / 2, y + MARGIN / 2, cell_width - MARGIN, cell_height - MARGIN, 255);
+	    fill(sheet, x + MARGIN, y + MARGIN, thumbnail_width, thumbnail_height, 0);
+	  }
+	if (thumbnails[i].state == THUMBNAIL_DONE)
+	  paste_thumbnail(sheet, x, y, thumbnails + i);
+	else if (thumbnails[i].state != THUMBNAIL_FAILED)
+	  fill(sheet, x + MARGIN, y + MARGIN, thumbnail_width, thumbnail_height, 0x30);
+      }
+  pthread_mutex_unlock(&mutex);
+  
+  return draw((screen_width - width) / 2, (screen_height - height) / 2, width, height, &levels, 6, sheet);
+}
+
+
+/**
+ * Show the pages in a directory, 1.pnm, 2.pnm, and so on, as a
+ * grid of thumbnails, the thumbnails are created in the background,
+ * those on the screen first and then the rest in scroll order,
+ * and are cached on disk, the keys are:
+ * 
+ *   arrows, h/j/k/l         Select another page
+ *   page up, page down, b,  Scroll by one screen
+ *   space
+ *   enter                   Zoom and pan around the selected page
+ *   q, escape               Exit
+ * 
+ * @param   directory      The directory with the pages
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @param   draw           Function that draws the grid onto the screen
+ * @param   keys           Where the keys pressed by the user are read from
+ * @return                 Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+int contact_sheet_run(const char* directory, size_t screen_width, size_t screen_height,
+		      display_draw_func_t* draw, const display_keys_t* restrict keys)
+{
+  pthread_t workers[CONTACT_SHEET_MAX_WORKERS];
+  size_t i, started = 0, selected = 0, first_row, page_cells;
+  unsigned char* sheet = NULL;
+  struct termios stty;
+  struct termios saved_stty;
+  int have_stty = 0, saved_errno;
+  char pressed[16];
+  char* path;
+  ssize_t got, k;
+  long int cpus;
+  
+  /* Find the pages and lay out the grid. */
+  sheet_directory = directory;
+  pages = count_pages();
+  if (pages == 0)
+    {
+      fprintf(stderr, "%s: %s: no pages found\n", execname, directory);
+      manifest_destroy(&sheet_manifest);
+      return errno = 0, -1;
+    }
+  columns = screen_width  / CONTACT_SHEET_CELL, columns += !columns;
+  rows    = screen_height / CONTACT_SHEET_CELL, rows    += !rows;
+  cell_width  = screen_width  / columns;
+  cell_height = screen_height / rows;
+  thumbnail_width  = cell_width  > 2 * MARGIN ? cell_width  - 2 * MARGIN : 1;
+  thumbnail_height = cell_height > 2 * MARGIN ? cell_height - 2 * MARGIN : 1;
+  page_cells = columns * rows;
+  
+  t (thumbnails = calloc(pages, sizeof(*thumbnails)), thumbnails == NULL);
+  t (sheet = malloc(columns * cell_width * rows * cell_height * 3), sheet == NULL);
+  t (pipe2(notify_pipe, O_CLOEXEC | O_NONBLOCK));
+  
+  /* Start creating thumbnails. */
+  stopping = 0;
+  first_visible = 0;
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpus = cpus < 1 ? 1 : cpus > CONTACT_SHEET_MAX_WORKERS ? CONTACT_SHEET_MAX_WORKERS : cpus;
+  for (; started < (size_t)cpus; started++)
+    if ((errno = pthread_create(workers + started, NULL, thumbnail_worker, NULL)))
+      {
+	t (started == 0);
+	break;
+      }
+  
+  /* Read keys one at a time, if they are typed in the terminal. */
+  if (!tcgetattr(keys->fd, &stty))
+    {
+      saved_stty = stty, have_stty = 1;
+      stty.c_lflag &= (tcflag_t)~(ICANON | ECHO | ISIG);
+      tcsetattr(keys->fd, TCSAFLUSH, &stty);
+    }
+  
+  for (;;)
+    {
+      /* Scroll the selected page into view. */
+      first_row = first_visible / columns;
+      if (selected / columns < first_row)
+	first_row = selected / columns;
+      else if (selected / columns >= first_row + rows)
+	first_row = selected / columns - rows + 1;
+      pthread_mutex_lock(&mutex);
+      first_visible = first_row * columns;
+      pthread_mutex_unlock(&mutex);
+      
+      t (render(sheet, selected, screen_width, screen_height, draw));
+      
+      /* Wait for a key, or for a thumbnail to be created. */
+      got = display_wait_keys(keys, pressed, sizeof(pressed), notify_pipe[0]);
+      if (got < 0)
+	{
+	  t ((errno != EINTR) && (errno != EAGAIN));
+	  while (read(notify_pipe[0], pressed, sizeof(pressed)) > 0);
+	  continue;
+	}
+      if ((got == 0) || ((got == 1) && (*pressed == '\033')))
+	break;
+      
+      for (k = 0; k < got; k++)
+	{
+	  if ((pressed[k] == '\033') && (k + 2 < got) && (pressed[k + 1] == '['))
+	    {
+	      k += 2;
+	      if (('A' <= pressed[k]) && (pressed[k] <= 'D'))
+		pressed[k] = "kjlh"[pressed[k] - 'A'];
+	      else if ((k + 1 < got) && (pressed[k + 1] == '~'))
+		k += 1, pressed[k] = pressed[k - 1] == '5' ? 'b' : pressed[k - 1] == '6' ? ' ' : '~';
+	    }
+	  switch (pressed[k])
+	    {
+	    case 'h':  selected -= selected > 0;  break;
+	    case 'l':  selected += selected + 1 < pages;  break;
+	    case 'k':  selected -= selected >= columns ? columns : 0;  break;
+	    case 'j':  selected += selected + columns < pages ? columns : 0;  break;
+	    case 'b':  selected = selected > page_cells ? selected - page_cells : 0;  break;
+	    case ' ':  selected = selected + page_cells < pages ? selected + page_cells : pages - 1;  break;
+	    case '\n':
+	      aprintf(&path, "%s/%zu.pnm", sheet_directory, selected + 1);
+	      t (path == NULL);
+	      if (viewer_run(path, screen_width, screen_height, draw, keys) && errno)
+		perror(execname);
+	      free(path);
+	      break;
+	    case 'q':
+	      goto done;
+	    default:
+	      break;
+	    }
+	}
+    }
+  
+ done:
+  saved_errno = 0;
+  goto cleanup;
+ fail:
+  saved_errno = errno;
+ cleanup:
+  if (have_stty)
+    tcsetattr(keys->fd, TCSAFLUSH, &saved_stty);
+  pthread_mutex_lock(&mutex);
+  stopping = 1;
+  pthread_mutex_unlock(&mutex);
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  if (thumbnails != NULL)
+    for (i = 0; i < pages; i++)
+      free(thumbnails[i].image);
+  free(thumbnails), thumbnails = NULL;
+  manifest_destroy(&sheet_manifest);
+  free(sheet);
+  if (notify_pipe[0] >= 0)
+    close(notify_pipe[0]), close(notify_pipe[1]), notify_pipe[0] = notify_pipe[1] = -1;
+  errno = saved_errno;
+  return saved_errno ? -1 : 0;
+}
+
@@ -0,0 +1,68 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_CONTACT_SHEET_H
+#define CRAZY_CONTACT_SHEET_H
+
+
+#include <stddef.h>
+
+#include "display.h"
+
+
+/**
+ * The preferred size of a cell in the contact sheet, in pixels,
+ * the number of columns and rows is chosen so that the cells
+ * are about this size
+ */
+#ifndef CONTACT_SHEET_CELL
+# define CONTACT_SHEET_CELL  240
+#endif
+
+/**
+ * The maximum number of threads that create thumbnails
+ */
+#ifndef CONTACT_SHEET_MAX_WORKERS
+# define CONTACT_SHEET_MAX_WORKERS  8
+#endif
+
+
+/**
+ * Show the pages in a directory, 1.pnm, 2.pnm, and so on, as a
+ * grid of thumbnails, the thumbnails are created in the background,
+ * those on the screen first and then the rest in scroll order,
+ * and are cached on disk, the keys are:
+ * 
+ *   arrows, h/j/k/l         Select another page
+ *   page up, page down, b,  Scroll by one screen
+ *   space
+ *   enter                   Zoom and pan around the selected page
+ *   q, escape               Exit
+ * 
+ * @param   directory      The directory with the pages
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @param   draw           Function that draws the grid onto the screen
+ * @param   keys           Where the keys pressed by the user are read from
+ * @return                 Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+int contact_sheet_run(const char* directory, size_t screen_width, size_t screen_height,
+		      display_draw_func_t* draw, const display_keys_t* restrict keys);
+
+
+#endif
+
@@ -18,9 +18,9 @@
 #include "crazy.h"
 
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +32,12 @@
 
 #include "display.h"
 #include "display_fb.h"
+#include "display_mem.h"
+#include "display_term.h"
+#include "display_x.h"
+#include "images.h"
+#include "resize_cache.h"
+#include "transform.h"
 #include "util.h"
 
 
@@ -97,6 +103,11 @@ static char* postimg = NULL;
  */
 static display_t display;
 
+/**
+ * Whether to print statistics on exit
+ */
+static int print_stats = 0;
+
 
 
 /**
@@ -107,8 +118,8 @@ static display_t display;
  */
 static char** get_devices(ssize_t* restrict count)
 {
-  pid_t pid, reaped;
-  int fd, status;
+  subprocess_t proc;
+  int fd = -1;
   char** rc = NULL;
   char* line = NULL;
   size_t linesize = 0;
@@ -118,9 +129,10 @@ static char** get_devices(ssize_t* restrict count)
   char* q;
   
   /* Start listing devices. */
-  fd = subprocess_rd("scanimage", (const char* const[]){"scanimage", "-L", NULL}, 1, &pid);
+  t (subprocess_spawn(&proc, "scanimage", (const char* const[]){"scanimage", "-L", NULL},
+		      SUBPROCESS_STDOUT | SUBPROCESS_LANG_C));
+  fd = proc.stdout_fd;
   /* Output line format: device `DEVICE_ADDRESS' is a DEVICE_NAME_AND_TYPE */
-  t (fd < 0);
   
   /* Retrieve device list. */
   *count = 0;
@@ -130,7 +142,7 @@ static char** get_devices(ssize_t* restrict count)
       t (len < 0);
       if (len == 0)
 	break;
-
+      
       /* Check end of list. (For when nothing is found, scanimage is a bit odd here) */
       if (*line == '\n')
 	break;
@@ -171,18 +183,7 @@ static char** get_devices(ssize_t* restrict count)
   free(line), line = NULL;
   
   /* Reap device lister. */
-  for (;;)
-    {
-      reaped = wait(&status);
-      t (reaped < 0);
-      if (reaped == pid)
-	{
-	  if (!status)
-	    break;
-	  errno = 0;
-	  goto fail;
-	}
-    }
+  t (subprocess_reap(&proc));
   
   /* Done. */
   close(fd);
@@ -266,22 +267,28 @@ static int select_item(char** restrict selected, char** restrict list, size_t n,
 
 
 /**
- * Scan an image
+ * Scan an image, and display it while it is being scanned,
+ * and again after it has been postprocessed, rotated and mirrored
  * 
- * @param   image  Output parameter for the image buffer
- * @return         Zero on and only on success
+ * @param   image       Output parameter for the image buffer
+ * @param   image_size  Output parameter for the number of bytes stored in `*image`
+ * @return              Zero on and only on success
  */
-static int scan_image(char** image)
+static int scan_image(char** restrict image, size_t* restrict image_size)
 {
   char* sh = NULL;
   const char* mode_ = mode == 0 ? "lineart" : mode == 1 ? "gray" : "color"; /* [sic!] */
   char threshold[sizeof(" --threshold -") + 3 * sizeof(int)];
-  int fd = -1;
-  pid_t pid;
+  char* processed;
+  size_t processed_size;
+  int fd = -1, redisplay = 0, saved_errno;
+  subprocess_t proc;
   
   /* Init. */
   *image = NULL;
+  *image_size = 0;
   *threshold = '\0';
+  proc.pid = -1;
   
   /* Construct scan command. */
   if (mode == 0)
@@ -291,22 +298,58 @@ static int scan_image(char** image)
   t (sh == NULL);
   
   /* Start scanner process. */
-  fd = subprocess_rd("sh", (const char* const[]){"sh", "-c", sh}, 0, &pid);
-  t (fd < 0);
+  t (subprocess_spawn(&proc, "sh", (const char* const[]){"sh", "-c", sh, NULL}, SUBPROCESS_STDOUT));
+  fd = proc.stdout_fd;
+  
+  /* Display the image while it is being scanned, the scanner is reaped when it is done. */
+  t (display_read_image(&display, fd, &proc, image, image_size));
+  close(fd), fd = -1;
+  
+  /* Postprocess the image. */
+  if (postimg != NULL)
+    {
+      if (filter_image(postimg, *image, *image_size, &processed, &processed_size))
+	{
+	  if (!errno)
+	    fprintf(stderr, "%s: postprocessing failed\n", execname);
+	  goto fail;
+	}
+      free(*image);
+      *image = processed;
+      *image_size = processed_size;
+      redisplay = 1;
+    }
+  
+  /* Rotate and mirror the image as selected with --rotate, --mirror-x, and --mirror-y. */
+  if ((c1 != 1) || (c2 != 2) || (c3 != 3) || (c4 != 4))
+    {
+      t (transform_image(*image, *image_size, c1, c2, c3, c4, &processed, &processed_size));
+      free(*image);
+      *image = processed;
+      *image_size = processed_size;
+      redisplay = 1;
+    }
   
-  /* TODO */
+  /* Display the result. */
+  if (redisplay)
+    t (display_read_image(&display, -1, NULL, image, image_size));
   
   /* Done. */
-  close(pipe_rw[0]);
+  free(sh);
   return 0;
  fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  if (proc.pid >= 0)
+    subprocess_reap(&proc);
+  errno = saved_errno;
   if (errno)
     perror(execname);
   free(*image);
   *image = NULL;
+  *image_size = 0;
   free(sh);
-  if (pipe_rw[0] >= 0)  close(pipe_rw[0]);
-  if (pipe_rw[1] >= 0)  close(pipe_rw[1]);
   return -1;
 }
 
@@ -344,6 +387,36 @@ static void apply_transformation(int r, int x, int y)
 }
 
 
+/**
+ * Print statistics to stderr
+ */
+static void print_statistics(void)
+{
+  resize_cache_stats_t cache;
+  display_stats_t frames;
+  unsigned long long int mean;
+  
+  resize_cache_get_stats(&cache);
+  display_get_stats(&frames);
+  fprintf(stderr, "%s: resize cache: %zu memory hits, %zu disk hits, %zu misses, %zu evictions\n",
+	  execname, cache.memory_hits, cache.disk_hits, cache.misses, cache.evictions);
+  fprintf(stderr, "%s: resize cache: %zu images, %zu of %zu bytes in memory\n",
+	  execname, cache.entries, cache.memory_used, cache.memory_limit);
+  if (frames.frames)
+    {
+      mean = frames.total_ns / frames.frames;
+      fprintf(stderr, "%s: display: %zu frames, last %llu.%03llu ms, "
+	      "mean %llu.%03llu ms, max %llu.%03llu ms\n", execname, frames.frames,
+	      frames.last_ns / 1000000ULL, frames.last_ns / 1000ULL % 1000ULL,
+	      mean / 1000000ULL, mean / 1000ULL % 1000ULL,
+	      frames.max_ns / 1000000ULL, frames.max_ns / 1000ULL % 1000ULL);
+    }
+  if (frames.bands)
+    fprintf(stderr, "%s: preview: %zu bands read, %zu skipped\n",
+	    execname, frames.bands, frames.skipped_bands);
+}
+
+
 /**
  * Everything begins "here"
  * 
@@ -365,6 +438,12 @@ int main(int argc, char* argv[])
   char** devices = NULL;
   int mirrorx = 0, mirrory = 0, rotation = 0;
   int display_initialised = 0;
+  long int cache_size = (long int)(RESIZE_CACHE_DEFAULT_LIMIT >> 20);
+  const char* display_system = NULL;
+  const char* view = NULL;
+  const char* browse = NULL;
+  char* image;
+  size_t image_size;
   
   
   /* Parse command line. */
@@ -409,6 +488,24 @@ int main(int argc, char* argv[])
   args_add_option(args_new_argumented(NULL, (char*)"ROTATION", 0, (char*)"-r", (char*)"--rotate", NULL),
 		  (char*)"Select rotation: 0|90|180|270");
   
+  args_add_option(args_new_argumented(NULL, (char*)"MIB", 0, (char*)"-c", (char*)"--cache-size", NULL),
+		  (char*)"Select how many mebibytes of resized images to keep in memory");
+  
+  args_add_option(args_new_argumentless(NULL, 0, (char*)"-C", (char*)"--cache-spill", NULL),
+		  (char*)"Store resized images evicted from memory under $XDG_CACHE_HOME");
+  
+  args_add_option(args_new_argumentless(NULL, 0, (char*)"-S", (char*)"--stats", NULL),
+		  (char*)"Print statistics on exit");
+  
+  args_add_option(args_new_argumented(NULL, (char*)"SYSTEM", 0, (char*)"-D", (char*)"--display", NULL),
+		  (char*)"Select display system: fb|x|term[:kitty|:sixel]|mem[:WIDTHxHEIGHT[:FORMAT[:DIRECTORY]]]");
+  
+  args_add_option(args_new_argumented(NULL, (char*)"FILE", 0, (char*)"-V", (char*)"--view", NULL),
+		  (char*)"Zoom and pan around a scanned PNM image instead of scanning");
+  
+  args_add_option(args_new_argumented(NULL, (char*)"DIRECTORY", 0, (char*)"-G", (char*)"--contact-sheet", NULL),
+		  (char*)"Show the pages in a directory as a grid of thumbnails instead of scanning");
+  
   
   args_parse(argc, argv);
   args_support_alternatives();
@@ -485,10 +582,10 @@ int main(int argc, char* argv[])
     }
   mirrorx = !!args_opts_used((char*)"--mirror-x");
   mirrory = !!args_opts_used((char*)"--mirror-y");
-  if (args_opts_used((char*)"--rotation"))
+  if (args_opts_used((char*)"--rotate"))
     {
-      args = args_opts_get((char*)"--rotation");
-      if ((args_opts_get_count((char*)"--rotation") != 1) || (*args == NULL))
+      args = args_opts_get((char*)"--rotate");
+      if ((args_opts_get_count((char*)"--rotate") != 1) || (*args == NULL))
 	goto invalid_opts;
       rotation = atoi(*args) % 360;
       if (rotation < 0)
@@ -496,9 +593,94 @@ int main(int argc, char* argv[])
       if (rotation % 90)
 	goto invalid_opts;
     }
+  if (args_opts_used((char*)"--cache-size"))
+    {
+      args = args_opts_get((char*)"--cache-size");
+      if ((args_opts_get_count((char*)"--cache-size") != 1) || (*args == NULL))
+	goto invalid_opts;
+      cache_size = atol(*args);
+      if ((cache_size < 0) || ((unsigned long int)cache_size > SIZE_MAX >> 20))
+	goto invalid_opts;
+    }
+  print_stats = !!args_opts_used((char*)"--stats");
+  if (args_opts_used((char*)"--display"))
+    {
+      args = args_opts_get((char*)"--display");
+      if ((args_opts_get_count((char*)"--display") != 1) || (*args == NULL))
+	goto invalid_opts;
+      display_system = *args;
+      if (!strcmp(display_system, "mem"))
+	t (display_mem_configure(NULL));
+      else if (!strncmp(display_system, "mem:", 4))
+	{
+	  if (display_mem_configure(display_system + 4))
+	    {
+	      if (errno != EINVAL)
+		goto fail;
+	      goto invalid_opts;
+	    }
+	}
+      else if (!strcmp(display_system, "term"))
+	t (display_term_configure(NULL));
+      else if (!strncmp(display_system, "term:", 5))
+	{
+	  if (display_term_configure(display_system + 5))
+	    goto invalid_opts;
+	}
+      else if (strcmp(display_system, "fb") && strcmp(display_system, "x"))
+	goto invalid_opts;
+    }
+  if (args_opts_used((char*)"--view"))
+    {
+      args = args_opts_get((char*)"--view");
+      if ((args_opts_get_count((char*)"--view") != 1) || (*args == NULL))
+	goto invalid_opts;
+      view = *args;
+    }
+  if (args_opts_used((char*)"--contact-sheet"))
+    {
+      args = args_opts_get((char*)"--contact-sheet");
+      if ((args_opts_get_count((char*)"--contact-sheet") != 1) || (*args == NULL))
+	goto invalid_opts;
+      browse = *args;
+    }
+  t (resize_cache_configure((size_t)cache_size << 20, !!args_opts_used((char*)"--cache-spill")));
   
   /* Start. */
   
+  /* Select display system, X is used by default when running inside X,
+   * and terminal graphics when logged in remotely without X. */
+  if (display_system == NULL)
+    {
+      if (strchr(getenv("DISPLAY") ?: "", ':'))
+	display_system = "x";
+      else if (getenv("SSH_TTY") || getenv("SSH_CONNECTION"))
+	display_system = "term";
+      else
+	display_system = "fb";
+    }
+  if (!strncmp(display_system, "mem", 3))
+    display_mem_get(&display);
+  else if (!strncmp(display_system, "term", 4))
+    display_term_get(&display);
+  else if (!strcmp(display_system, "x"))
+    display_x_get(&display);
+  else
+    display_fb_get(&display);
+  
+  
+  /* Inspect an image or a directory of pages instead of scanning. */
+  if ((view != NULL) || (browse != NULL))
+    {
+      t (display.initialise());
+      display_initialised = 1;
+      if (view != NULL)
+	t (display.inspect(view));
+      else
+	t (display.browse(browse));
+      goto exit;
+    }
+  
   /* Find scanner. */
   if (device == NULL)
     {
@@ -555,25 +737,22 @@ int main(int argc, char* argv[])
   apply_transformation(rotation, mirrorx, mirrory);
   
   
-  /* Select display system. */
-  display_fb_get(&display);
-  /*
-  if (strchr(getenv("DISPLAY") ?: "", ':'))
-    display_x_get(&display);
-  */
-  
-  
   /* Start display system. */
   t (display.initialise());
   display_initialised = 1;
   
   
-  /* TODO  Start scanning. */
+  /* Scan a page, and preview it. */
+  t (scan_image(&image, &image_size));
+  free(image);
   
   /* Done. */
  exit:
   if (display_initialised)
     display.terminate();
+  if (print_stats)
+    print_statistics();
+  resize_cache_terminate();
   if (devices != NULL)
     {
       while (device_count)
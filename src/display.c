@@ -0,0 +1,706 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "display.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "crazy.h"
+#include "images.h"
+#include "resize_cache.h"
+#include "ring.h"
+
+
+
+/**
+ * While an image is being read, it is passed to the
+ * thread that draws it in about this many bands
+ */
+#ifndef PROGRESS_BANDS
+# define PROGRESS_BANDS  32
+#endif
+
+/**
+ * The number of bands that can be waiting to be drawn,
+ * when it is full, bands are skipped rather than waited for
+ */
+#ifndef PROGRESS_SLOTS
+# define PROGRESS_SLOTS  8
+#endif
+
+
+
+/**
+ * The header of a slot in the ring of bands, the
+ * rows of the image as it is read follows it
+ */
+struct band
+{
+  /**
+   * The index of the first row
+   */
+  size_t first_row;
+  
+  /**
+   * The number of rows
+   */
+  size_t rows;
+};
+
+
+/**
+ * The state of the drawing of an image while it is being read
+ */
+struct progress
+{
+  /**
+   * The image as it is drawn
+   */
+  display_header_t header;
+  
+  /**
+   * Lookup table for `header.maxval`
+   */
+  pnm_levels_t levels;
+  
+  /**
+   * The display system
+   */
+  const display_t* display;
+  
+  /**
+   * 4: raw lineart, 5: raw greyscale, 6: raw colour, for the image as it is read
+   */
+  int type;
+  
+  /**
+   * The width of the image as it is read
+   */
+  size_t width;
+  
+  /**
+   * The height of the image as it is read
+   */
+  size_t height;
+  
+  /**
+   * The number of bytes per row in the image as it is read
+   */
+  size_t row_size;
+  
+  /**
+   * The number of bytes per pixel in the image as it is drawn
+   */
+  size_t pixel_size;
+  
+  /**
+   * The column in the image as it is read for each column in the image as
+   * it is drawn, `NULL` if the image is drawn as it is read
+   */
+  size_t* columns;
+  
+  /**
+   * The image as it is drawn, the parts that have been received
+   */
+  unsigned char* image;
+  
+  /**
+   * The number of rows of the image as it is read per band
+   */
+  size_t band_rows;
+  
+  /**
+   * The number of rows that have been passed to the drawing thread, or skipped
+   */
+  size_t pushed;
+  
+  /**
+   * The bands that have been read but not drawn
+   */
+  ring_t ring;
+  
+  /**
+   * The thread that draws the bands
+   */
+  pthread_t thread;
+  
+  /**
+   * Whether `thread` is running
+   */
+  int running;
+  
+  /**
+   * The `errno` of the first failure in `thread`, zero if none
+   */
+  int error;
+};
+
+
+
+/**
+ * Timing of the frames that have been drawn
+ */
+static display_stats_t frame_stats = { .frames = 0, .total_ns = 0, .max_ns = 0, .last_ns = 0,
+				       .bands = 0, .skipped_bands = 0 };
+
+
+
+/**
+ * Read the keys that have been typed in the terminal, without blocking
+ * 
+ * @param   keys  Output buffer for the keys
+ * @param   size  The size of `keys`
+ * @return        The number of bytes stored in `keys`, zero at end of input,
+ *                -1 on error, `errno` is set to `EAGAIN` if no keys are available
+ */
+static ssize_t display_tty_read_keys(char* keys, size_t size)
+{
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+  int r = poll(&pfd, 1, 0);
+  if (r <= 0)
+    return r ? -1 : (errno = EAGAIN, -1);
+  return read(STDIN_FILENO, keys, size);
+}
+
+
+/**
+ * Keys typed in the terminal, on stdin, used by
+ * the display systems that do not open a window
+ */
+const display_keys_t display_tty_keys = { .fd = STDIN_FILENO, .read = display_tty_read_keys };
+
+
+
+/**
+ * Get the first row of the image as it is drawn that
+ * shows a row of the image as it is read
+ * 
+ * @param   progress  The state of the drawing
+ * @param   row       The row in the image as it is read
+ * @return            The first row in the image as it is drawn that is at or below `row`
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static size_t progress_map_row(const struct progress* restrict progress, size_t row)
+{
+  size_t height = progress->header.height;
+  return row >= progress->height ? height : (row * height + progress->height - 1) / progress->height;
+}
+
+
+/**
+ * Add a band to the image as it is drawn
+ * 
+ * @param   progress  The state of the drawing
+ * @param   band      The band, followed by its rows
+ * @param   first     Output parameter for the first row in the image as it is drawn that was updated
+ * @return            The number of rows in the image as it is drawn that were updated
+ */
+static size_t progress_add_band(struct progress* restrict progress, const struct band* restrict band,
+				size_t* restrict first)
+{
+  size_t width = progress->header.width, pixel_size = progress->pixel_size;
+  size_t y, x, i, sy, sx, end;
+  const unsigned char* data = (const unsigned char*)(band + 1);
+  const unsigned char* row;
+  unsigned char* d;
+  
+  *first = progress_map_row(progress, band->first_row);
+  end = progress_map_row(progress, band->first_row + band->rows);
+  d = progress->image + *first * width * pixel_size;
+  
+  /* If the image fits the screen, it is drawn as it is read. */
+  if (progress->columns == NULL)
+    {
+      memcpy(d, data, band->rows * progress->row_size);
+      return end - *first;
+    }
+  
+  /* Otherwise, sample the nearest pixels. */
+  for (y = *first; y < end; y++)
+    {
+      sy = y * progress->height / progress->header.height;
+      row = data + (sy - band->first_row) * progress->row_size;
+      if (progress->type == 4)
+	for (x = 0; x < width; x++)
+	  sx = progress->columns[x], *d++ = (row[sx >> 3] >> (7 - (sx & 7)) & 1) ? 0 : 255;
+      else
+	for (x = 0; x < width; x++)
+	  for (i = 0, sx = progress->columns[x] * pixel_size; i < pixel_size; i++)
+	    *d++ = row[sx + i];
+    }
+  return end - *first;
+}
+
+
+/**
+ * Draw the bands as they are read, as fast as the display system
+ * allows, all bands that are waiting are drawn at once
+ * 
+ * @param   arg  The state of the drawing
+ * @return       `NULL`
+ */
+static void* progress_thread(void* arg)
+{
+  struct progress* restrict progress = arg;
+  const struct band* band;
+  size_t first, count, run_first = 0, run_count = 0, line = progress->header.width * progress->pixel_size;
+  
+  while (!ring_wait(&(progress->ring)))
+    {
+      /* Gather the waiting bands, drawing only when a skipped band breaks the run. */
+      while ((band = ring_pop_begin(&(progress->ring))))
+	{
+	  count = progress_add_band(progress, band, &first);
+	  ring_pop_end(&(progress->ring));
+	  if (run_count && (first != run_first + run_count) && !progress->error)
+	    if (progress->display->rows(run_first, run_count, progress->image + run_first * line))
+	      progress->error = errno ? errno : EIO;
+	  if (!run_count || (first != run_first + run_count))
+	    run_first = first, run_count = 0;
+	  run_count += count;
+	}
+      if (run_count && !progress->error)
+	if (progress->display->rows(run_first, run_count, progress->image + run_first * line))
+	  progress->error = errno ? errno : EIO;
+      run_count = 0;
+    }
+  
+  return NULL;
+}
+
+
+/**
+ * Start drawing an image while it is being read
+ * 
+ * @param   progress       The state of the drawing
+ * @param   display        The display system
+ * @param   type           4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   maxval         The maximum value on a subpixel
+ * @param   width          The width of the image
+ * @param   height         The height of the image
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @return                 Zero on success, -1 on error
+ */
+static int progress_begin(struct progress* restrict progress, const display_t* restrict display, int type,
+			  unsigned int maxval, size_t width, size_t height, size_t screen_width, size_t screen_height)
+{
+  size_t x;
+  
+  progress->display    = display;
+  progress->type       = type;
+  progress->width      = width;
+  progress->height     = height;
+  progress->row_size   = pnm_row_size(type, maxval, width);
+  progress->pixel_size = type == 4 ? 1 : pnm_row_size(type, maxval, 1);
+  progress->band_rows  = height / PROGRESS_BANDS ? height / PROGRESS_BANDS : 1;
+  progress->pushed     = 0;
+  progress->error      = 0;
+  
+  get_resize_dimensions(width, height, screen_width, screen_height,
+			&(progress->header.width), &(progress->header.height));
+  progress->header.type   = type == 4 ? 5 : type;
+  progress->header.maxval = type == 4 ? 255 : maxval;
+  progress->header.xoff   = (screen_width  - progress->header.width)  / 2;
+  progress->header.yoff   = (screen_height - progress->header.height) / 2;
+  progress->header.levels = &(progress->levels);
+  t (pnm_levels_init(&(progress->levels), progress->header.maxval));
+  
+  /* Pick the column in the image to show in each column on the screen. */
+  if ((type == 4) || (progress->header.width != width) || (progress->header.height != height))
+    {
+      t (progress->columns = malloc(progress->header.width * sizeof(size_t)), progress->columns == NULL);
+      for (x = 0; x < progress->header.width; x++)
+	progress->columns[x] = x * width / progress->header.width;
+    }
+  progress->image = malloc(progress->header.width * progress->header.height * progress->pixel_size);
+  t (progress->image == NULL);
+  
+  /* Start drawing in a thread of its own, so that reading is never held up. */
+  t (ring_initialise(&(progress->ring), PROGRESS_SLOTS,
+		     sizeof(struct band) + progress->band_rows * progress->row_size));
+  t (display->begin(&(progress->header)));
+  t ((errno = pthread_create(&(progress->thread), NULL, progress_thread, progress)));
+  progress->running = 1;
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Pass the rows of an image that have been read since the last call to the
+ * drawing thread, band by band, bands are skipped if the thread is behind
+ * 
+ * @param   progress  The state of the drawing
+ * @param   payload   The pixel data that has been read
+ * @param   rows      The number of rows in `payload`
+ * @param   force     Whether to pass the last band even if it is incomplete
+ */
+static void progress_push(struct progress* restrict progress, const unsigned char* restrict payload,
+			  size_t rows, int force)
+{
+  struct band* band;
+  size_t n;
+  
+  rows = rows < progress->height ? rows : progress->height;
+  while ((rows - progress->pushed >= progress->band_rows) || (force && (rows > progress->pushed)))
+    {
+      n = rows - progress->pushed < progress->band_rows ? rows - progress->pushed : progress->band_rows;
+      band = ring_push_begin(&(progress->ring));
+      if (band != NULL)
+	{
+	  band->first_row = progress->pushed;
+	  band->rows = n;
+	  memcpy(band + 1, payload + progress->pushed * progress->row_size, n * progress->row_size);
+	  ring_push_end(&(progress->ring));
+	}
+      else
+	frame_stats.skipped_bands += 1;
+      frame_stats.bands += 1;
+      progress->pushed += n;
+    }
+}
+
+
+/**
+ * Wait for the drawing thread to draw the last band,
+ * and release the resources of the drawing
+ * 
+ * @param   progress  The state of the drawing
+ * @return            Zero on success, -1 on error
+ */
+static int progress_end(struct progress* restrict progress)
+{
+  int r = 0;
+  
+  if (progress->running)
+    {
+      ring_close(&(progress->ring));
+      pthread_join(progress->thread, NULL);
+      progress->running = 0;
+      if (progress->error)
+	errno = progress->error, r = -1;
+      if (progress->display->end())
+	r = -1;
+    }
+  ring_destroy(&(progress->ring));
+  pnm_levels_destroy(&(progress->levels));
+  free(progress->columns), progress->columns = NULL;
+  free(progress->image), progress->image = NULL;
+  return r;
+}
+
+
+/**
+ * Read the scanning, resize it to fit the screen, and draw it,
+ * the image is drawn, roughly resized, while it is being read
+ * 
+ * @param   display     The display system
+ * @param   fd          The file descriptor for the image scanning, read from `*image` if negative
+ * @param   proc        The process writting to `fd`, `NULL` if `fd` is a file
+ * @param   image       Output parameter for the image buffer
+ * @param   image_size  Output parameter for the number of bytes stored in `*image`,
+ *                      the number of bytes stored in `*image` if `fd` is negative
+ * @return              Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+int display_read_image(const display_t* restrict display, int fd, subprocess_t* restrict proc,
+		       char** restrict image, size_t* restrict image_size)
+{
+  int saved_errno;
+  ssize_t got;
+  size_t ptr = 0, size = 8 << 10, offset, payload = 0;
+  char* old;
+  int state, comment, type;
+  unsigned int maxval = 0;
+  size_t width, height;
+  int resize_vertically;
+  size_t screen_width, screen_height;
+  size_t display_width, display_height;
+  char* scaled_image = NULL;
+  struct stat attr;
+  int have_identity = 0, cached = 0, begun = 0;
+  resize_cache_key_t key;
+  pnm_levels_t levels = { .maxval = 0, .table = NULL };
+  display_header_t header;
+  struct progress progress = { .levels = { .maxval = 0, .table = NULL }, .columns = NULL, .image = NULL,
+			       .ring = { .buffer = NULL }, .running = 0 };
+  
+  display->size(&screen_width, &screen_height);
+  
+  /* If reading from `*image`, we are not scanning. */
+  if (fd < 0)
+    {
+      ptr = *image_size;
+      goto reading_done;
+    }
+  *image_size = 0;
+  
+  /* If reading from a file, resized versions of it can be cached. */
+  if (!fstat(fd, &attr) && S_ISREG(attr.st_mode))
+    have_identity = 1;
+  
+  /* Read image that is being scanned. */
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
+  *image = malloc(size * sizeof(char));
+  t (*image == NULL);
+  for (;;)
+    {
+      /* Read. */
+      if (size - ptr < 1024)
+	{
+	  old = *image;
+	  *image = realloc(*image, size <<= 1);
+	  if (*image == NULL)
+	    {
+	      *image = old;
+	      goto fail;
+	    }
+	}
+      got = read(fd, *image + ptr, size - ptr);
+      if (got == 0)
+	break;
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      
+      /* Parse header and start drawing. */
+      offset = 0;
+      if (state < 10)
+	offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, (size_t)got, *image + ptr);
+      if (state == 10)
+	{
+	  state++;
+	  payload = ptr + offset;
+	  if ((type >= 4) && (type <= 6) && (maxval > 0) && width && height)
+	    {
+	      begun = 1;
+	      t (progress_begin(&progress, display, type, maxval, width, height, screen_width, screen_height));
+	    }
+	}
+      
+      /* Skip pass headers. */
+      ptr += offset;
+      got -= (ssize_t)offset;
+      if (got == 0)
+	continue;
+      
+      /* Update buffer pointer. */
+      ptr += (size_t)got;
+      
+      /* Display partially scanned image. */
+      if (begun)
+	progress_push(&progress, (unsigned char*)*image + payload, (ptr - payload) / progress.row_size, 0);
+    }
+  if (begun)
+    progress_push(&progress, (unsigned char*)*image + payload, (ptr - payload) / progress.row_size, 1);
+  begun = 0;
+  t (progress_end(&progress));
+  *image_size = ptr;
+  
+  /* Reap scanner process. */
+  if (proc != NULL)
+    t (subprocess_reap(proc));
+  
+  /* Display wholly scanned image. */
+ reading_done:
+  
+  /* Parse headers. */
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
+  offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, ptr, *image);
+  
+  /* Get binary size of the image payload. */
+  size = pnm_payload_size(type, maxval, width, height);
+  
+  /* Check that the image is complete. */
+  if ((state < 10) || (ptr - offset < size) || (maxval < 1)) /* Note: hypercomplete is allowed. */
+    goto incomplete_scan;
+  
+  /* Minimise the image allocation. */
+  old = *image;
+  *image = realloc(*image, (size + offset) * sizeof(char));
+  if (*image == NULL)
+    {
+      perror(execname);
+      errno = 0;
+      *image = old;
+    }
+  *image_size = size + offset;
+  
+  /* Resize image to fit the screen, unless it has already been resized. */
+  resize_vertically = get_resize_dimensions(width, height, screen_width, screen_height,
+					    &display_width, &display_height);
+  if (have_identity)
+    {
+      resize_cache_key(&key, &attr, display_width, display_height, RESIZE_FILTER);
+      cached = resize_cache_lookup(&key, &scaled_image, &ptr);
+      if (cached < 0)
+	perror(execname), cached = 0;
+    }
+  if (!cached)
+    {
+      t (resize_image(display_width, display_height, resize_vertically,
+		      *image, size + offset, &scaled_image, &ptr));
+      if (have_identity && resize_cache_insert(&key, scaled_image, ptr))
+	perror(execname);
+    }
+  
+  /* Parse headers of the resized image. */
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &display_width, &display_height);
+  offset = pnm_parse_header(&state, &comment, &type, &maxval, &display_width, &display_height,
+			    ptr, scaled_image);
+  
+  /* Get binary size of the resized image's payload. */
+  size = pnm_payload_size(type, maxval, display_width, display_height);
+  
+  /* Check that the resize was not cancelled.. */
+  if ((state < 10) || (ptr - offset < size) || (maxval < 1))
+    goto incomplete_scan;
+  
+  /* Minimise the image allocation. */
+  old = scaled_image;
+  scaled_image = realloc(scaled_image, (size + offset) * sizeof(char));
+  if (scaled_image == NULL)
+    {
+      perror(execname);
+      errno = 0;
+      scaled_image = old;
+    }
+  
+  /* Display resized image, straight from the buffer it was read into. */
+  t (pnm_levels_init(&levels, maxval));
+  header.type   = type;
+  header.maxval = maxval;
+  header.levels = &levels;
+  header.xoff   = (screen_width  - display_width)  / 2;
+  header.yoff   = (screen_height - display_height) / 2;
+  header.width  = display_width;
+  header.height = display_height;
+  t (display->begin(&header));
+  begun = 1;
+  t (display->rows(0, display_height, (unsigned char*)scaled_image + offset));
+  begun = 0;
+  t (display->end());
+  
+  /* Done. */
+  pnm_levels_destroy(&levels);
+  free(scaled_image);
+  return 0;
+ incomplete_scan:
+  fprintf(stderr, "%s: scan failed, image incomplete\n", execname);
+  errno = 0;
+ fail:
+  saved_errno = errno;
+  if (begun && !progress.running)
+    display->end();
+  progress_end(&progress);
+  pnm_levels_destroy(&levels);
+  free(scaled_image);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Mark the start of a frame
+ * 
+ * @param  start  Output parameter for the time the frame started
+ */
+void display_frame_start(struct timespec* restrict start)
+{
+  clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+
+/**
+ * Mark the end of a frame, and add it to the statistics
+ * 
+ * @param  start  The time the frame started, as set by `display_frame_start`
+ */
+void display_frame_end(const struct timespec* restrict start)
+{
+  struct timespec end;
+  unsigned long long int ns;
+  
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ns = (unsigned long long int)((long long int)(end.tv_sec - start->tv_sec) * 1000000000LL
+				+ (long long int)(end.tv_nsec - start->tv_nsec));
+  
+  frame_stats.frames   += 1;
+  frame_stats.total_ns += ns;
+  frame_stats.last_ns   = ns;
+  if (ns > frame_stats.max_ns)
+    frame_stats.max_ns = ns;
+}
+
+
+/**
+ * Get the timing of the frames that have been drawn
+ * 
+ * @param  stats  Output parameter for the statistics
+ */
+void display_get_stats(display_stats_t* restrict stats)
+{
+  *stats = frame_stats;
+}
+
+
+/**
+ * Wait until keys are available and read them
+ * 
+ * @param   keys    Where the keys are read from
+ * @param   buffer  Output buffer for the keys
+ * @param   size    The size of `buffer`, at least 8
+ * @param   notify  File descriptor that interrupts the wait when it becomes readable, -1 if none
+ * @return          The number of bytes stored in `buffer`, zero at end of input, -1 on error,
+ *                  `errno` is set to `EAGAIN` if `notify` became readable before any keys
+ */
+ssize_t display_wait_keys(const display_keys_t* restrict keys, char* restrict buffer, size_t size, int notify)
+{
+  struct pollfd pfds[2];
+  ssize_t got;
+  
+  pfds[0].fd = keys->fd;
+  pfds[1].fd = notify;
+  pfds[0].events = pfds[1].events = POLLIN;
+  
+  /* Keys may already have been received, for example by Xlib, before the file descriptor is polled. */
+  while ((got = keys->read(buffer, size)) < 0)
+    {
+      if ((errno != EAGAIN) && (errno != EINTR))
+	return -1;
+      if (poll(pfds, 2, -1) < 0)
+	{
+	  if (errno != EINTR)
+	    return -1;
+	}
+      else if (pfds[1].revents)
+	return errno = EAGAIN, -1;
+    }
+  return got;
+}
@@ -21,6 +21,96 @@
 
 #include <stddef.h>
 #include <sys/types.h>
+#include <time.h>
+
+#include "pnm.h"
+#include "util.h"
+
+
+
+/**
+ * Draw an PNM image onto the screen
+ * 
+ * @param   xoff       The where onto the screen the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the screen the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
+ */
+typedef int display_draw_func_t(size_t xoff, size_t yoff, size_t width, size_t height,
+				const pnm_levels_t* restrict levels, int type,
+				const unsigned char* restrict pixeldata);
+
+
+/**
+ * Where the keys pressed by the user are read from, the keys are
+ * encoded as a terminal encodes them, so that keys pressed in a
+ * window are handled the same way as those typed in the terminal
+ */
+typedef struct display_keys
+{
+  /**
+   * File descriptor that becomes readable when keys may be available
+   */
+  int fd;
+  
+  /**
+   * Read the keys that are available, without blocking
+   * 
+   * @param   keys  Output buffer for the keys
+   * @param   size  The size of `keys`, at least 8
+   * @return        The number of bytes stored in `keys`, zero at end of input,
+   *                -1 on error, `errno` is set to `EAGAIN` if no keys are available
+   */
+  ssize_t (*read)(char* keys, size_t size);
+  
+} display_keys_t;
+
+
+/**
+ * Description of an image that is drawn row by row
+ */
+typedef struct display_header
+{
+  /**
+   * 4: raw lineart, 5: raw greyscale, 6: raw colour
+   */
+  int type;
+  
+  /**
+   * The maximum value on a subpixel
+   */
+  unsigned int maxval;
+  
+  /**
+   * Lookup table for `maxval`
+   */
+  const pnm_levels_t* levels;
+  
+  /**
+   * The where onto the screen the top-left corner of the image is drawn on the X-axis
+   */
+  size_t xoff;
+  
+  /**
+   * The where onto the screen the top-left corner of the image is drawn on the Y-axis
+   */
+  size_t yoff;
+  
+  /**
+   * The width of the image
+   */
+  size_t width;
+  
+  /**
+   * The height of the image
+   */
+  size_t height;
+  
+} display_header_t;
 
 
 /**
@@ -36,20 +126,54 @@ typedef struct display
   int (*initialise)(void);
   
   /**
-   * Display the scanning
+   * Get the size of the screen
+   * 
+   * @param  width   Output parameter for the width of the screen
+   * @param  height  Output parameter for the height of the screen
+   */
+  void (*size)(size_t* restrict width, size_t* restrict height);
+  
+  /**
+   * Start drawing an image, the area the previously drawn image
+   * covered that the new image does not cover is cleared
+   * 
+   * @param   header  Description of the image, `header->levels` stays valid until `end` is called
+   * @return          Zero on success, -1 on error
+   */
+  int (*begin)(const display_header_t* restrict header);
+  
+  /**
+   * Draw rows of the image, and make them visible
    * 
-   * @param   fd           The file descriptor for the image scanning, read from `*image` if negative
-   * @param   pid          The PID of the process writting to `fd`
-   * @param   image        Output parameter for the image buffer
-   * @param   crop_x       Output parameter for the X-position of the top-left corner of the cropped image
-   * @param   crop_y       Output parameter for the Y-position of the top-left corner of the cropped image
-   * @param   crop_width   Output parameter for the width of the image after cropping, 0 if not cropped
-   * @param   crop_height  Output parameter for the height of the image after cropping, 0 if not cropped
-   * @param   split_x      Output parameter for where on the X-axis to split the cropped image, 0 if not splitted
-   * @return               Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+   * @param   first_row  The index of the first row to draw
+   * @param   count      The number of rows to draw
+   * @param   data       Pixel data, of the type described by the header, of the first row to draw
+   * @return             Zero on success, -1 on error
+   */
+  int (*rows)(size_t first_row, size_t count, const unsigned char* restrict data);
+  
+  /**
+   * Finish drawing the image
+   * 
+   * @return  Zero on success, -1 on error
    */
-  int (*display)(int fd, pid_t pid, char** restrict image, size_t* restrict crop_x, size_t* restrict crop_y,
-		 size_t* restrict crop_width, size_t* restrict crop_height, size_t* restrict split_x);
+  int (*end)(void);
+  
+  /**
+   * Let the user zoom and pan around an image at full resolution
+   * 
+   * @param   pathname  The pathname of the image, must be a raw PNM image
+   * @return            Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+   */
+  int (*inspect)(const char* pathname);
+  
+  /**
+   * Show the pages in a directory as a grid of thumbnails
+   * 
+   * @param   directory  The directory with the pages, 1.pnm, 2.pnm, and so on
+   * @return             Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+   */
+  int (*browse)(const char* directory);
   
   /**
    * Terminate the display system
@@ -59,5 +183,102 @@ typedef struct display
 } display_t;
 
 
+/**
+ * Timing of the frames drawn by the display system, and
+ * the bands the scanning previews were drawn in
+ */
+typedef struct display_stats
+{
+  /**
+   * The number of frames that have been drawn
+   */
+  size_t frames;
+  
+  /**
+   * The total time spent drawing frames, in nanoseconds
+   */
+  unsigned long long int total_ns;
+  
+  /**
+   * The time spent drawing the slowest frame, in nanoseconds
+   */
+  unsigned long long int max_ns;
+  
+  /**
+   * The time spent drawing the last frame, in nanoseconds
+   */
+  unsigned long long int last_ns;
+  
+  /**
+   * The number of bands of rows that have been read while scanning
+   */
+  size_t bands;
+  
+  /**
+   * The number of bands in `bands` that were not drawn
+   * because the display system was behind
+   */
+  size_t skipped_bands;
+  
+} display_stats_t;
+
+
+
+/**
+ * Keys typed in the terminal, on stdin, used by
+ * the display systems that do not open a window
+ */
+extern const display_keys_t display_tty_keys;
+
+
+/**
+ * Read the scanning, resize it to fit the screen, and draw it,
+ * the image is drawn, roughly resized, while it is being read
+ * 
+ * @param   display     The display system
+ * @param   fd          The file descriptor for the image scanning, read from `*image` if negative
+ * @param   proc        The process writting to `fd`, `NULL` if `fd` is a file
+ * @param   image       Output parameter for the image buffer
+ * @param   image_size  Output parameter for the number of bytes stored in `*image`,
+ *                      the number of bytes stored in `*image` if `fd` is negative
+ * @return              Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+int display_read_image(const display_t* restrict display, int fd, subprocess_t* restrict proc,
+		       char** restrict image, size_t* restrict image_size);
+
+/**
+ * Mark the start of a frame
+ * 
+ * @param  start  Output parameter for the time the frame started
+ */
+void display_frame_start(struct timespec* restrict start);
+
+/**
+ * Mark the end of a frame, and add it to the statistics
+ * 
+ * @param  start  The time the frame started, as set by `display_frame_start`
+ */
+void display_frame_end(const struct timespec* restrict start);
+
+/**
+ * Get the timing of the frames that have been drawn
+ * 
+ * @param  stats  Output parameter for the statistics
+ */
+void display_get_stats(display_stats_t* restrict stats);
+
+/**
+ * Wait until keys are available and read them
+ * 
+ * @param   keys    Where the keys are read from
+ * @param   buffer  Output buffer for the keys
+ * @param   size    The size of `buffer`, at least 8
+ * @param   notify  File descriptor that interrupts the wait when it becomes readable, -1 if none
+ * @return          The number of bytes stored in `buffer`, zero at end of input, -1 on error,
+ *                  `errno` is set to `EAGAIN` if `notify` became readable before any keys
+ */
+ssize_t display_wait_keys(const display_keys_t* restrict keys, char* restrict buffer, size_t size, int notify);
+
+
 #endif
 
@@ -23,15 +23,17 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <stropts.h>
 #include <stdint.h>
-#include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <linux/fb.h>
 
 #include "crazy.h"
-#include "images.h"
+#include "blit.h"
+#include "canvas.h"
+#include "contact_sheet.h"
+#include "viewer.h"
 
 
 /**
@@ -59,20 +61,72 @@ static size_t fb_height;
 static int fb_fd = -1;
 
 /**
- * Framebuffer pointer
+ * The memory mapping of the framebuffer
+ */
+static int8_t* fb_map = MAP_FAILED;
+
+/**
+ * The size of `fb_map`
+ */
+static size_t fb_map_size;
+
+/**
+ * Framebuffer pointer, the first page if double buffered
  */
 static int8_t* fb_mem = MAP_FAILED;
 
 /**
- * Increment for `mem` to move to next pixel on the line
+ * The pixel format of the framebuffer
  */
-static size_t fb_bytes_per_pixel;
+static blit_format_t fb_format;
 
 /**
  * Increment for `mem` to move down one line but stay in the same column
  */
 static size_t fb_line_length;
 
+/**
+ * Back buffer that images are composed in before
+ * the modified areas are copied to the framebuffer
+ */
+static canvas_t fb_canvas = { .pixels = NULL };
+
+/**
+ * The image that is being drawn row by row
+ */
+static display_header_t fb_header = { .levels = NULL };
+
+/**
+ * The number of pages in the framebuffer that are used,
+ * 2 if double buffered, 1 if copying to the visible page
+ */
+static size_t fb_pages = 1;
+
+/**
+ * The index of the visible page
+ */
+static size_t fb_page = 0;
+
+/**
+ * Whether to wait for vertical synchronisation before flipping pages
+ */
+static int fb_vsync = 1;
+
+/**
+ * The variable screen information of the framebuffer, used for panning
+ */
+static struct fb_var_screeninfo fb_var_info;
+
+/**
+ * The variable screen information of the framebuffer before it was initialised
+ */
+static struct fb_var_screeninfo fb_saved_var_info;
+
+/**
+ * Whether `fb_saved_var_info` shall be restored on termination
+ */
+static int fb_var_info_changed = 0;
+
 
 
 /**
@@ -80,11 +134,88 @@ static size_t fb_line_length;
  */
 static void display_fb_terminate(void)
 {
+  blit_terminate();
+  canvas_destroy(&fb_canvas);
+  if (fb_var_info_changed)
+    ioctl(fb_fd, (unsigned long int)FBIOPUT_VSCREENINFO, &fb_saved_var_info);
+  else if (fb_pages > 1)
+    ioctl(fb_fd, (unsigned long int)FBIOPAN_DISPLAY, &fb_saved_var_info);
+  fb_var_info_changed = 0;
+  fb_pages = 1, fb_page = 0;
+  if (fb_map != MAP_FAILED)
+    munmap(fb_map, fb_map_size), fb_map = fb_mem = MAP_FAILED;
   if (fb_fd >= 0)
     close(fb_fd), fb_fd = -1;
 }
 
 
+/**
+ * Make the framebuffer twice as tall as the screen, if it is not
+ * already, so that it can hold a hidden page and a visible page
+ * 
+ * @param  fix_info  The fixed screen information, will be updated
+ * @param  var_info  The variable screen information, will be updated
+ */
+static void display_fb_allocate_pages(struct fb_fix_screeninfo* restrict fix_info,
+				      struct fb_var_screeninfo* restrict var_info)
+{
+  struct fb_var_screeninfo wanted = *var_info;
+  
+  fb_saved_var_info = *var_info;
+  
+  if (var_info->yres_virtual < 2 * var_info->yres)
+    {
+      wanted.yres_virtual = 2 * var_info->yres;
+      wanted.yoffset = 0;
+      if (ioctl(fb_fd, (unsigned long int)FBIOPUT_VSCREENINFO, &wanted))
+	return;
+      fb_var_info_changed = 1;
+      if (ioctl(fb_fd, (unsigned long int)FBIOGET_FSCREENINFO, fix_info) ||
+	  ioctl(fb_fd, (unsigned long int)FBIOGET_VSCREENINFO, var_info))
+	return;
+    }
+  
+  if ((var_info->yres_virtual >= 2 * var_info->yres) &&
+      ((size_t)(fix_info->smem_len) >= var_info->xoffset * (var_info->bits_per_pixel / 8) +
+				       2 * var_info->yres * (size_t)(fix_info->line_length)))
+    fb_pages = 2;
+}
+
+
+/**
+ * Make the content of the back buffer visible
+ */
+static void display_fb_present(void)
+{
+  canvas_rect_t all = { 0, 0, fb_width, fb_height };
+  size_t hidden = fb_page ^ 1;
+  uint32_t crtc = 0;
+  
+  if (fb_pages < 2)
+    {
+      canvas_flush(&fb_canvas, fb_mem, fb_line_length);
+      return;
+    }
+  
+  /* Render off-screen and flip. */
+  canvas_flush_page(&fb_canvas, fb_mem + hidden * fb_height * fb_line_length, fb_line_length);
+  if (fb_vsync && ioctl(fb_fd, (unsigned long int)FBIO_WAITFORVSYNC, &crtc))
+    fb_vsync = 0;
+  fb_var_info.yoffset = (uint32_t)(hidden * fb_height);
+  if (!ioctl(fb_fd, (unsigned long int)FBIOPAN_DISPLAY, &fb_var_info))
+    {
+      fb_page = hidden;
+      return;
+    }
+  
+  /* Panning is not supported, copy to the visible page instead. */
+  fb_mem += fb_page * fb_height * fb_line_length;
+  fb_pages = 1;
+  canvas_damage(&fb_canvas, &all);
+  canvas_flush(&fb_canvas, fb_mem, fb_line_length);
+}
+
+
 /**
  * Initialise the display system
  * 
@@ -109,26 +240,48 @@ static int display_fb_initialise(void)
       fb_fd = dup(fb_fd);
       t (fb_fd < 0);
     }
-  while (ptr--)
-    close(fds[ptr]);
+  while (ptr)
+    close(fds[--ptr]);
   
   /* Acquire screen information. */
   t (ioctl(fb_fd, (unsigned long int)FBIOGET_FSCREENINFO, &fix_info) ||
      ioctl(fb_fd, (unsigned long int)FBIOGET_VSCREENINFO, &var_info));
   
+  /* Get room for a hidden page, for tear-free flipping. */
+  display_fb_allocate_pages(&fix_info, &var_info);
+  fb_var_info = var_info;
+  
+  /* Select pixel conversion functions. */
+  if (blit_get_format(&fb_format, var_info.bits_per_pixel,
+		      var_info.red.offset,   var_info.red.length,
+		      var_info.green.offset, var_info.green.length,
+		      var_info.blue.offset,  var_info.blue.length))
+    {
+      fprintf(stderr, "%s: unsupported framebuffer pixel format\n", execname);
+      goto fail;
+    }
+  
   /* Memory map the framebuffer. */
-  fb_mem = mmap(NULL, (size_t)(fix_info.smem_len), PROT_WRITE, MAP_PRIVATE, fb_fd, (off_t)0);
-  t (fb_mem == MAP_FAILED);
+  fb_map_size = (size_t)(fix_info.smem_len);
+  fb_map = mmap(NULL, fb_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, (off_t)0);
+  t (fb_map == MAP_FAILED);
   
-  /* Skip offset in framebuffer. */
-  fb_mem += var_info.xoffset * (var_info.bits_per_pixel / 8);
-  fb_mem += var_info.yoffset * fix_info.line_length;
+  /* Skip offset in framebuffer, the pages start at the top if double buffered. */
+  fb_mem = fb_map + var_info.xoffset * (var_info.bits_per_pixel / 8);
+  if (fb_pages < 2)
+    fb_mem += var_info.yoffset * fix_info.line_length;
+  else
+    fb_page = var_info.yoffset >= var_info.yres;
   
   /* Store framebuffer information. */
-  fb_width           = var_info.xres;
-  fb_height          = var_info.yres;
-  fb_bytes_per_pixel = var_info.bits_per_pixel / 8;
-  fb_line_length     = fix_info.line_length;
+  fb_width       = var_info.xres;
+  fb_height      = var_info.yres;
+  fb_line_length = fix_info.line_length;
+  
+  /* Blank out the screen, once, through a black back buffer. */
+  t (canvas_initialise(&fb_canvas, fb_width, fb_height, &fb_format));
+  fb_canvas.streaming = 1;
+  display_fb_present();
   
   return 0;
  fail:
@@ -142,279 +295,115 @@ static int display_fb_initialise(void)
 
 
 /**
- * Draw an PNM image onto the framebuffer
+ * Draw an PNM image onto the framebuffer, and clear what
+ * remains of the previously drawn image around it
  * 
- * @param  xoff       The where onto the framebuffer the top-left corner of the image is drawn on the X-axis
- * @param  yoff       The where onto the framebuffer the top-left corner of the image is drawn on the Y-axis
- * @param  width      The width of the image
- * @param  height     The height of the image
- * @param  maxval     The maximum value subpixel can have
- * @param  type       4: raw lineart, 5: raw greyscale, 6: raw colour
- * @param  pixeldata  Pixel data of the type described by `type`
+ * @param   xoff       The where onto the framebuffer the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the framebuffer the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
  */
-static void display_fb_draw_image(size_t xoff, size_t yoff, size_t width, size_t height,
-				  int maxval, int type, const unsigned char* restrict pixeldata)
+static int display_fb_draw_image(size_t xoff, size_t yoff, size_t width, size_t height,
+				 const pnm_levels_t* restrict levels, int type,
+				 const unsigned char* restrict pixeldata)
 {
-  int8_t* mem = fb_mem + yoff * fb_line_length + xoff * fb_bytes_per_pixel;
-  size_t next_line = fb_line_length - width * fb_bytes_per_pixel;
-  size_t i, x, y;
-  uint32_t maxval_;
-  
-  if (maxval > 255)
-    maxval >>= 7;
-  maxval_ = (uint32_t)maxval;
+  struct timespec start;
   
-  
-  /* Packed lineart. (lineart = monochrome) */
-  if (type == 4)
-    for (i = y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, i++, mem += fb_bytes_per_pixel)
-	*(uint32_t*)mem = (uint32_t)((pixeldata[x >> 3] & (1 << (i & 7))) ? ~0 : 0);
-  
-  /* Greyscale. Normal colour resolution. */
-  else if ((type == 5) && (maxval == 255))
-    for (y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, mem += fb_bytes_per_pixel)
-	{
-	  uint32_t colour = (uint32_t)*pixeldata++;
-	  *(uint32_t*)mem = colour | (colour << 8) | (colour << 16);
-	}
-  /* Greyscale. Low colour resolution. */
-  else if ((type == 5) && (maxval < 255))
-    for (y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, mem += fb_bytes_per_pixel)
-	{
-	  uint32_t colour = (uint32_t)*pixeldata++;
-	  colour = 255 * colour / maxval_;
-	  *(uint32_t*)mem = colour | (colour << 8) | (colour << 16);
-	}
-  /* Greyscale. High colour resolution. */
-  else if (type == 5)
-    for (y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, mem += fb_bytes_per_pixel)
-	{
-	  uint32_t colour = (uint32_t)*pixeldata++ << 1;
-	  colour |= (uint32_t)(*pixeldata++) >> 7;
-	  colour = 511 * colour / maxval_;
-	  *(uint32_t*)mem = colour | (colour << 8) | (colour << 16);
-	}
-  
-  /* Coloured. Normal colour resolution. */
-  else if ((type == 6) && (maxval == 255))
-    for (y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, mem += fb_bytes_per_pixel)
-	{
-	  uint32_t colour = (uint32_t)*pixeldata++ << 16;
-	  colour |= (uint32_t)*pixeldata++ << 8;
-	  colour |= (uint32_t)*pixeldata++;
-	  *(uint32_t*)mem = colour;
-	}
-  /* Coloured. Low colour resolution. */
-  else if ((type == 6) && (maxval < 255))
-    for (y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, mem += fb_bytes_per_pixel)
-	{
-	  uint32_t colour;
-	  colour  = (255 * (uint32_t)*pixeldata++ / maxval_) << 16;
-	  colour |= (255 * (uint32_t)*pixeldata++ / maxval_) <<  8;
-	  colour |=  255 * (uint32_t)*pixeldata++ / maxval_;
-	  *(uint32_t*)mem = colour;
-	}
-  /* Coloured. High colour resolution. */
-  else if (type == 6)
-    for (y = 0; y < height; y++, mem += next_line)
-      for (x = 0; x < width; x++, mem += fb_bytes_per_pixel)
-	{
-	  uint32_t colour_r, colour_g, colour_b;
-	  colour_r  = (uint32_t)*pixeldata++ << 1;
-	  colour_r |= (uint32_t)*pixeldata++ >> 7;
-	  colour_g  = (uint32_t)*pixeldata++ << 1;
-	  colour_g |= (uint32_t)*pixeldata++ >> 7;
-	  colour_b  = (uint32_t)*pixeldata++ << 1;
-	  colour_b |= (uint32_t)*pixeldata++ >> 7;
-	  colour_r = 511 * colour_r / maxval_;
-	  colour_g = 511 * colour_g / maxval_;
-	  colour_b = 511 * colour_b / maxval_;
-	  *(uint32_t*)mem = (colour_r << 16) | (colour_g << 8) | colour_b;
-	}
+  display_frame_start(&start);
+  if (canvas_draw_image(&fb_canvas, xoff, yoff, width, height, levels, type, pixeldata))
+    return -1;
+  display_fb_present();
+  display_frame_end(&start);
+  return 0;
 }
 
 
 /**
- * Display the scanning
+ * Get the size of the framebuffer
  * 
- * @param   fd           The file descriptor for the image scanning, read from `*image` if negative
- * @param   pid          The PID of the process writting to `fd`
- * @param   image        Output parameter for the image buffer
- * @param   crop_x       Output parameter for the X-position of the top-left corner of the cropped image
- * @param   crop_y       Output parameter for the Y-position of the top-left corner of the cropped image
- * @param   crop_width   Output parameter for the width of the image after cropping, 0 if not cropped
- * @param   crop_height  Output parameter for the height of the image after cropping, 0 if not cropped
- * @param   split_x      Output parameter for where on the X-axis to split the cropped image, 0 if not splitted
- * @return               Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ * @param  width   Output parameter for the width of the framebuffer
+ * @param  height  Output parameter for the height of the framebuffer
  */
-static int display_fb_display(int fd, pid_t pid, char** restrict image, size_t* restrict crop_x,
-			      size_t* restrict crop_y, size_t* restrict crop_width,
-			      size_t* restrict crop_height, size_t* restrict split_x)
+static void display_fb_size(size_t* restrict width, size_t* restrict height)
 {
-  pid_t reaped;
-  int status, saved_errno;
-  ssize_t got;
-  size_t ptr = 0, size = 8 << 10, offset;
-  char* old;
-  int state, comment, type;
-  unsigned int maxval = 0;
-  size_t width, height;
-  int resize_vertically;
-  size_t display_width, display_height;
-  char* scaled_image = NULL;
-  
-  (void) crop_x;
-  (void) crop_y;
-  (void) crop_width;
-  (void) crop_height;
-  (void) split_x;
-  
-  /* Blank out the screen. */
-  system("cat /dev/zero > " FB_DEVICE);
-  
-  /* If reading from `*image`, we are not scanning. */
-  if (fd < 0)
-    goto reading_done;
-  
-  /* Read image that is being scanned. */
-  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
-  *image = malloc(size * sizeof(char));
-  t (*image == NULL);
-  for (;;)
-    {
-      /* Read. */
-      if (size - ptr < 1024)
-	{
-	  old = *image;
-	  *image = realloc(*image, size <<= 1);
-	  if (*image == NULL)
-	    {
-	      *image = old;
-	      goto fail;
-	    }
-	}
-      got = read(fd, *image, size - ptr);
-      if (got == 0)
-	break;
-      if (got < 0)
-	{
-	  t (errno != EINTR);
-	  continue;
-	}
-      
-      /* Parse header and get display dimension. */
-      offset = 0;
-      if (state < 10)
-	offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, (size_t)got, *image + ptr);
-      if (state == 10)
-	{
-	  state++;
-	  resize_vertically = get_resize_dimensions(width, height, fb_width, fb_height,
-						    &display_width, &display_height);
-	}
-      
-      /* Skip pass headers. */
-      ptr += offset;
-      got -= (ssize_t)offset;
-      if (got == 0)
-	continue;
-      
-      /* Display partially scanned image. */
-      /*   TODO display!   */
-      
-      /* Update buffer pointer. */
-      ptr += (size_t)got;
-    }
-  
-  /* Reap scanner process. */
-  for (;;)
-    {
-      reaped = wait(&status);
-      t (reaped < 0);
-      if (reaped == pid)
-	{
-	  if (!status)
-	    break;
-	  errno = 0;
-	  goto fail;
-	}
-    }
-  
-  /* Display wholly scanned image. */
- reading_done:
-  
-  /* Parse headers. */
-  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
-  offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, ptr, *image);
-  
-  /* Get binary size of the image payload. */
-  size = width * height * (maxval <= 0x100 ? 1 : 2) * (type == 6 ? 3 : 1);
-  if (type == 4)
-    size = (size + 7) / 8;
-  
-  /* Check that the image is complete. */
-  if ((state < 10) || (ptr - offset < size) || (maxval < 1)) /* Note: hypercomplete is allowed. */
-    goto incomplete_scan;
-  
-  /* Minimise the image allocation. */
-  old = *image;
-  *image = realloc(*image, (size + offset) * sizeof(char));
-  if (*image == NULL)
-    {
-      perror(execname);
-      errno = 0;
-      *image = old;
-    }
-  
-  /* Resize image to fit the screen. */
-  resize_vertically = get_resize_dimensions(width, height, fb_width, fb_height,
-					    &display_width, &display_height);
-  t (resize_image(display_width, display_height, resize_vertically,
-		  *image, size + offset, &scaled_image, &ptr));
-  
-  /* Parse headers of the resized image. */
-  pnm_init_parse_header(&state, &comment, &type, &maxval, &display_width, &height);
-  offset = pnm_parse_header(&state, &comment, &type, &maxval, &display_width, &height, ptr, scaled_image);
-  
-  /* Get binary size of the resized image's payload. */
-  size = display_width * display_height * (maxval <= 0x100 ? 1 : 2) * (type == 6 ? 3 : 1);
-  if (type == 4)
-    size = (size + 7) / 8;
-  
-  /* Check that the resize was not cancelled.. */
-  if ((state < 10) || (ptr - offset < size) || (maxval < 1))
-    goto incomplete_scan;
-  
-  /* Minimise the image allocation. */
-  old = scaled_image;
-  scaled_image = realloc(scaled_image, (size + offset) * sizeof(char));
-  if (scaled_image == NULL)
-    {
-      perror(execname);
-      errno = 0;
-      scaled_image = old;
-    }
-  
-  /* Display resized image. */
-  /*   TODO display!   */
+  *width  = fb_width;
+  *height = fb_height;
+}
+
+
+/**
+ * Start drawing an image, the area the previously drawn image
+ * covered that the new image does not cover is cleared
+ * 
+ * @param   header  Description of the image, `header->levels` stays valid until `end` is called
+ * @return          Zero on success, -1 on error
+ */
+static int display_fb_begin(const display_header_t* restrict header)
+{
+  fb_header = *header;
+  canvas_begin_image(&fb_canvas, header->xoff, header->yoff, header->width, header->height);
+  return 0;
+}
+
+
+/**
+ * Draw rows of the image, and make them visible
+ * 
+ * @param   first_row  The index of the first row to draw
+ * @param   count      The number of rows to draw
+ * @param   data       Pixel data, of the type described by the header, of the first row to draw
+ * @return             Zero on success, -1 on error
+ */
+static int display_fb_rows(size_t first_row, size_t count, const unsigned char* restrict data)
+{
+  struct timespec start;
   
-  /* Done. */
-  free(scaled_image);
+  display_frame_start(&start);
+  if (canvas_draw_rows(&fb_canvas, first_row, count, fb_header.levels, fb_header.type, data))
+    return -1;
+  display_fb_present();
+  display_frame_end(&start);
   return 0;
- incomplete_scan:
-  fprintf(stderr, "%s: scan failed, image incomplete", execname);
-  errno = 0;
- fail:
-  saved_errno = errno;
-  free(scaled_image);
-  errno = saved_errno;
-  return -1;
+}
+
+
+/**
+ * Finish drawing the image
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_fb_end(void)
+{
+  fb_header.levels = NULL;
+  return 0;
+}
+
+
+/**
+ * Let the user zoom and pan around an image at full resolution
+ * 
+ * @param   pathname  The pathname of the image, must be a raw PNM image
+ * @return            Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_fb_inspect(const char* pathname)
+{
+  return viewer_run(pathname, fb_width, fb_height, display_fb_draw_image, &display_tty_keys);
+}
+
+
+/**
+ * Show the pages in a directory as a grid of thumbnails
+ * 
+ * @param   directory  The directory with the pages, 1.pnm, 2.pnm, and so on
+ * @return             Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_fb_browse(const char* directory)
+{
+  return contact_sheet_run(directory, fb_width, fb_height, display_fb_draw_image, &display_tty_keys);
 }
 
 
@@ -426,7 +415,12 @@ static int display_fb_display(int fd, pid_t pid, char** restrict image, size_t*
 void display_fb_get(display_t* restrict display)
 {
   display->initialise = display_fb_initialise;
-  display->display    = display_fb_display;
+  display->size       = display_fb_size;
+  display->begin      = display_fb_begin;
+  display->rows       = display_fb_rows;
+  display->end        = display_fb_end;
+  display->inspect    = display_fb_inspect;
+  display->browse     = display_fb_browse;
   display->terminate  = display_fb_terminate;
 }
 
@@ -0,0 +1,405 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "display_mem.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "crazy.h"
+#include "blit.h"
+#include "canvas.h"
+#include "contact_sheet.h"
+#include "viewer.h"
+
+
+
+/**
+ * A pixel format that can be selected by name
+ */
+struct format_name
+{
+  /**
+   * The name of the format
+   */
+  const char* name;
+  
+  /**
+   * The number of bits per pixel
+   */
+  unsigned int bits_per_pixel;
+  
+  /**
+   * The offset and length of the red, green, and blue bits, in that order
+   */
+  unsigned int fields[6];
+};
+
+
+/**
+ * The supported pixel formats, with the same
+ * layouts as the framebuffer reports them
+ */
+static const struct format_name formats[] =
+  {
+    { "rgb565",   16, { 11, 5,  5, 6,  0, 5 } },
+    { "rgb888",   24, { 16, 8,  8, 8,  0, 8 } },
+    { "bgr888",   24, {  0, 8,  8, 8, 16, 8 } },
+    { "xrgb8888", 32, { 16, 8,  8, 8,  0, 8 } },
+    { "xbgr8888", 32, {  0, 8,  8, 8, 16, 8 } },
+  };
+
+
+
+/**
+ * The width of the screen
+ */
+static size_t mem_width = 1024;
+
+/**
+ * The height of the screen
+ */
+static size_t mem_height = 768;
+
+/**
+ * The selected pixel format
+ */
+static const struct format_name* mem_format_name = formats + 3;
+
+/**
+ * The directory displayed frames are saved to, `NULL` if not saved
+ */
+static char* mem_directory = NULL;
+
+/**
+ * The pixel format of the screen
+ */
+static blit_format_t mem_format;
+
+/**
+ * The screen's pixels
+ */
+static unsigned char* mem_screen = MAP_FAILED;
+
+/**
+ * The size of `mem_screen`
+ */
+static size_t mem_size;
+
+/**
+ * Increment for `mem_screen` to move down one line but stay in the same column
+ */
+static size_t mem_line_length;
+
+/**
+ * Back buffer that images are composed in before
+ * the modified areas are copied to the screen
+ */
+static canvas_t mem_canvas = { .pixels = NULL };
+
+/**
+ * The image that is being drawn row by row
+ */
+static display_header_t mem_header = { .levels = NULL };
+
+/**
+ * The number of frames that have been displayed
+ */
+static size_t mem_frames = 0;
+
+
+
+/**
+ * Configure the in-memory display system
+ * 
+ * The configuration is on the format `WIDTHxHEIGHT[:FORMAT[:DIRECTORY]]`,
+ * where `FORMAT` is rgb565, rgb888, bgr888, xrgb8888 (default), or xbgr8888,
+ * and `DIRECTORY` is where each displayed frame shall be saved as a PPM image
+ * 
+ * @param   spec  The configuration, `NULL` for 1024x768:xrgb8888 without saving frames
+ * @return        Zero on success, -1 if the configuration is invalid
+ */
+int display_mem_configure(const char* spec)
+{
+  char* end;
+  size_t i, n;
+  
+  free(mem_directory), mem_directory = NULL;
+  if (spec == NULL)
+    return 0;
+  
+  mem_width = (size_t)strtoul(spec, &end, 10);
+  if ((end == spec) || (*end != 'x'))
+    goto invalid;
+  spec = end + 1;
+  mem_height = (size_t)strtoul(spec, &end, 10);
+  if ((end == spec) || (*end && (*end != ':')) || !mem_width || !mem_height)
+    goto invalid;
+  if (!*end)
+    return 0;
+  spec = end + 1;
+  
+  n = strcspn(spec, ":");
+  for (i = 0; i < sizeof(formats) / sizeof(*formats); i++)
+    if ((strlen(formats[i].name) == n) && !strncasecmp(formats[i].name, spec, n))
+      break;
+  if (i == sizeof(formats) / sizeof(*formats))
+    goto invalid;
+  mem_format_name = formats + i;
+  if (!spec[n])
+    return 0;
+  
+  mem_directory = strdup(spec + n + 1);
+  return mem_directory == NULL ? -1 : 0;
+ invalid:
+  return errno = EINVAL, -1;
+}
+
+
+/**
+ * Save the screen as a PPM image
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_mem_save_frame(void)
+{
+  char* pathname = NULL;
+  unsigned char* row = NULL;
+  FILE* f = NULL;
+  size_t y;
+  int saved_errno;
+  
+  aprintf(&pathname, "%s/frame-%05zu.ppm", mem_directory, mem_frames);
+  t (pathname == NULL);
+  t (row = malloc(3 * mem_width), row == NULL);
+  t (f = fopen(pathname, "wb"), f == NULL);
+  
+  t (fprintf(f, "P6\n%zu %zu\n255\n", mem_width, mem_height) < 0);
+  for (y = 0; y < mem_height; y++)
+    {
+      blit_unpack_row(&mem_format, row, mem_screen + y * mem_line_length, mem_width);
+      t (fwrite(row, 3, mem_width, f) != mem_width);
+    }
+  
+  t (fclose(f));
+  free(row);
+  free(pathname);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (f != NULL)
+    fclose(f);
+  free(row);
+  free(pathname);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Make the content of the back buffer visible
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_mem_present(void)
+{
+  canvas_flush(&mem_canvas, mem_screen, mem_line_length);
+  if ((mem_directory != NULL) && display_mem_save_frame())
+    return -1;
+  mem_frames++;
+  return 0;
+}
+
+
+/**
+ * Terminate the display system
+ */
+static void display_mem_terminate(void)
+{
+  blit_terminate();
+  canvas_destroy(&mem_canvas);
+  if (mem_screen != MAP_FAILED)
+    munmap(mem_screen, mem_size), mem_screen = MAP_FAILED;
+}
+
+
+/**
+ * Initialise the display system
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_mem_initialise(void)
+{
+  const unsigned int* f = mem_format_name->fields;
+  int saved_errno;
+  
+  t (blit_get_format(&mem_format, mem_format_name->bits_per_pixel, f[0], f[1], f[2], f[3], f[4], f[5]));
+  
+  mem_line_length = mem_width * mem_format.bytes_per_pixel;
+  mem_size = mem_line_length * mem_height;
+  mem_screen = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, (off_t)0);
+  t (mem_screen == MAP_FAILED);
+  
+  mem_frames = 0;
+  t (canvas_initialise(&mem_canvas, mem_width, mem_height, &mem_format));
+  t (display_mem_present());
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  display_mem_terminate();
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Draw an PNM image onto the screen, and clear what
+ * remains of the previously drawn image around it
+ * 
+ * @param   xoff       The where onto the screen the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the screen the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
+ */
+static int display_mem_draw_image(size_t xoff, size_t yoff, size_t width, size_t height,
+				  const pnm_levels_t* restrict levels, int type,
+				  const unsigned char* restrict pixeldata)
+{
+  struct timespec start;
+  int r;
+  
+  display_frame_start(&start);
+  if (canvas_draw_image(&mem_canvas, xoff, yoff, width, height, levels, type, pixeldata))
+    return -1;
+  r = display_mem_present();
+  display_frame_end(&start);
+  return r;
+}
+
+
+/**
+ * Get the size of the screen
+ * 
+ * @param  width   Output parameter for the width of the screen
+ * @param  height  Output parameter for the height of the screen
+ */
+static void display_mem_size(size_t* restrict width, size_t* restrict height)
+{
+  *width  = mem_width;
+  *height = mem_height;
+}
+
+
+/**
+ * Start drawing an image, the area the previously drawn image
+ * covered that the new image does not cover is cleared
+ * 
+ * @param   header  Description of the image, `header->levels` stays valid until `end` is called
+ * @return          Zero on success, -1 on error
+ */
+static int display_mem_begin(const display_header_t* restrict header)
+{
+  mem_header = *header;
+  canvas_begin_image(&mem_canvas, header->xoff, header->yoff, header->width, header->height);
+  return 0;
+}
+
+
+/**
+ * Draw rows of the image, and make them visible
+ * 
+ * @param   first_row  The index of the first row to draw
+ * @param   count      The number of rows to draw
+ * @param   data       Pixel data, of the type described by the header, of the first row to draw
+ * @return             Zero on success, -1 on error
+ */
+static int display_mem_rows(size_t first_row, size_t count, const unsigned char* restrict data)
+{
+  struct timespec start;
+  int r;
+  
+  display_frame_start(&start);
+  if (canvas_draw_rows(&mem_canvas, first_row, count, mem_header.levels, mem_header.type, data))
+    return -1;
+  r = display_mem_present();
+  display_frame_end(&start);
+  return r;
+}
+
+
+/**
+ * Finish drawing the image
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_mem_end(void)
+{
+  mem_header.levels = NULL;
+  return 0;
+}
+
+
+/**
+ * Let the user zoom and pan around an image at full resolution
+ * 
+ * @param   pathname  The pathname of the image, must be a raw PNM image
+ * @return            Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_mem_inspect(const char* pathname)
+{
+  return viewer_run(pathname, mem_width, mem_height, display_mem_draw_image, &display_tty_keys);
+}
+
+
+/**
+ * Show the pages in a directory as a grid of thumbnails
+ * 
+ * @param   directory  The directory with the pages, 1.pnm, 2.pnm, and so on
+ * @return             Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_mem_browse(const char* directory)
+{
+  return contact_sheet_run(directory, mem_width, mem_height, display_mem_draw_image, &display_tty_keys);
+}
+
+
+/**
+ * Get the functions associated with the in-memory display system
+ * 
+ * @param  display  Output parameter the functions
+ */
+void display_mem_get(display_t* restrict display)
+{
+  display->initialise = display_mem_initialise;
+  display->size       = display_mem_size;
+  display->begin      = display_mem_begin;
+  display->rows       = display_mem_rows;
+  display->end        = display_mem_end;
+  display->inspect    = display_mem_inspect;
+  display->browse     = display_mem_browse;
+  display->terminate  = display_mem_terminate;
+}
+
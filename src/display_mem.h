@@ -0,0 +1,46 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_DISPLAY_MEM_H
+#define CRAZY_DISPLAY_MEM_H
+
+
+#include "display.h"
+
+
+/**
+ * Configure the in-memory display system
+ * 
+ * The configuration is on the format `WIDTHxHEIGHT[:FORMAT[:DIRECTORY]]`,
+ * where `FORMAT` is rgb565, rgb888, bgr888, xrgb8888 (default), or xbgr8888,
+ * and `DIRECTORY` is where each displayed frame shall be saved as a PPM image
+ * 
+ * @param   spec  The configuration, `NULL` for 1024x768:xrgb8888 without saving frames
+ * @return        Zero on success, -1 if the configuration is invalid
+ */
+int display_mem_configure(const char* spec);
+
+/**
+ * Get the functions associated with the in-memory display system
+ * 
+ * @param  display  Output parameter the functions
+ */
+void display_mem_get(display_t* restrict display);
+
+
+#endif
+
@@ -0,0 +1,800 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "display_term.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "crazy.h"
+#include "blit.h"
+#include "canvas.h"
+#include "contact_sheet.h"
+#include "viewer.h"
+
+
+/**
+ * The directories where image files for kitty are
+ * created, in order of preference, kitty only reads
+ * and removes files whose pathnames contain
+ * "tty-graphics-protocol"
+ */
+#ifndef TERM_KITTY_DIRECTORIES
+# define TERM_KITTY_DIRECTORIES  "/dev/shm", "/tmp"
+#endif
+
+/**
+ * The maximum number of base64 characters in one chunk
+ * of an image that is sent to kitty over the terminal
+ */
+#define KITTY_CHUNK  4096
+
+/**
+ * The number of colours in the sixel palette, a
+ * 6 × 6 × 6 colour cube followed by greys
+ */
+#define SIXEL_COLOURS  256
+
+
+
+/**
+ * The width of the screen
+ */
+static size_t term_width;
+
+/**
+ * The height of the screen
+ */
+static size_t term_height;
+
+/**
+ * The height of a character cell, in pixels, images are only
+ * updated in whole strips of this height, as they can only be
+ * placed at the top edge of a cell
+ */
+static size_t term_cell_height;
+
+/**
+ * Whether the kitty graphics protocol is used rather than sixel,
+ * -1 if it shall be selected depending on the terminal
+ */
+static int term_kitty = -1;
+
+/**
+ * Whether kitty runs on the same machine, so that
+ * the image can be sent through a file
+ */
+static int term_local;
+
+/**
+ * The pixel format of the screen, R, G, and B bytes
+ */
+static blit_format_t term_format;
+
+/**
+ * The back buffer
+ */
+static canvas_t term_canvas = { .pixels = NULL };
+
+/**
+ * The image that is being drawn row by row
+ */
+static display_header_t term_header = { .levels = NULL };
+
+/**
+ * The last presented content of the back buffer, this is what is encoded
+ */
+static unsigned char* term_screen = NULL;
+
+/**
+ * Escape sequences that are written to the terminal at once
+ */
+static char* output = NULL;
+
+/**
+ * The number of bytes in `output`
+ */
+static size_t output_ptr = 0;
+
+/**
+ * The allocation size of `output`
+ */
+static size_t output_size = 0;
+
+/**
+ * The palette index for each colour, with 5 bits per
+ * channel, computed once and then used for all frames
+ */
+static unsigned char sixel_map[1 << 15];
+
+/**
+ * Whether `sixel_map` has been computed
+ */
+static int sixel_map_ready = 0;
+
+/**
+ * The sixels of one band of rows, `term_width` bytes per colour
+ */
+static unsigned char* sixel_bits = NULL;
+
+
+
+/**
+ * Make room for more data in `output`
+ * 
+ * @param   n  The number of bytes that will be appended
+ * @return     Zero on success, -1 on error
+ */
+static int output_reserve(size_t n)
+{
+  char* new;
+  size_t new_size = output_size ? output_size : 64 << 10;
+  
+  if (output_size - output_ptr >= n)
+    return 0;
+  while (new_size - output_ptr < n)
+    new_size <<= 1;
+  new = realloc(output, new_size);
+  if (new == NULL)
+    return -1;
+  output = new;
+  output_size = new_size;
+  return 0;
+}
+
+
+/**
+ * Append a string to `output`, room must have been reserved
+ * 
+ * @param  str  The string
+ */
+static void output_string(const char* str)
+{
+  size_t n = strlen(str);
+  memcpy(output + output_ptr, str, n);
+  output_ptr += n;
+}
+
+
+/**
+ * Append a number to `output`, room must have been reserved
+ * 
+ * @param  n  The number
+ */
+static void output_number(size_t n)
+{
+  char buf[3 * sizeof(size_t)];
+  size_t i = sizeof(buf);
+  
+  do
+    buf[--i] = (char)('0' + n % 10);
+  while (n /= 10);
+  memcpy(output + output_ptr, buf + i, sizeof(buf) - i);
+  output_ptr += sizeof(buf) - i;
+}
+
+
+/**
+ * Write and clear `output`
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int output_flush(void)
+{
+  size_t ptr = 0;
+  ssize_t wrote;
+  
+  while (ptr < output_ptr)
+    {
+      wrote = write(STDOUT_FILENO, output + ptr, output_ptr - ptr);
+      if (wrote < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  output_ptr = 0;
+	  return -1;
+	}
+      ptr += (size_t)wrote;
+    }
+  output_ptr = 0;
+  return 0;
+}
+
+
+/**
+ * Get the colour of an entry in the sixel palette
+ * 
+ * @param  index  The index of the entry
+ * @param  rgb    Output parameter for the red, green, and blue values, 0 to 255
+ */
+static void sixel_palette(size_t index, unsigned int rgb[3])
+{
+  if (index < 216)
+    {
+      rgb[0] = (unsigned int)(index / 36) * 51;
+      rgb[1] = (unsigned int)(index / 6 % 6) * 51;
+      rgb[2] = (unsigned int)(index % 6) * 51;
+    }
+  else
+    rgb[0] = rgb[1] = rgb[2] = (unsigned int)(index - 216 + 1) * 255 / (SIXEL_COLOURS - 216 + 1);
+}
+
+
+/**
+ * Compute `sixel_map`, once
+ */
+static void sixel_init_map(void)
+{
+  unsigned int palette[SIXEL_COLOURS][3];
+  unsigned int rgb[3];
+  size_t i, j, best = 0;
+  long int d, best_d, diff;
+  int c;
+  
+  if (sixel_map_ready)
+    return;
+  
+  for (i = 0; i < SIXEL_COLOURS; i++)
+    sixel_palette(i, palette[i]);
+  
+  for (i = 0; i < sizeof(sixel_map); i++)
+    {
+      rgb[0] = (unsigned int)(i >> 10 & 31) * 255 / 31;
+      rgb[1] = (unsigned int)(i >>  5 & 31) * 255 / 31;
+      rgb[2] = (unsigned int)(i >>  0 & 31) * 255 / 31;
+      for (j = 0, best_d = -1; j < SIXEL_COLOURS; j++)
+	{
+	  for (c = 0, d = 0; c < 3; c++)
+	    diff = (long int)(palette[j][c]) - (long int)(rgb[c]), d += diff * diff;
+	  if ((best_d < 0) || (d < best_d))
+	    best_d = d, best = j;
+	}
+      sixel_map[i] = (unsigned char)best;
+    }
+  
+  sixel_map_ready = 1;
+}
+
+
+/**
+ * Append a cursor movement to the left edge of a
+ * strip of cells to `output`, room must have been reserved
+ * 
+ * @param  top  The top edge of the strip, in pixels, a multiple of `term_cell_height`
+ */
+static void output_goto(size_t top)
+{
+  output_string("\033[");
+  output_number(top / term_cell_height + 1);
+  output_string(";1H");
+}
+
+
+/**
+ * Check whether a strip of cells was modified by the last flush
+ * 
+ * @param   top  The top edge of the strip, in pixels, a multiple of `term_cell_height`
+ * @return       1 if the strip was modified, 0 otherwise
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static int strip_damaged(size_t top)
+{
+  const canvas_rect_t* rect;
+  size_t i;
+  
+  for (i = 0; i < term_canvas.last_damage_count; i++)
+    {
+      rect = term_canvas.last_damage + i;
+      if (rect->width && rect->height && (rect->y < top + term_cell_height) && (rect->y + rect->height > top))
+	return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Encode rows of the screen as a sixel image into `output`,
+ * the image is drawn over the same rows on the terminal
+ * 
+ * @param   top     The first row, a multiple of `term_cell_height`
+ * @param   bottom  The row after the last row, it is rounded up to
+ *                  a whole band of 6 rows, unless that is outside
+ *                  the screen
+ * @return          Zero on success, -1 on error
+ */
+static int sixel_encode(size_t top, size_t bottom)
+{
+  size_t x, y, r, i, n, end, colour, used_count;
+  size_t line_length = term_width * 3;
+  unsigned int rgb[3];
+  unsigned char used[SIXEL_COLOURS];
+  unsigned char used_list[SIXEL_COLOURS];
+  const unsigned char* p;
+  unsigned char* bits;
+  
+  sixel_init_map();
+  memset(used, 0, sizeof(used));
+  bottom = top + (bottom - top + 5) / 6 * 6;
+  if (bottom > term_height)
+    bottom = term_height;
+  
+  /* Header and palette, with colours in percent. */
+  if (output_reserve(96 + SIXEL_COLOURS * 20))
+    return -1;
+  output_goto(top);
+  output_string("\033P0;0;0q\"1;1;");
+  output_number(term_width);
+  output_string(";");
+  output_number(bottom - top);
+  for (i = 0; i < SIXEL_COLOURS; i++)
+    {
+      sixel_palette(i, rgb);
+      output_string("#"), output_number(i), output_string(";2;");
+      output_number((rgb[0] * 100 + 127) / 255), output_string(";");
+      output_number((rgb[1] * 100 + 127) / 255), output_string(";");
+      output_number((rgb[2] * 100 + 127) / 255);
+    }
+  
+  for (y = top; y < bottom; y += 6)
+    {
+      /* Split the band by colour, clearing only the colours that are used. */
+      used_count = 0;
+      for (r = 0; (r < 6) && (y + r < bottom); r++)
+	for (x = 0, p = term_screen + (y + r) * line_length; x < term_width; x++, p += 3)
+	  {
+	    colour = sixel_map[(p[0] >> 3) << 10 | (p[1] >> 3) << 5 | p[2] >> 3];
+	    if (!used[colour])
+	      {
+		used[colour] = 1;
+		used_list[used_count++] = (unsigned char)colour;
+		memset(sixel_bits + colour * term_width, 0, term_width);
+	      }
+	    sixel_bits[colour * term_width + x] |= (unsigned char)(1 << r);
+	  }
+      
+      /* Emit one run-length encoded line per colour, overprinting each other. */
+      if (output_reserve(used_count * (term_width + 8) + 8))
+	return -1;
+      for (i = 0; i < used_count; i++)
+	{
+	  colour = used_list[i];
+	  used[colour] = 0;
+	  bits = sixel_bits + colour * term_width;
+	  for (end = term_width; end && !bits[end - 1]; end--);
+	  output_string(i ? "$#" : "#");
+	  output_number(colour);
+	  for (x = 0; x < end; x += n)
+	    {
+	      for (n = 1; (x + n < end) && (bits[x + n] == bits[x]); n++);
+	      if (n > 3)
+		{
+		  output[output_ptr++] = '!';
+		  output_number(n);
+		  output[output_ptr++] = (char)(63 + bits[x]);
+		}
+	      else
+		for (r = 0; r < n; r++)
+		  output[output_ptr++] = (char)(63 + bits[x]);
+	    }
+	}
+      output[output_ptr++] = '-';
+    }
+  
+  if (output_reserve(2))
+    return -1;
+  output_string("\033\\");
+  return 0;
+}
+
+
+/**
+ * Write pixels to a file that kitty reads and removes
+ * 
+ * @param   pathname  Output parameter for the pathname of the file
+ * @param   data      The pixels
+ * @param   size      The number of bytes in `data`
+ * @return            Zero on success, -1 on error
+ */
+static int kitty_write_file(char pathname[static 64], const unsigned char* restrict data, size_t size)
+{
+  static const char* directories[] = { TERM_KITTY_DIRECTORIES };
+  size_t i, ptr = 0;
+  ssize_t wrote;
+  int fd = -1, saved_errno;
+  
+  for (i = 0; i < sizeof(directories) / sizeof(*directories); i++)
+    {
+      snprintf(pathname, 64, "%s/crazy-tty-graphics-protocol-XXXXXX", directories[i]);
+      if (fd = mkstemp(pathname), fd >= 0)
+	break;
+    }
+  t (fd < 0);
+  
+  while (ptr < size)
+    {
+      wrote = write(fd, data + ptr, size - ptr);
+      if (wrote < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      ptr += (size_t)wrote;
+    }
+  t (close(fd));
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd), unlink(pathname);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Append base64 encoded data to `output`, room must have been reserved
+ * 
+ * @param  data  The data
+ * @param  n     The number of bytes in `data`
+ */
+static void output_base64(const unsigned char* restrict data, size_t n)
+{
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned long int v;
+  char* out = output + output_ptr;
+  
+  for (; n >= 3; n -= 3, data += 3)
+    {
+      v = (unsigned long int)data[0] << 16 | (unsigned long int)data[1] << 8 | data[2];
+      *out++ = digits[v >> 18 & 63], *out++ = digits[v >> 12 & 63];
+      *out++ = digits[v >>  6 & 63], *out++ = digits[v >>  0 & 63];
+    }
+  if (n)
+    {
+      v = (unsigned long int)data[0] << 16 | (n > 1 ? (unsigned long int)data[1] << 8 : 0);
+      *out++ = digits[v >> 18 & 63], *out++ = digits[v >> 12 & 63];
+      *out++ = n > 1 ? digits[v >> 6 & 63] : '=';
+      *out++ = '=';
+    }
+  output_ptr = (size_t)(out - output);
+}
+
+
+/**
+ * Encode a strip of cells of the screen as a kitty graphics protocol
+ * command into `output`, each strip is its own image, and the image
+ * replaces the previously displayed image of the same strip
+ * 
+ * @param   top  The top edge of the strip, in pixels, a multiple of `term_cell_height`
+ * @return       Zero on success, -1 on error
+ */
+static int kitty_encode(size_t top)
+{
+  const unsigned char* data = term_screen + top * term_width * 3;
+  size_t height = term_height - top < term_cell_height ? term_height - top : term_cell_height;
+  size_t size = term_width * height * 3, ptr, n;
+  char pathname[64];
+  
+  if (output_reserve(160))
+    return -1;
+  output_goto(top);
+  output_string("\033_Ga=T,i=");
+  output_number(top / term_cell_height + 1);
+  output_string(",q=2,C=1,f=24,s=");
+  output_number(term_width);
+  output_string(",v=");
+  output_number(height);
+  
+  /* Locally, let kitty read the pixels from a file in memory. */
+  if (term_local && !kitty_write_file(pathname, data, size))
+    {
+      if (output_reserve(128))
+	return -1;
+      output_string(",t=t;");
+      output_base64((const unsigned char*)pathname, strlen(pathname));
+      output_string("\033\\");
+      return 0;
+    }
+  
+  /* Otherwise, send the pixels over the terminal in chunks. */
+  if (output_reserve(size / 3 * 4 + (size / (KITTY_CHUNK / 4 * 3) + 1) * 16))
+    return -1;
+  for (ptr = 0; ptr < size; ptr += n)
+    {
+      n = size - ptr < KITTY_CHUNK / 4 * 3 ? size - ptr : KITTY_CHUNK / 4 * 3;
+      if (ptr)
+	output_string("\033_G");
+      output_string(ptr + n < size ? (ptr ? "m=1;" : ",m=1;") : (ptr ? "m=0;" : ";"));
+      output_base64(data + ptr, n);
+      output_string("\033\\");
+    }
+  return 0;
+}
+
+
+/**
+ * Make the content of the back buffer visible, only
+ * the strips of cells that have been modified are sent
+ * to the terminal, for sixel, adjacent modified strips
+ * are sent as one image
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_term_present(void)
+{
+  size_t top, bottom;
+  
+  if (!term_canvas.damage_count)
+    return 0;
+  canvas_flush(&term_canvas, term_screen, term_width * 3);
+  
+  for (top = 0; top < term_height; top = bottom)
+    {
+      bottom = top + term_cell_height;
+      if (!strip_damaged(top))
+	continue;
+      if (term_kitty)
+	{
+	  if (kitty_encode(top))
+	    return -1;
+	  continue;
+	}
+      while ((bottom < term_height) && strip_damaged(bottom))
+	bottom += term_cell_height;
+      if (sixel_encode(top, bottom < term_height ? bottom : term_height))
+	return -1;
+    }
+  
+  return output_flush();
+}
+
+
+/**
+ * Configure the terminal graphics display system
+ * 
+ * The configuration is the name of the protocol, kitty or
+ * sixel, if `NULL` kitty is used inside kitty and sixel
+ * is used in other terminals
+ * 
+ * @param   spec  The configuration, may be `NULL`
+ * @return        Zero on success, -1 if the configuration is invalid
+ */
+int display_term_configure(const char* spec)
+{
+  if (spec == NULL)
+    term_kitty = -1;
+  else if (!strcmp(spec, "kitty"))
+    term_kitty = 1;
+  else if (!strcmp(spec, "sixel"))
+    term_kitty = 0;
+  else
+    return errno = EINVAL, -1;
+  return 0;
+}
+
+
+/**
+ * Terminate the display system
+ */
+static void display_term_terminate(void)
+{
+  blit_terminate();
+  canvas_destroy(&term_canvas);
+  if (term_screen != NULL)
+    {
+      output_ptr = 0;
+      if (!output_reserve(32))
+	{
+	  output_string(term_kitty ? "\033_Ga=d,d=A,q=2\033\\" : "");
+	  output_string("\033[2J\033[H\033[?25h");
+	  output_flush();
+	}
+    }
+  free(term_screen), term_screen = NULL;
+  free(sixel_bits), sixel_bits = NULL;
+  free(output), output = NULL;
+  output_ptr = output_size = 0;
+}
+
+
+/**
+ * Initialise the display system
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_term_initialise(void)
+{
+  struct winsize winsize;
+  const char* term = getenv("TERM");
+  int saved_errno;
+  
+  if (term_kitty < 0)
+    term_kitty = (getenv("KITTY_WINDOW_ID") != NULL) || ((term != NULL) && strstr(term, "kitty"));
+  term_local = (getenv("SSH_CONNECTION") == NULL) && (getenv("SSH_TTY") == NULL);
+  
+  /* Get the size of the terminal in pixels, but do not
+   * draw over the last line, lest the terminal scrolls. */
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &winsize) || !winsize.ws_col || !winsize.ws_row)
+    winsize.ws_col = 80, winsize.ws_row = 24, winsize.ws_xpixel = winsize.ws_ypixel = 0;
+  if (!winsize.ws_xpixel || (winsize.ws_ypixel < winsize.ws_row))
+    {
+      winsize.ws_xpixel = (unsigned short int)(winsize.ws_col * 10);
+      winsize.ws_ypixel = (unsigned short int)(winsize.ws_row * 20);
+    }
+  term_width  = winsize.ws_xpixel;
+  term_cell_height = winsize.ws_ypixel / winsize.ws_row;
+  term_height = (size_t)(winsize.ws_ypixel) - term_cell_height;
+  
+  t (blit_get_format(&term_format, 24, 0, 8, 8, 8, 16, 8));
+  t (term_screen = malloc(term_width * term_height * 3), term_screen == NULL);
+  if (!term_kitty)
+    t (sixel_bits = malloc(SIXEL_COLOURS * term_width), sixel_bits == NULL);
+  
+  /* Hide the cursor and blank out the screen. */
+  t (output_reserve(32));
+  output_string("\033[?25l\033[2J");
+  t (output_flush());
+  t (canvas_initialise(&term_canvas, term_width, term_height, &term_format));
+  t (display_term_present());
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  display_term_terminate();
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Draw an PNM image onto the screen, and clear what
+ * remains of the previously drawn image around it
+ * 
+ * @param   xoff       The where onto the screen the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the screen the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
+ */
+static int display_term_draw_image(size_t xoff, size_t yoff, size_t width, size_t height,
+				   const pnm_levels_t* restrict levels, int type,
+				   const unsigned char* restrict pixeldata)
+{
+  struct timespec start;
+  int r;
+  
+  display_frame_start(&start);
+  if (canvas_draw_image(&term_canvas, xoff, yoff, width, height, levels, type, pixeldata))
+    return -1;
+  r = display_term_present();
+  display_frame_end(&start);
+  return r;
+}
+
+
+/**
+ * Get the size of the screen
+ * 
+ * @param  width   Output parameter for the width of the screen
+ * @param  height  Output parameter for the height of the screen
+ */
+static void display_term_size(size_t* restrict width, size_t* restrict height)
+{
+  *width  = term_width;
+  *height = term_height;
+}
+
+
+/**
+ * Start drawing an image, the area the previously drawn image
+ * covered that the new image does not cover is cleared
+ * 
+ * @param   header  Description of the image, `header->levels` stays valid until `end` is called
+ * @return          Zero on success, -1 on error
+ */
+static int display_term_begin(const display_header_t* restrict header)
+{
+  term_header = *header;
+  canvas_begin_image(&term_canvas, header->xoff, header->yoff, header->width, header->height);
+  return 0;
+}
+
+
+/**
+ * Draw rows of the image, and make them visible
+ * 
+ * @param   first_row  The index of the first row to draw
+ * @param   count      The number of rows to draw
+ * @param   data       Pixel data, of the type described by the header, of the first row to draw
+ * @return             Zero on success, -1 on error
+ */
+static int display_term_rows(size_t first_row, size_t count, const unsigned char* restrict data)
+{
+  struct timespec start;
+  int r;
+  
+  display_frame_start(&start);
+  if (canvas_draw_rows(&term_canvas, first_row, count, term_header.levels, term_header.type, data))
+    return -1;
+  r = display_term_present();
+  display_frame_end(&start);
+  return r;
+}
+
+
+/**
+ * Finish drawing the image
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_term_end(void)
+{
+  term_header.levels = NULL;
+  return 0;
+}
+
+
+/**
+ * Let the user zoom and pan around an image at full resolution
+ * 
+ * @param   pathname  The pathname of the image, must be a raw PNM image
+ * @return            Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_term_inspect(const char* pathname)
+{
+  return viewer_run(pathname, term_width, term_height, display_term_draw_image, &display_tty_keys);
+}
+
+
+/**
+ * Show the pages in a directory as a grid of thumbnails
+ * 
+ * @param   directory  The directory with the pages, 1.pnm, 2.pnm, and so on
+ * @return             Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_term_browse(const char* directory)
+{
+  return contact_sheet_run(directory, term_width, term_height, display_term_draw_image, &display_tty_keys);
+}
+
+
+/**
+ * Get the functions associated with the terminal graphics display system
+ * 
+ * @param  display  Output parameter the functions
+ */
+void display_term_get(display_t* restrict display)
+{
+  display->initialise = display_term_initialise;
+  display->size       = display_term_size;
+  display->begin      = display_term_begin;
+  display->rows       = display_term_rows;
+  display->end        = display_term_end;
+  display->inspect    = display_term_inspect;
+  display->browse     = display_term_browse;
+  display->terminate  = display_term_terminate;
+}
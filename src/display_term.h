@@ -0,0 +1,45 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_DISPLAY_TERM_H
+#define CRAZY_DISPLAY_TERM_H
+
+
+#include "display.h"
+
+
+/**
+ * Configure the terminal graphics display system
+ * 
+ * The configuration is the name of the protocol, kitty or
+ * sixel, if `NULL` kitty is used inside kitty and sixel
+ * is used in other terminals
+ * 
+ * @param   spec  The configuration, may be `NULL`
+ * @return        Zero on success, -1 if the configuration is invalid
+ */
+int display_term_configure(const char* spec);
+
+/**
+ * Get the functions associated with the terminal graphics display system
+ * 
+ * @param  display  Output parameter the functions
+ */
+void display_term_get(display_t* restrict display);
+
+
+#endif
@@ -0,0 +1,530 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "display_x.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+
+#include "crazy.h"
+#include "blit.h"
+#include "canvas.h"
+#include "contact_sheet.h"
+#include "viewer.h"
+
+
+
+/**
+ * The connection to the X server
+ */
+static Display* x_display = NULL;
+
+/**
+ * The window the images are drawn in
+ */
+static Window x_window = None;
+
+/**
+ * The graphics context used to draw in `x_window`
+ */
+static GC x_gc = NULL;
+
+/**
+ * The image that is uploaded to `x_window`
+ */
+static XImage* x_image = NULL;
+
+/**
+ * The shared memory segment `x_image` is stored in,
+ * `shmaddr` is `NULL` if shared memory is not used
+ */
+static XShmSegmentInfo x_shm = { .shmaddr = NULL };
+
+/**
+ * Whether `x_shm` is attached to the X server
+ */
+static int x_shm_attached = 0;
+
+/**
+ * Set when the X server reports that an request failed
+ */
+static int x_error = 0;
+
+/**
+ * The width of the window
+ */
+static size_t x_width;
+
+/**
+ * The height of the window
+ */
+static size_t x_height;
+
+/**
+ * The pixel format of `x_image`
+ */
+static blit_format_t x_format;
+
+/**
+ * The back buffer, it is drawn directly in the memory of `x_image`,
+ * changes are uploaded to the window when presented
+ */
+static canvas_t x_canvas = { .pixels = NULL };
+
+/**
+ * The image that is being drawn row by row
+ */
+static display_header_t x_header = { .levels = NULL };
+
+/**
+ * Where the keys pressed in the window are read from,
+ * `fd` is set when the X server has been connected to
+ */
+static display_keys_t x_keys = { .fd = -1, .read = NULL };
+
+
+
+/**
+ * Remember that a request failed, instead of exiting
+ * 
+ * @param   display  The connection to the X server
+ * @param   event    The error
+ * @return           Ignored
+ */
+static int display_x_error_handler(Display* display, XErrorEvent* event)
+{
+  (void) display;
+  (void) event;
+  x_error = 1;
+  return 0;
+}
+
+
+/**
+ * Get the position and length of the bits in a mask
+ * 
+ * @param  mask    The mask
+ * @param  offset  Output parameter for the position of the lowest set bit
+ * @param  length  Output parameter for the number of set bits
+ */
+static void display_x_mask_field(unsigned long int mask, unsigned int* restrict offset,
+				 unsigned int* restrict length)
+{
+  for (*offset = 0; mask && !(mask & 1); mask >>= 1)
+    *offset += 1;
+  for (*length = 0; mask & 1; mask >>= 1)
+    *length += 1;
+}
+
+
+/**
+ * Create the image in shared memory, so that it is
+ * uploaded without being sent over the socket
+ * 
+ * @param   visual  The visual of the window
+ * @param   depth   The depth of the window
+ * @return          Zero on success, -1 if shared memory cannot be used
+ */
+static int display_x_create_shm_image(Visual* visual, int depth)
+{
+  int (*old_handler)(Display*, XErrorEvent*);
+  
+  if (!XShmQueryExtension(x_display))
+    return -1;
+  
+  x_shm.shmid = -1;
+  x_image = XShmCreateImage(x_display, visual, (unsigned int)depth, ZPixmap, NULL, &x_shm,
+			    (unsigned int)x_width, (unsigned int)x_height);
+  if (x_image == NULL)
+    return -1;
+  
+  x_shm.shmid = shmget(IPC_PRIVATE, (size_t)(x_image->bytes_per_line) * x_height, IPC_CREAT | 0600);
+  if (x_shm.shmid < 0)
+    goto fail;
+  x_shm.shmaddr = x_image->data = shmat(x_shm.shmid, NULL, 0);
+  if (x_shm.shmaddr == (char*)-1)
+    goto fail;
+  x_shm.readOnly = False;
+  
+  /* Attaching fails asynchronously, for example if the server is remote. */
+  x_error = 0;
+  old_handler = XSetErrorHandler(display_x_error_handler);
+  XShmAttach(x_display, &x_shm);
+  XSync(x_display, False);
+  XSetErrorHandler(old_handler);
+  if (x_error)
+    goto fail;
+  x_shm_attached = 1;
+  
+  /* Let the segment be removed as soon as both sides have detached. */
+  shmctl(x_shm.shmid, IPC_RMID, NULL);
+  return 0;
+ fail:
+  if ((x_shm.shmaddr != NULL) && (x_shm.shmaddr != (char*)-1))
+    shmdt(x_shm.shmaddr);
+  if (x_shm.shmid >= 0)
+    shmctl(x_shm.shmid, IPC_RMID, NULL);
+  x_shm.shmaddr = NULL;
+  x_image->data = NULL;
+  XDestroyImage(x_image), x_image = NULL;
+  return -1;
+}
+
+
+/**
+ * Upload an area of the image to the window
+ * 
+ * @param  rect  The area
+ */
+static void display_x_put(const canvas_rect_t* restrict rect)
+{
+  int x = (int)(rect->x), y = (int)(rect->y);
+  unsigned int width = (unsigned int)(rect->width), height = (unsigned int)(rect->height);
+  
+  if (x_shm.shmaddr != NULL)
+    XShmPutImage(x_display, x_window, x_gc, x_image, x, y, x, y, width, height, False);
+  else
+    XPutImage(x_display, x_window, x_gc, x_image, x, y, x, y, width, height);
+}
+
+
+/**
+ * Make the content of the back buffer visible
+ * 
+ * The back buffer is the image, so nothing is copied,
+ * only the changed areas are uploaded to the window
+ */
+static void display_x_present(void)
+{
+  canvas_rect_t all = { 0, 0, x_width, x_height };
+  size_t i;
+  XEvent event;
+  int exposed = 0;
+  
+  /* The window has no backing store, so redraw it wholly when exposed,
+   * other events, such as key presses, are left for `display_x_read_keys`. */
+  while (XCheckTypedWindowEvent(x_display, x_window, Expose, &event))
+    exposed = 1;
+  
+  canvas_commit(&x_canvas);
+  if (exposed)
+    display_x_put(&all);
+  else
+    for (i = 0; i < x_canvas.last_damage_count; i++)
+      display_x_put(x_canvas.last_damage + i);
+  
+  /* Do not modify the shared image before the server has read it. */
+  XSync(x_display, False);
+}
+
+
+/**
+ * Read the keys pressed in the window, without blocking,
+ * encoded as a terminal encodes them, one key at a time
+ * 
+ * @param   keys  Output buffer for the keys
+ * @param   size  The size of `keys`, at least 8
+ * @return        The number of bytes stored in `keys`, -1 on error,
+ *                `errno` is set to `EAGAIN` if no keys are available
+ */
+static ssize_t display_x_read_keys(char* keys, size_t size)
+{
+  canvas_rect_t all = { 0, 0, x_width, x_height };
+  const char* sequence;
+  XEvent event;
+  KeySym sym;
+  int n;
+  
+  while (XPending(x_display))
+    {
+      XNextEvent(x_display, &event);
+      if (event.type == Expose)
+	{
+	  /* Redraw the image while waiting, so that it is not modified before the server has read it. */
+	  display_x_put(&all);
+	  XSync(x_display, False);
+	  continue;
+	}
+      if (event.type != KeyPress)
+	continue;
+      
+      n = XLookupString(&(event.xkey), keys, (int)size, &sym, NULL);
+      switch (sym)
+	{
+	case XK_Up:    case XK_KP_Up:         sequence = "\033[A";   break;
+	case XK_Down:  case XK_KP_Down:       sequence = "\033[B";   break;
+	case XK_Right: case XK_KP_Right:      sequence = "\033[C";   break;
+	case XK_Left:  case XK_KP_Left:       sequence = "\033[D";   break;
+	case XK_Prior: case XK_KP_Prior:      sequence = "\033[5~";  break;
+	case XK_Next:  case XK_KP_Next:       sequence = "\033[6~";  break;
+	case XK_Return: case XK_KP_Enter:     sequence = "\n";       break;
+	default:                              sequence = NULL;       break;
+	}
+      if (sequence != NULL)
+	n = (int)strlen(sequence), memcpy(keys, sequence, (size_t)n);
+      if (n > 0)
+	return (ssize_t)n;
+    }
+  
+  return errno = EAGAIN, -1;
+}
+
+
+/**
+ * Terminate the display system
+ */
+static void display_x_terminate(void)
+{
+  blit_terminate();
+  canvas_destroy(&x_canvas);
+  if (x_shm_attached)
+    XShmDetach(x_display, &x_shm), x_shm_attached = 0;
+  if (x_image != NULL)
+    {
+      if (x_shm.shmaddr != NULL)
+	x_image->data = NULL;
+      XDestroyImage(x_image), x_image = NULL;
+    }
+  if (x_shm.shmaddr != NULL)
+    shmdt(x_shm.shmaddr), x_shm.shmaddr = NULL;
+  if (x_gc != NULL)
+    XFreeGC(x_display, x_gc), x_gc = NULL;
+  if (x_window != None)
+    XDestroyWindow(x_display, x_window), x_window = None;
+  if (x_display != NULL)
+    XCloseDisplay(x_display), x_display = NULL;
+}
+
+
+/**
+ * Initialise the display system
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_x_initialise(void)
+{
+  int screen, depth, saved_errno;
+  Visual* visual;
+  Atom state, fullscreen;
+  XEvent event;
+  unsigned int offsets[3], lengths[3];
+  
+  /* Connect to the X server. */
+  x_display = XOpenDisplay(NULL);
+  if (x_display == NULL)
+    {
+      fprintf(stderr, "%s: cannot connect to the X server\n", execname);
+      errno = 0;
+      goto fail;
+    }
+  x_keys.fd   = ConnectionNumber(x_display);
+  x_keys.read = display_x_read_keys;
+  screen = DefaultScreen(x_display);
+  visual = DefaultVisual(x_display, screen);
+  depth  = DefaultDepth(x_display, screen);
+  x_width  = (size_t)DisplayWidth(x_display, screen);
+  x_height = (size_t)DisplayHeight(x_display, screen);
+  
+  /* Create a fullscreen window. */
+  x_window = XCreateSimpleWindow(x_display, RootWindow(x_display, screen), 0, 0,
+				 (unsigned int)x_width, (unsigned int)x_height, 0,
+				 BlackPixel(x_display, screen), BlackPixel(x_display, screen));
+  XStoreName(x_display, x_window, execname);
+  state      = XInternAtom(x_display, "_NET_WM_STATE", False);
+  fullscreen = XInternAtom(x_display, "_NET_WM_STATE_FULLSCREEN", False);
+  XChangeProperty(x_display, x_window, state, XA_ATOM, 32, PropModeReplace,
+		  (unsigned char*)&fullscreen, 1);
+  XSelectInput(x_display, x_window, ExposureMask | StructureNotifyMask | KeyPressMask);
+  x_gc = XCreateGC(x_display, x_window, 0, NULL);
+  XMapWindow(x_display, x_window);
+  do
+    XNextEvent(x_display, &event);
+  while (event.type != MapNotify);
+  
+  /* Create the image, in shared memory if possible. */
+  if (display_x_create_shm_image(visual, depth))
+    {
+      x_image = XCreateImage(x_display, visual, (unsigned int)depth, ZPixmap, 0, NULL,
+			     (unsigned int)x_width, (unsigned int)x_height, 32, 0);
+      t (x_image == NULL);
+      t (x_image->data = malloc((size_t)(x_image->bytes_per_line) * x_height), x_image->data == NULL);
+    }
+  
+  /* Select pixel conversion functions. */
+  display_x_mask_field(visual->red_mask,   offsets + 0, lengths + 0);
+  display_x_mask_field(visual->green_mask, offsets + 1, lengths + 1);
+  display_x_mask_field(visual->blue_mask,  offsets + 2, lengths + 2);
+  if ((visual->class != TrueColor) || (x_image->byte_order != LSBFirst) ||
+      blit_get_format(&x_format, (unsigned int)(x_image->bits_per_pixel),
+		      offsets[0], lengths[0], offsets[1], lengths[1], offsets[2], lengths[2]))
+    {
+      fprintf(stderr, "%s: unsupported X visual\n", execname);
+      errno = 0;
+      goto fail;
+    }
+  
+  /* Blank out the window, once, by drawing directly in the image. */
+  canvas_wrap(&x_canvas, x_width, x_height, &x_format, x_image->data, (size_t)(x_image->bytes_per_line));
+  display_x_present();
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  display_x_terminate();
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Draw an PNM image onto the window, and clear what
+ * remains of the previously drawn image around it
+ * 
+ * @param   xoff       The where onto the window the top-left corner of the image is drawn on the X-axis
+ * @param   yoff       The where onto the window the top-left corner of the image is drawn on the Y-axis
+ * @param   width      The width of the image
+ * @param   height     The height of the image
+ * @param   levels     Lookup table for the image's maxval
+ * @param   type       4: raw lineart, 5: raw greyscale, 6: raw colour
+ * @param   pixeldata  Pixel data of the type described by `type`
+ * @return             Zero on success, -1 on error
+ */
+static int display_x_draw_image(size_t xoff, size_t yoff, size_t width, size_t height,
+				const pnm_levels_t* restrict levels, int type,
+				const unsigned char* restrict pixeldata)
+{
+  struct timespec start;
+  
+  display_frame_start(&start);
+  if (canvas_draw_image(&x_canvas, xoff, yoff, width, height, levels, type, pixeldata))
+    return -1;
+  display_x_present();
+  display_frame_end(&start);
+  return 0;
+}
+
+
+/**
+ * Get the size of the window
+ * 
+ * @param  width   Output parameter for the width of the window
+ * @param  height  Output parameter for the height of the window
+ */
+static void display_x_size(size_t* restrict width, size_t* restrict height)
+{
+  *width  = x_width;
+  *height = x_height;
+}
+
+
+/**
+ * Start drawing an image, the area the previously drawn image
+ * covered that the new image does not cover is cleared
+ * 
+ * @param   header  Description of the image, `header->levels` stays valid until `end` is called
+ * @return          Zero on success, -1 on error
+ */
+static int display_x_begin(const display_header_t* restrict header)
+{
+  x_header = *header;
+  canvas_begin_image(&x_canvas, header->xoff, header->yoff, header->width, header->height);
+  return 0;
+}
+
+
+/**
+ * Draw rows of the image, and make them visible
+ * 
+ * @param   first_row  The index of the first row to draw
+ * @param   count      The number of rows to draw
+ * @param   data       Pixel data, of the type described by the header, of the first row to draw
+ * @return             Zero on success, -1 on error
+ */
+static int display_x_rows(size_t first_row, size_t count, const unsigned char* restrict data)
+{
+  struct timespec start;
+  
+  display_frame_start(&start);
+  if (canvas_draw_rows(&x_canvas, first_row, count, x_header.levels, x_header.type, data))
+    return -1;
+  display_x_present();
+  display_frame_end(&start);
+  return 0;
+}
+
+
+/**
+ * Finish drawing the image
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int display_x_end(void)
+{
+  x_header.levels = NULL;
+  return 0;
+}
+
+
+/**
+ * Let the user zoom and pan around an image at full resolution
+ * 
+ * @param   pathname  The pathname of the image, must be a raw PNM image
+ * @return            Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_x_inspect(const char* pathname)
+{
+  return viewer_run(pathname, x_width, x_height, display_x_draw_image, &x_keys);
+}
+
+
+/**
+ * Show the pages in a directory as a grid of thumbnails
+ * 
+ * @param   directory  The directory with the pages, 1.pnm, 2.pnm, and so on
+ * @return             Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+static int display_x_browse(const char* directory)
+{
+  return contact_sheet_run(directory, x_width, x_height, display_x_draw_image, &x_keys);
+}
+
+
+/**
+ * Get the functions associated with the X display system
+ * 
+ * @param  display  Output parameter the functions
+ */
+void display_x_get(display_t* restrict display)
+{
+  display->initialise = display_x_initialise;
+  display->size       = display_x_size;
+  display->begin      = display_x_begin;
+  display->rows       = display_x_rows;
+  display->end        = display_x_end;
+  display->inspect    = display_x_inspect;
+  display->browse     = display_x_browse;
+  display->terminate  = display_x_terminate;
+}
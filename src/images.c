@@ -19,78 +19,475 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 
 #include "crazy.h"
+#include "util.h"
+
+
+
+/**
+ * The number of milliseconds a `gm batch` process is given
+ * to run a command before it is killed
+ */
+#ifndef GM_BATCH_TIMEOUT
+# define GM_BATCH_TIMEOUT  30000
+#endif
+
+
+/**
+ * A long-lived `gm batch` process, it is fed one command per
+ * line on its stdin and answers each with PASS or FAIL on its
+ * stdout, so GraphicsMagick is only started once per thread
+ * rather than once per image
+ */
+struct gm_batch
+{
+  /**
+   * The process, its PID is -1 if it is not running
+   */
+  subprocess_t proc;
+  
+  /**
+   * The directory for `input` and `output`, it is
+   * created under $TMPDIR, or /tmp if it is not set
+   */
+  char* directory;
+  
+  /**
+   * The FIFO through which images are passed to the process
+   */
+  char* input;
+  
+  /**
+   * The FIFO through which images are passed from the process
+   */
+  char* output;
+  
+  /**
+   * Output from the process that has been read but not parsed
+   */
+  char buffer[128];
+  
+  /**
+   * The number of bytes stored in `buffer`
+   */
+  size_t buffered;
+};
+
+
+/**
+ * The key for each thread's `gm batch` process
+ */
+static pthread_key_t gm_batch_key;
+
+/**
+ * Makes sure `gm_batch_key` is only created once
+ */
+static pthread_once_t gm_batch_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Pipe an image through an external filter
+ * 
+ * @param   file         The filename of the filter command
+ * @param   argv         The command line arguments for the filter
+ * @param   image        The image to pipe
+ * @param   image_size   The number of bytes stored in `image`
+ * @param   output       Output parameter for the output of the filter
+ * @param   output_size  Output parameter for the number of bytes stored in `output`
+ * @return               Zero on success, -1 on error
+ */
+static int run_filter(const char* file, const char* const argv[], const char* image, size_t image_size,
+		      char** restrict output, size_t* restrict output_size)
+{
+  subprocess_t proc;
+  int saved_errno;
+  
+  *output = NULL;
+  *output_size = 0;
+  
+  t (subprocess_spawn(&proc, file, argv, SUBPROCESS_STDIN | SUBPROCESS_STDOUT));
+  if (subprocess_pump(&proc, image, image_size, output, output_size))
+    {
+      saved_errno = errno;
+      subprocess_reap(&proc);
+      errno = saved_errno;
+      goto fail;
+    }
+  t (subprocess_reap(&proc));
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(*output), *output = NULL;
+  *output_size = 0;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Remove the FIFOs and directory of a `gm batch` process, and free it
+ * 
+ * @param  batch  The process, must not be running
+ */
+static void gm_batch_free(struct gm_batch* batch)
+{
+  if (batch->input != NULL)
+    unlink(batch->input), free(batch->input);
+  if (batch->output != NULL)
+    unlink(batch->output), free(batch->output);
+  if (batch->directory != NULL)
+    rmdir(batch->directory), free(batch->directory);
+  free(batch);
+}
+
+
+/**
+ * Stop a `gm batch` process and remove its directory
+ * 
+ * @param  batch_  The process, will be freed
+ */
+static void gm_batch_destroy(void* batch_)
+{
+  struct gm_batch* batch = batch_;
+  int saved_errno = errno;
+  
+  if (batch->proc.pid >= 0)
+    {
+      /* The process exits when it reaches the end of its stdin. */
+      close(batch->proc.stdin_fd);
+      close(batch->proc.stdout_fd);
+      subprocess_reap(&(batch->proc));
+    }
+  gm_batch_free(batch);
+  errno = saved_errno;
+}
+
+
+/**
+ * Stop the `gm batch` process of the main thread when the program exits
+ */
+static void gm_batch_exit(void)
+{
+  struct gm_batch* batch = pthread_getspecific(gm_batch_key);
+  if (batch != NULL)
+    pthread_setspecific(gm_batch_key, NULL), gm_batch_destroy(batch);
+}
+
+
+/**
+ * Create `gm_batch_key`
+ */
+static void gm_batch_create_key(void)
+{
+  if (!pthread_key_create(&gm_batch_key, gm_batch_destroy))
+    atexit(gm_batch_exit);
+}
+
+
+/**
+ * Get the `gm batch` process of this thread, and start it
+ * if it is not running
+ * 
+ * @return  The process, `NULL` on error
+ */
+static struct gm_batch* gm_batch_get(void)
+{
+  struct gm_batch* batch;
+  const char* tmp;
+  int saved_errno;
+  
+  pthread_once(&gm_batch_once, gm_batch_create_key);
+  
+  batch = pthread_getspecific(gm_batch_key);
+  if (batch == NULL)
+    {
+      t (batch = calloc(1, sizeof(*batch)), batch == NULL);
+      batch->proc.pid = -1;
+      if (!(tmp = getenv("TMPDIR")) || !*tmp)
+	tmp = "/tmp";
+      aprintf(&(batch->directory), "%s/crazy-gm-XXXXXX", tmp);
+      t (batch->directory == NULL);
+      if (mkdtemp(batch->directory) == NULL)
+	{
+	  saved_errno = errno;
+	  free(batch->directory), batch->directory = NULL;
+	  errno = saved_errno;
+	  goto fail;
+	}
+      aprintf(&(batch->input),  "%s/in.pnm",  batch->directory);
+      aprintf(&(batch->output), "%s/out.pnm", batch->directory);
+      t ((batch->input == NULL) || (batch->output == NULL));
+      t (mkfifo(batch->input, 0600) || mkfifo(batch->output, 0600));
+      t ((errno = pthread_setspecific(gm_batch_key, batch)));
+    }
+  
+  /* The process is restarted if it has died. */
+  if (batch->proc.pid < 0)
+    {
+      batch->buffered = 0;
+      if (subprocess_spawn(&(batch->proc), "gm",
+			   (const char* const[]){"gm", "batch", "-echo", "off", "-feedback", "on",
+						 "-pass", "PASS", "-fail", "FAIL",
+						 "-stop-on-error", "off", NULL},
+			   SUBPROCESS_STDIN | SUBPROCESS_STDOUT))
+	return NULL;
+    }
+  
+  return batch;
+ fail:
+  saved_errno = errno;
+  if (batch != NULL)
+    gm_batch_free(batch);
+  errno = saved_errno;
+  return NULL;
+}
+
+
+/**
+ * Stop a `gm batch` process that has stopped responding
+ * 
+ * @param  batch  The process
+ */
+static void gm_batch_kill(struct gm_batch* restrict batch)
+{
+  int saved_errno = errno;
+  close(batch->proc.stdin_fd), batch->proc.stdin_fd = -1;
+  close(batch->proc.stdout_fd), batch->proc.stdout_fd = -1;
+  kill(batch->proc.pid, SIGKILL);
+  subprocess_reap(&(batch->proc));
+  batch->proc.pid = -1;
+  errno = saved_errno;
+}
+
+
+/**
+ * Get the time left until a deadline
+ * 
+ * @param   deadline  The deadline, on the monotonic clock
+ * @return            The number of milliseconds left, zero if the deadline has passed
+ */
+static int time_left(const struct timespec* restrict deadline)
+{
+  struct timespec now;
+  long long int ms;
+  
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms  = (long long int)(deadline->tv_sec - now.tv_sec) * 1000;
+  ms += (long long int)(deadline->tv_nsec - now.tv_nsec) / 1000000;
+  return ms < 0 ? 0 : ms > GM_BATCH_TIMEOUT ? GM_BATCH_TIMEOUT : (int)ms;
+}
 
 
 /**
- * Initialise the state for the PNM header-parsing
+ * Parse the output of a `gm batch` process that has been read,
+ * anything that is not the status of a command, such as warnings,
+ * is skipped, the status may be preceded by a prompt, which is
+ * not followed by a LF
  * 
- * @param  state    The major state of the parser, 10 when done
- * @param  comment  Whether the parser is in a comment section
- * @param  type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
- * @param  maxval   The maximum value on a subpixel
- * @param  width    The width of the image, in pixels
- * @param  height   The height of the image, in pixels
+ * @param   batch  The process
+ * @return         0 if PASS was read, 1 if FAIL was read,
+ *                 -1 if the status has not been read yet
  */
-void pnm_init_parse_header(int* restrict state, int* restrict comment, int* restrict type,
-			   unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height)
+static int gm_batch_status(struct gm_batch* restrict batch)
 {
-  *state = *comment = *type = 0;
-  *maxval = 0;
-  *width = *height = 0;
+  int status;
+  char* lf;
+  
+  while ((lf = memchr(batch->buffer, '\n', batch->buffered)) != NULL)
+    {
+      status = lf - batch->buffer < 4 ? -1 : !memcmp(lf - 4, "PASS", 4) ? 0 : !memcmp(lf - 4, "FAIL", 4) ? 1 : -1;
+      lf++;
+      batch->buffered -= (size_t)(lf - batch->buffer);
+      memmove(batch->buffer, lf, batch->buffered);
+      if (status >= 0)
+	return status;
+    }
+  if (batch->buffered == sizeof(batch->buffer))
+    batch->buffered = 0;
+  return -1;
 }
 
 
 /**
- * Parse the header of a PNM file
+ * Run a command in a `gm batch` process, and pipe an image
+ * through it
+ * 
+ * The image is fed to the process through its input FIFO, and
+ * its output is read from its output FIFO, while the process's
+ * stdout is watched for the status of the command. The process
+ * opens the FIFOs only when it runs the command, so no data is
+ * written to disk, and a process that does not answer within
+ * `GM_BATCH_TIMEOUT` milliseconds is killed
  * 
- * @param   state    The major state of the parser, 10 when done
- * @param   comment  Whether the parser is in a comment section
- * @param   type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
- * @param   maxval   The maximum value on a subpixel
- * @param   width    The width of the image, in pixels
- * @param   height   The height of the image, in pixels
- * @param   size     The bytes ready to be read from `image`
- * @param   image    The image
- * @return           The number of bytes read from `image`
+ * @param   batch        The process, it will be stopped if it fails to respond
+ * @param   command      The command, without the leading "gm" and with a trailing LF
+ * @param   image        The image to pipe
+ * @param   image_size   The number of bytes stored in `image`
+ * @param   output       Output parameter for the output of the command
+ * @param   output_size  Output parameter for the number of bytes stored in `output`
+ * @return               Zero on success, -1 on error, `errno` will be set to zero
+ *                       if the command failed
  */
-size_t pnm_parse_header(int* restrict state, int* restrict comment, int* restrict type,
-			unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height,
-			size_t size, const char* image)
+static int gm_batch_run(struct gm_batch* restrict batch, const char* command, const char* image,
+			size_t image_size, char** restrict output, size_t* restrict output_size)
 {
-#define X(S)  ((*state == S) || (*state == S + 1)) && ('0' <= c) && (c <= '9')
+  struct pollfd fds[3];
+  struct timespec deadline;
+  sigset_t sigpipe, saved_mask;
+  struct timespec no_wait = { 0, 0 };
+  size_t n = strlen(command), written = 0, size = 8 << 10;
+  int in_fd = -1, out_fd = -1, status = -1, got_epipe = 0, timeout, backoff = 1, saved_errno;
+  ssize_t r;
+  char* new;
   
-  size_t i;
-  char c;
+  *output = NULL;
+  *output_size = 0;
   
-  for (i = 0; i < size; i++)
-    if (c = image[i], *state == 9)
-      {
-	if (c == '\n')
-	  return *state = 10, i;
-      }
-    else if (comment)                      *comment = c != '\n';
-    else if (c == '#')                     *comment = 1;
-    else if ((*state == 0) && (c == 'P'))  ++*state;
-    else if (X(1))                         *state = 2, *type   = *type   * 10 + (c & 15);
-    else if (X(3))                         *state = 4, *width  = *width  * 10 + (c & 15);
-    else if (X(5))                         *state = 6, *height = *height * 10 + (c & 15);
-    else if (X(7))                         *state = 8, *maxval = *maxval * 10 + (c & 15);
-    else if ((*state % 2) == 0)
-      {
-	++*state;
-	if ((*state == 7) && (*type == 4))  *state = 9, *maxval = 1;
-	if ((*state == 9) && (c == '\n'))   return *state = 10, i;
-      }
+  /* Do not get killed if the process has exited or stopped reading the image. */
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &saved_mask);
   
-  return i;
+  t (*output = malloc(size), *output == NULL);
   
-#undef X
+  /* Opening the read end first lets the process open the write end without
+   * blocking. Until then, the FIFO neither reports end of file nor hangup. */
+  t (out_fd = open(batch->output, O_RDONLY | O_NONBLOCK | O_CLOEXEC), out_fd < 0);
+  
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += GM_BATCH_TIMEOUT / 1000;
+  deadline.tv_nsec += (GM_BATCH_TIMEOUT % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L)
+    deadline.tv_sec += 1, deadline.tv_nsec -= 1000000000L;
+  
+  while (written < n)
+    {
+      r = write(batch->proc.stdin_fd, command + written, n - written);
+      if (r >= 0)
+	written += (size_t)r;
+      else if (errno == EPIPE)
+	got_epipe = 1;
+      t ((r < 0) && (errno != EINTR));
+    }
+  written = 0;
+  
+  /* The output is complete when the process has passed and closed the FIFO. */
+  while ((status < 0) || ((status == 0) && (out_fd >= 0)))
+    {
+      /* Once the command has finished, the image will not be read. */
+      if ((status >= 0) && (written < image_size))
+	written = image_size;
+      
+      /* Close the input FIFO when the whole image has been written, so that
+       * the process reaches its end. Opening it for writing fails with ENXIO
+       * until the process has opened it for reading. */
+      if ((in_fd >= 0) && (written == image_size))
+	close(in_fd), in_fd = -1;
+      else if ((in_fd < 0) && (written < image_size))
+	{
+	  in_fd = open(batch->input, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	  t ((in_fd < 0) && (errno != ENXIO));
+	}
+      
+      t ((timeout = time_left(&deadline)) == 0 ? (errno = ETIMEDOUT) : 0);
+      if ((in_fd < 0) && (written < image_size))
+	{
+	  /* There is nothing to poll for until the process opens the
+	   * input FIFO, so retry with an increasing interval. */
+	  timeout = timeout < backoff ? timeout : backoff;
+	  backoff = backoff < 16 ? backoff << 1 : backoff;
+	}
+      
+      fds[0].fd = in_fd,  fds[0].events = POLLOUT;
+      fds[1].fd = out_fd, fds[1].events = POLLIN;
+      fds[2].fd = status < 0 ? batch->proc.stdout_fd : -1, fds[2].events = POLLIN;
+      if (poll(fds, 3, timeout) < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      
+      /* Feed the image. */
+      if ((in_fd >= 0) && fds[0].revents)
+	{
+	  r = write(in_fd, image + written, image_size - written);
+	  if (r >= 0)
+	    written += (size_t)r;
+	  else if (errno == EPIPE)
+	    got_epipe = 1, written = image_size;
+	  else
+	    t ((errno != EINTR) && (errno != EAGAIN));
+	}
+      
+      /* Drain the output. */
+      if ((out_fd >= 0) && fds[1].revents)
+	{
+	  if (size - *output_size < 1024)
+	    {
+	      new = realloc(*output, size <<= 1);
+	      t (new == NULL);
+	      *output = new;
+	    }
+	  r = read(out_fd, *output + *output_size, size - *output_size);
+	  if (r == 0)
+	    close(out_fd), out_fd = -1;
+	  else if (r > 0)
+	    *output_size += (size_t)r;
+	  else
+	    t ((errno != EINTR) && (errno != EAGAIN));
+	}
+      
+      /* Read the status. */
+      if ((status < 0) && fds[2].revents)
+	{
+	  r = read(batch->proc.stdout_fd, batch->buffer + batch->buffered,
+		   sizeof(batch->buffer) - batch->buffered);
+	  t ((r < 0) && (errno != EINTR));
+	  t (r == 0 ? (errno = 0, 1) : 0);
+	  if (r > 0)
+	    batch->buffered += (size_t)r, status = gm_batch_status(batch);
+	}
+    }
+  
+  if (in_fd >= 0)
+    close(in_fd);
+  if (out_fd >= 0)
+    close(out_fd);
+  if (got_epipe)
+    while ((sigtimedwait(&sigpipe, NULL, &no_wait) < 0) && (errno == EINTR));
+  pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+  if (status == 0)
+    return 0;
+  free(*output), *output = NULL;
+  *output_size = 0;
+  return errno = 0, -1;
+  
+ fail:
+  saved_errno = errno;
+  if (in_fd >= 0)
+    close(in_fd);
+  if (out_fd >= 0)
+    close(out_fd);
+  free(*output), *output = NULL;
+  *output_size = 0;
+  gm_batch_kill(batch);
+  if (got_epipe)
+    while ((sigtimedwait(&sigpipe, NULL, &no_wait) < 0) && (errno == EINTR));
+  pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+  errno = saved_errno;
+  return -1;
 }
 
 
@@ -113,7 +510,7 @@ int get_resize_dimensions(size_t img_width, size_t img_height, size_t max_width,
   if (*new_width <= max_width)
     return 1;
   
-  *new_height = max_width * img_width / img_height;
+  *new_height = max_width * img_height / img_width;
   *new_width = max_width;
   return 0;
 }
@@ -135,13 +532,9 @@ int resize_image(size_t width, size_t height, int resize_vertically, const char*
 		 size_t image_size, char** restrict scaled, size_t* restrict scaled_size)
 {
   char scale[3 * sizeof(size_t) + 2];
-  pid_t pid_1 = -1, pid_2 = -1, reaped;
-  int in_rw[2];
-  int out_rw[2];
-  int status, reap_count = 0;
-  size_t ptr = 0, size = 8 << 10;
-  ssize_t got;
-  char* old;
+  struct gm_batch* batch;
+  char* command;
+  int r, saved_errno;
   
   *scaled = NULL;
   *scaled_size = 0;
@@ -149,127 +542,37 @@ int resize_image(size_t width, size_t height, int resize_vertically, const char*
   if (resize_vertically)  sprintf(scale, "x%zu", height);
   else                    sprintf(scale, "%zux", width);
   
-  t (pipe(in_rw));
-  t (pipe(out_rw));
+  /* The images are passed through FIFOs, as the process's stdin carries the commands. */
+  t (batch = gm_batch_get(), batch == NULL);
+  aprintf(&command, "convert %s -format pnm -resize %s -filter %s pnm:%s\n",
+	  batch->input, scale, RESIZE_FILTER, batch->output);
+  t (command == NULL);
   
-  pid_1 = fork();
-  t (pid_1 < 0);
-  
-  if (pid_1 == 0)
-    {
-      close(in_rw[1]), in_rw[1] = -1;
-      close(out_rw[0]), out_rw[0] = -1;
-      if (STDIN_FILENO != in_rw[0])
-	{
-	  if (STDIN_FILENO == out_rw[1])
-	    {
-	      int fd = dup(out_rw[1]);
-	      close(out_rw[1]);
-	      out_rw[1] = fd;
-	    }
-	  else
-	    close(STDIN_FILENO);
-	  dup2(in_rw[0], STDIN_FILENO);
-	  close(in_rw[0]), in_rw[0] = -1;
-	}
-      if (STDOUT_FILENO != out_rw[1])
-	{
-	  close(STDOUT_FILENO);
-	  dup2(out_rw[1], STDOUT_FILENO);
-	  close(out_rw[1]), out_rw[1] = -1;
-	}
-      
-      execlp("gm", "gm", "convert", "-", "-format", "pnm", "-resize", scale, "-filter", "Lanczos", "-", NULL);
-      goto fail;
-    }
-  
-  close(in_rw[0]), in_rw[0] = -1;
-  close(out_rw[1]), out_rw[1] = -1;
-  
-  pid_2 = fork();
-  t (pid_2 < 0);
-  
-  if (pid_2 == 0)
-    {
-      close(out_rw[0]), out_rw[0] = -1;
-      
-      while (ptr < image_size)
-	{
-	  got = write(in_rw[1], image + ptr, image_size - ptr);
-	  t (got < 0);
-	  ptr += (size_t)got;
-	}
-      
-      close(in_rw[1]);
-      exit(0);
-    }
-  
-  close(in_rw[1]), in_rw[1] = -1;
-  
-  *scaled = malloc(size);
-  t (*scaled == NULL);
-  for (;;)
-    {
-      if (size - ptr < 1024)
-	{
-	  old = *scaled;
-	  *scaled = realloc(*scaled, size <<= 1);
-	  if (*scaled == NULL)
-	    {
-	      *scaled = old;
-	      goto fail;
-	    }
-	}
-      got = read(out_rw[0], *scaled, size - ptr);
-      if (got == 0)
-	break;
-      if (got < 0)
-	{
-	  t (errno != EINTR);
-	  continue;
-	}
-      
-      ptr += (size_t)got;
-    }
-  *scaled_size = ptr;
-  
-  for (;;)
-    if (reaped = wait(&status), reaped < 0)
-      goto fail;
-    else if (reaped == pid_1)
-      {
-	if (status)
-	  {
-	    errno = 0;
-	    goto fail;
-	  }
-	if (++reap_count == 2)
-	  break;
-      }
-    else if (reaped == pid_2)
-      {
-	if (status)
-	  {
-	    errno = 0;
-	    goto fail;
-	  }
-	if (++reap_count == 2)
-	  break;
-      }
-  
-  close(out_rw[0]);
-  return 0;
+  r = gm_batch_run(batch, command, image, image_size, scaled, scaled_size);
+  saved_errno = errno;
+  free(command);
+  errno = saved_errno;
+  return r;
  fail:
-  if ((pid_1 == 0) && (pid_2 == 0))
-    perror(execname);
-  if (in_rw[0] >= 0)   close(in_rw[0]);
-  if (in_rw[1] >= 0)   close(in_rw[1]);
-  if (out_rw[0] >= 0)  close(out_rw[0]);
-  if (out_rw[1] >= 0)  close(out_rw[1]);
-  free(*scaled), *scaled = NULL;
-  *scaled_size = 0;
-  if ((pid_1 == 0) && (pid_2 == 0))
-    exit(1);
   return -1;
 }
 
+
+/**
+ * Pipe an image through a shell sequence, such as the one
+ * selected with --pipe or --postprocess
+ * 
+ * @param   command      The shell sequence
+ * @param   image        The image to pipe
+ * @param   image_size   The number of bytes stored in `image`
+ * @param   output       Output parameter for the output of `command`
+ * @param   output_size  Output parameter for the number of bytes stored in `output`
+ * @return               Zero on success, -1 on error
+ */
+int filter_image(const char* command, const char* image, size_t image_size,
+		 char** restrict output, size_t* restrict output_size)
+{
+  return run_filter("sh", (const char* const[]){"sh", "-c", command, NULL},
+		    image, image_size, output, output_size);
+}
+
@@ -21,37 +21,13 @@
 
 #include <stddef.h>
 
-
-/**
- * Initialise the state for the PNM header-parsing
- * 
- * @param  state    The major state of the parser, 10 when done
- * @param  comment  Whether the parser is in a comment section
- * @param  type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
- * @param  maxval   The maximum value on a subpixel
- * @param  width    The width of the image, in pixels
- * @param  height   The height of the image, in pixels
- */
-void pnm_init_parse_header(int* restrict state, int* restrict comment, int* restrict type,
-			   unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height);
+#include "pnm.h"
 
 
 /**
- * Parse the header of a PNM file
- * 
- * @param   state    The major state of the parser, 10 when done
- * @param   comment  Whether the parser is in a comment section
- * @param   type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
- * @param   maxval   The maximum value on a subpixel
- * @param   width    The width of the image, in pixels
- * @param   height   The height of the image, in pixels
- * @param   size     The bytes ready to be read from `image`
- * @param   image    The image
- * @return           The number of bytes read from `image`
+ * The filter used when resizing images
  */
-size_t pnm_parse_header(int* restrict state, int* restrict comment, int* restrict type,
-			unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height,
-			size_t size, const char* image);
+#define RESIZE_FILTER  "Lanczos"
 
 
 /**
@@ -85,5 +61,20 @@ int resize_image(size_t width, size_t height, int resize_vertically, const char*
 		 size_t image_size, char** restrict scaled, size_t* restrict scaled_size);
 
 
+/**
+ * Pipe an image through a shell sequence, such as the one
+ * selected with --pipe or --postprocess
+ * 
+ * @param   command      The shell sequence
+ * @param   image        The image to pipe
+ * @param   image_size   The number of bytes stored in `image`
+ * @param   output       Output parameter for the output of `command`
+ * @param   output_size  Output parameter for the number of bytes stored in `output`
+ * @return               Zero on success, -1 on error
+ */
+int filter_image(const char* command, const char* image, size_t image_size,
+		 char** restrict output, size_t* restrict output_size);
+
+
 #endif
 
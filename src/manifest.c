@@ -0,0 +1,645 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "manifest.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "crazy.h"
+#include "pnm.h"
+
+
+
+/**
+ * The first line of a manifest
+ */
+#define MANIFEST_MAGIC  "crazy manifest 1"
+
+/**
+ * The number of bytes read from the beginning of a page to parse its header
+ */
+#define MANIFEST_HEADER_SIZE  4096
+
+/**
+ * The size of the buffer `scan_pages` reads directory entries into,
+ * large enough for tens of thousands of entries per system call
+ */
+#define SCAN_BUFFER_SIZE  (1 << 20)
+
+
+
+/**
+ * A directory entry as returned by the getdents64 system call
+ */
+struct linux_dirent64
+{
+  /**
+   * The inode number of the file
+   */
+  uint64_t d_ino;
+  
+  /**
+   * The offset of the next entry
+   */
+  int64_t d_off;
+  
+  /**
+   * The size of this entry
+   */
+  unsigned short int d_reclen;
+  
+  /**
+   * The type of the file
+   */
+  unsigned char d_type;
+  
+  /**
+   * The name of the file, NUL-terminated
+   */
+  char d_name[];
+};
+
+
+
+/**
+ * Compare two page numbers, for `qsort`
+ * 
+ * @param   a  One of the numbers
+ * @param   b  The other number
+ * @return     Negative if `a` is smaller, positive if `a` is larger, otherwise zero
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static int compare_numbers(const void* a, const void* b)
+{
+  size_t x = *(const size_t*)a, y = *(const size_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Get the number of a page from its filename
+ * 
+ * @param   name  The filename
+ * @return        N if `name` is N.pnm, where N is a positive integer
+ *                without leading zeroes, otherwise zero
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static size_t page_number(const char* name)
+{
+  size_t n = 0, digit;
+  
+  if ((*name < '1') || (*name > '9'))
+    return 0;
+  for (; ('0' <= *name) && (*name <= '9'); name++)
+    {
+      digit = (size_t)(*name - '0');
+      if (n > (SIZE_MAX - 1 - digit) / 10)
+	return 0;
+      n = n * 10 + digit;
+    }
+  
+  return strcmp(name, ".pnm") ? 0 : n;
+}
+
+
+/**
+ * Find the pages in a directory, the files named N.pnm,
+ * where N is a positive integer without leading zeroes
+ * 
+ * The directory is read once, with a large buffer for
+ * getdents64, so this only takes a few system calls,
+ * however many files and gaps there are
+ * 
+ * @param   dirfd    File descriptor for the directory, it must not have been read from
+ * @param   numbers  Output parameter for the numbers of the pages, sorted,
+ *                   shall be freed by the caller
+ * @param   count    Output parameter for the number of pages
+ * @return           Zero on success, -1 on error
+ */
+int scan_pages(int dirfd, size_t** numbers, size_t* count)
+{
+  const struct linux_dirent64* entry;
+  char* buf = NULL;
+  size_t* new;
+  size_t size = 0, n;
+  long int got, off;
+  int saved_errno;
+  
+  *numbers = NULL;
+  *count = 0;
+  
+  t (!(buf = malloc(SCAN_BUFFER_SIZE)));
+  
+  while ((got = syscall(SYS_getdents64, dirfd, buf, SCAN_BUFFER_SIZE)))
+    {
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      for (off = 0; off < got; off += entry->d_reclen)
+	{
+	  entry = (const struct linux_dirent64*)(const void*)(buf + off);
+	  if (!(n = page_number(entry->d_name)))
+	    continue;
+	  if (*count == size)
+	    {
+	      size = size ? (size << 1) : 64;
+	      t (!(new = realloc(*numbers, size * sizeof(size_t))));
+	      *numbers = new;
+	    }
+	  (*numbers)[(*count)++] = n;
+	}
+    }
+  
+  free(buf);
+  qsort(*numbers, *count, sizeof(size_t), compare_numbers);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(buf);
+  free(*numbers), *numbers = NULL;
+  *count = 0;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Get the pathname of a file in a directory
+ * 
+ * @param   dir   The directory
+ * @param   file  The pathname of the file relative to `dir`
+ * @return        The pathname, `NULL` on error
+ */
+static char* manifest_pathname(const char* dir, const char* file)
+{
+  char* path = malloc(strlen(dir) + strlen(file) + 2);
+  if (path != NULL)
+    stpcpy(stpcpy(stpcpy(path, dir), "/"), file);
+  return path;
+}
+
+
+/**
+ * Compare two pages by their numbers, for `bsearch`
+ * 
+ * @param   a  One of the pages
+ * @param   b  The other page
+ * @return     Negative if `a` comes before `b`, positive if
+ *             `a` comes after `b`, otherwise zero
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static int manifest_compare(const void* a, const void* b)
+{
+  size_t x = ((const struct manifest_page*)a)->number;
+  size_t y = ((const struct manifest_page*)b)->number;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Read the manifest stored in a directory
+ * 
+ * @param   dir       The directory
+ * @param   attr      The status of the directory
+ * @param   manifest  Output parameter for the pages
+ * @return            1 if the directory has not been modified since the manifest
+ *                    was written, 0 if it has, or if there is no manifest, in
+ *                    which case `manifest` may still list pages, -1 on error
+ */
+static int manifest_read(const char* dir, const struct stat* restrict attr, struct manifest* restrict manifest)
+{
+  struct manifest_page page;
+  struct manifest_page* new;
+  char* path = NULL;
+  FILE* f = NULL;
+  uintmax_t dev, ino;
+  intmax_t sec, nsec;
+  size_t size = 0;
+  int fresh, saved_errno;
+  
+  manifest->pages = NULL;
+  manifest->count = 0;
+  
+  t (!(path = manifest_pathname(dir, MANIFEST_FILE)));
+  f = fopen(path, "re");
+  if (f == NULL)
+    {
+      free(path);
+      return errno == ENOENT ? 0 : -1;
+    }
+  
+  if (fscanf(f, MANIFEST_MAGIC " %ju %ju %jd %jd", &dev, &ino, &sec, &nsec) != 4)
+    goto malformed;
+  fresh = (dev == (uintmax_t)(attr->st_dev)) && (ino == (uintmax_t)(attr->st_ino)) &&
+    (sec == (intmax_t)(attr->st_mtim.tv_sec)) && (nsec == (intmax_t)(attr->st_mtim.tv_nsec));
+  
+  while (fscanf(f, " %zu %ju %ju %jd %jd %i %u %zu %zu", &(page.number), &(page.inode), &(page.size),
+		&sec, &nsec, &(page.type), &(page.maxval), &(page.width), &(page.height)) == 9)
+    {
+      page.mtime.tv_sec = (time_t)sec;
+      page.mtime.tv_nsec = (long int)nsec;
+      if (manifest->count == size)
+	{
+	  size = size ? (size << 1) : 64;
+	  t (!(new = realloc(manifest->pages, size * sizeof(*new))));
+	  manifest->pages = new;
+	}
+      manifest->pages[manifest->count++] = page;
+    }
+  if (!feof(f))
+    goto malformed;
+  
+  fclose(f);
+  free(path);
+  return fresh;
+  
+ malformed:
+  /* A broken manifest is not an error, the directory is scanned instead. */
+  fclose(f);
+  free(path);
+  manifest_destroy(manifest);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (f != NULL)
+    fclose(f);
+  free(path);
+  manifest_destroy(manifest);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Read the header of a page
+ * 
+ * @param  dirfd  File descriptor for the directory of the page
+ * @param  name   The filename of the page
+ * @param  page   The page, its type, maximum value, width and height will be set,
+ *                the type will be zero if the header could not be parsed
+ */
+static void manifest_read_header(int dirfd, const char* name, struct manifest_page* restrict page)
+{
+  char buf[MANIFEST_HEADER_SIZE];
+  size_t ptr = 0;
+  ssize_t got;
+  int fd, state, comment;
+  
+  page->type = 0, page->maxval = 0, page->width = page->height = 0;
+  
+  fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  while (ptr < sizeof(buf))
+    {
+      got = read(fd, buf + ptr, sizeof(buf) - ptr);
+      if (got > 0)
+	ptr += (size_t)got;
+      else if ((got == 0) || (errno != EINTR))
+	break;
+    }
+  close(fd);
+  
+  pnm_init_parse_header(&state, &comment, &(page->type), &(page->maxval), &(page->width), &(page->height));
+  pnm_parse_header(&state, &comment, &(page->type), &(page->maxval), &(page->width), &(page->height), ptr, buf);
+  if (state != 10)
+    page->type = 0, page->maxval = 0, page->width = page->height = 0;
+}
+
+
+/**
+ * Scan a directory for pages
+ * 
+ * @param   dirfd     File descriptor for the directory
+ * @param   old       Pages whose headers need not be read again if the
+ *                    pages have not been modified, sorted by their numbers
+ * @param   manifest  Output parameter for the pages
+ * @return            Zero on success, -1 on error
+ */
+static int manifest_scan(int dirfd, const struct manifest* restrict old, struct manifest* restrict manifest)
+{
+  char name[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
+  const struct manifest_page* known = old->pages;
+  const struct manifest_page* known_end = old->pages + old->count;
+  struct manifest_page* page;
+  struct stat attr;
+  size_t* numbers = NULL;
+  size_t i, count;
+  int saved_errno;
+  
+  manifest->pages = NULL;
+  manifest->count = 0;
+  
+  t (scan_pages(dirfd, &numbers, &count));
+  t (count && !(manifest->pages = malloc(count * sizeof(*(manifest->pages)))));
+  
+  for (i = 0; i < count; i++)
+    {
+      sprintf(name, "%zu.pnm", numbers[i]);
+      if (fstatat(dirfd, name, &attr, 0))
+	{
+	  t (errno != ENOENT);
+	  continue;
+	}
+      page = manifest->pages + manifest->count++;
+      page->number = numbers[i];
+      page->inode  = (uintmax_t)(attr.st_ino);
+      page->size   = (uintmax_t)(attr.st_size);
+      page->mtime  = attr.st_mtim;
+      
+      /* Both lists are sorted, so the old manifest is followed along rather than searched. */
+      while ((known < known_end) && (known->number < page->number))
+	known++;
+      if ((known < known_end) && (known->number == page->number) && (known->type != 0) &&
+	  (known->inode == page->inode) && (known->size == page->size) &&
+	  (known->mtime.tv_sec == page->mtime.tv_sec) && (known->mtime.tv_nsec == page->mtime.tv_nsec))
+	*page = *known;
+      else
+	manifest_read_header(dirfd, name, page);
+    }
+  
+  free(numbers);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(numbers);
+  manifest_destroy(manifest);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Replace the manifest stored in a directory
+ * 
+ * @param   dir       The directory
+ * @param   attr      The status of the directory, from before it was scanned
+ * @param   scanned   The time the scan of the directory began
+ * @param   manifest  The pages
+ * @return            Zero on success, -1 on error
+ */
+static int manifest_write(const char* dir, const struct stat* restrict attr, time_t scanned,
+			  const struct manifest* restrict manifest)
+{
+  const struct manifest_page* page;
+  char* path = NULL;
+  char* temp = NULL;
+  FILE* f = NULL;
+  size_t i;
+  int fd, saved_errno;
+  
+  t (!(path = manifest_pathname(dir, MANIFEST_FILE)));
+  t (!(temp = manifest_pathname(dir, MANIFEST_FILE ".XXXXXX")));
+  t (fd = mkostemp(temp, O_CLOEXEC), fd < 0);
+  if (!(f = fdopen(fd, "w")))
+    {
+      saved_errno = errno;
+      close(fd);
+      errno = saved_errno;
+      goto fail_unlink;
+    }
+  
+  /* If the directory was modified in the second the scan began, it may be modified
+   * again without its modification time changing, so the manifest is not trusted. */
+  if (attr->st_mtim.tv_sec < scanned)
+    fprintf(f, MANIFEST_MAGIC "\n%ju %ju %jd %jd\n", (uintmax_t)(attr->st_dev), (uintmax_t)(attr->st_ino),
+	    (intmax_t)(attr->st_mtim.tv_sec), (intmax_t)(attr->st_mtim.tv_nsec));
+  else
+    fprintf(f, MANIFEST_MAGIC "\n0 0 0 0\n");
+  
+  for (i = 0; i < manifest->count; i++)
+    {
+      page = manifest->pages + i;
+      fprintf(f, "%zu %ju %ju %jd %jd %i %u %zu %zu\n", page->number, page->inode, page->size,
+	      (intmax_t)(page->mtime.tv_sec), (intmax_t)(page->mtime.tv_nsec),
+	      page->type, page->maxval, page->width, page->height);
+    }
+  
+  if (ferror(f) | fclose(f))
+    {
+      f = NULL;
+      goto fail_unlink;
+    }
+  f = NULL;
+  if (rename(temp, path))
+    goto fail_unlink;
+  
+  free(temp);
+  free(path);
+  return 0;
+ fail_unlink:
+  saved_errno = errno;
+  if (f != NULL)
+    fclose(f);
+  unlink(temp);
+  errno = saved_errno;
+ fail:
+  saved_errno = errno;
+  free(temp);
+  free(path);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Scan a directory of pages and, optionally, replace its manifest
+ * 
+ * @param   dir       The directory
+ * @param   old       Pages whose headers need not be read again if the
+ *                    pages have not been modified, sorted by their numbers
+ * @param   manifest  Output parameter for the pages
+ * @param   store     Whether to replace the manifest stored in the directory
+ * @return            Zero on success, -1 on error
+ */
+static int manifest_rescan(const char* dir, const struct manifest* restrict old,
+			   struct manifest* restrict manifest, int store)
+{
+  struct stat attr;
+  time_t scanned;
+  int dirfd, saved_errno;
+  
+  manifest->pages = NULL;
+  manifest->count = 0;
+  
+  t (dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC), dirfd < 0);
+  
+  /* Create the manifest's directory before the directory's modification time is recorded. */
+  if (store)
+    mkdirat(dirfd, MANIFEST_DIRECTORY, 0755);
+  scanned = time(NULL);
+  t (fstat(dirfd, &attr));
+  t (manifest_scan(dirfd, old, manifest));
+  close(dirfd), dirfd = -1;
+  
+  /* The manifest is only an optimisation, so it is not an error if it cannot be written. */
+  if (store)
+    manifest_write(dir, &attr, scanned, manifest);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (dirfd >= 0)
+    close(dirfd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Get the pages in a directory
+ * 
+ * The manifest stored in the directory is used if the directory
+ * has not been modified since it was written, otherwise the
+ * directory is scanned, reusing what the stored manifest says
+ * about the pages that have not been modified
+ * 
+ * The stored manifest is not replaced, so that reading a directory
+ * does not modify it, `manifest_update` shall be called after the
+ * pages have been modified
+ * 
+ * @param   dir       The directory
+ * @param   manifest  Output parameter for the pages, shall be
+ *                    released with `manifest_destroy`
+ * @return            Zero on success, -1 on error
+ */
+int manifest_load(const char* dir, struct manifest* manifest)
+{
+  struct manifest old;
+  struct stat attr;
+  int r, saved_errno;
+  
+  manifest->pages = NULL;
+  manifest->count = 0;
+  
+  t (stat(dir, &attr));
+  t (r = manifest_read(dir, &attr, &old), r < 0);
+  if (r > 0)
+    return *manifest = old, 0;
+  
+  r = manifest_rescan(dir, &old, manifest, 0);
+  manifest_destroy(&old);
+  return r;
+ fail:
+  saved_errno = errno;
+  manifest_destroy(manifest);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Scan a directory of pages and replace its manifest,
+ * this shall be done after the pages have been modified,
+ * errors are ignored as the manifest is only an optimisation
+ * 
+ * @param  dir  The directory
+ */
+void manifest_update(const char* dir)
+{
+  struct manifest old, manifest;
+  struct stat attr;
+  int saved_errno = errno;
+  
+  if (stat(dir, &attr) || (manifest_read(dir, &attr, &old) < 0))
+    old.pages = NULL, old.count = 0;
+  if (!manifest_rescan(dir, &old, &manifest, 1))
+    manifest_destroy(&manifest);
+  manifest_destroy(&old);
+  errno = saved_errno;
+}
+
+
+/**
+ * Release the resources of a manifest
+ * 
+ * @param  manifest  The manifest
+ */
+void manifest_destroy(struct manifest* manifest)
+{
+  free(manifest->pages);
+  manifest->pages = NULL;
+  manifest->count = 0;
+}
+
+
+/**
+ * Look up a page in a manifest
+ * 
+ * @param   manifest  The manifest
+ * @param   number    The number of the page
+ * @return            The page, `NULL` if it does not exist
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+const struct manifest_page* manifest_find(const struct manifest* manifest, size_t number)
+{
+  struct manifest_page key;
+  key.number = number;
+  if (manifest->count == 0)
+    return NULL;
+  return bsearch(&key, manifest->pages, manifest->count, sizeof(key), manifest_compare);
+}
+
+
+/**
+ * Count the pages in a sequence that exist before the first that does not
+ * 
+ * @param   manifest  The manifest
+ * @param   first     The number of the first page in the sequence
+ * @param   diff      The number difference between successive pages in the sequence
+ * @return            The number of pages, `first`, `first + diff`, `first + 2 * diff`,
+ *                    and so on, that exist before the first page that does not exist
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+size_t manifest_run(const struct manifest* manifest, size_t first, size_t diff)
+{
+  const struct manifest_page* page = manifest_find(manifest, first);
+  const struct manifest_page* end = manifest->pages + manifest->count;
+  size_t n = 0;
+  
+  /* The pages are sorted, so the sequence can be followed without searching from the beginning. */
+  for (; page != NULL; n++, first += diff)
+    {
+      if (first > SIZE_MAX - diff)
+	return n + 1;
+      while ((page < end) && (page->number < first + diff))
+	page++;
+      if ((page == end) || (page->number != first + diff))
+	return n + 1;
+    }
+  
+  return n;
+}
@@ -0,0 +1,186 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_MANIFEST_H
+#define CRAZY_MANIFEST_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+
+/**
+ * The directory, inside a directory of pages, in which
+ * the manifest of the pages is stored, it is a directory
+ * of its own so that replacing the manifest does not
+ * change the modification time of the directory of pages
+ */
+#define MANIFEST_DIRECTORY  ".crazy"
+
+/**
+ * The pathname of the manifest, relative to the directory of pages
+ */
+#define MANIFEST_FILE  MANIFEST_DIRECTORY "/manifest"
+
+
+
+/**
+ * A page listed in a manifest
+ */
+struct manifest_page
+{
+  /**
+   * The number of the page, N in N.pnm
+   */
+  size_t number;
+  
+  /**
+   * The inode number of the page
+   */
+  uintmax_t inode;
+  
+  /**
+   * The size of the page, in bytes
+   */
+  uintmax_t size;
+  
+  /**
+   * The last modification time of the page
+   */
+  struct timespec mtime;
+  
+  /**
+   * The PNM type of the page, 0 if its header could not be parsed
+   */
+  int type;
+  
+  /**
+   * The maximum value on a subpixel
+   */
+  unsigned int maxval;
+  
+  /**
+   * The width of the page, in pixels
+   */
+  size_t width;
+  
+  /**
+   * The height of the page, in pixels
+   */
+  size_t height;
+};
+
+
+/**
+ * The pages in a directory
+ */
+struct manifest
+{
+  /**
+   * The pages, sorted by their numbers
+   */
+  struct manifest_page* pages;
+  
+  /**
+   * The number of pages
+   */
+  size_t count;
+};
+
+
+
+/**
+ * Find the pages in a directory, the files named N.pnm,
+ * where N is a positive integer without leading zeroes
+ * 
+ * The directory is read once, with a large buffer for
+ * getdents64, so this only takes a few system calls,
+ * however many files and gaps there are
+ * 
+ * @param   dirfd    File descriptor for the directory, it must not have been read from
+ * @param   numbers  Output parameter for the numbers of the pages, sorted,
+ *                   shall be freed by the caller
+ * @param   count    Output parameter for the number of pages
+ * @return           Zero on success, -1 on error
+ */
+int scan_pages(int dirfd, size_t** numbers, size_t* count);
+
+/**
+ * Get the pages in a directory
+ * 
+ * The manifest stored in the directory is used if the directory
+ * has not been modified since it was written, otherwise the
+ * directory is scanned, reusing what the stored manifest says
+ * about the pages that have not been modified
+ * 
+ * The stored manifest is not replaced, so that reading a directory
+ * does not modify it, `manifest_update` shall be called after the
+ * pages have been modified
+ * 
+ * @param   dir       The directory
+ * @param   manifest  Output parameter for the pages, shall be
+ *                    released with `manifest_destroy`
+ * @return            Zero on success, -1 on error
+ */
+int manifest_load(const char* dir, struct manifest* manifest);
+
+/**
+ * Scan a directory of pages and replace its manifest,
+ * this shall be done after the pages have been modified,
+ * errors are ignored as the manifest is only an optimisation
+ * 
+ * @param  dir  The directory
+ */
+void manifest_update(const char* dir);
+
+/**
+ * Release the resources of a manifest
+ * 
+ * @param  manifest  The manifest
+ */
+void manifest_destroy(struct manifest* manifest);
+
+/**
+ * Look up a page in a manifest
+ * 
+ * @param   manifest  The manifest
+ * @param   number    The number of the page
+ * @return            The page, `NULL` if it does not exist
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+const struct manifest_page* manifest_find(const struct manifest* manifest, size_t number);
+
+/**
+ * Count the pages in a sequence that exist before the first that does not
+ * 
+ * @param   manifest  The manifest
+ * @param   first     The number of the first page in the sequence
+ * @param   diff      The number difference between successive pages in the sequence
+ * @return            The number of pages, `first`, `first + diff`, `first + 2 * diff`,
+ *                    and so on, that exist before the first page that does not exist
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+size_t manifest_run(const struct manifest* manifest, size_t first, size_t diff);
+
+
+#endif
@@ -0,0 +1,210 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "orientation.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crazy.h"
+#include "transform.h"
+
+
+
+/**
+ * Get the pathname of the orientation file of a page
+ * 
+ * @param   page    The pathname of the page
+ * @param   suffix  Text to append after `ORIENTATION_SUFFIX`
+ * @return          The pathname, `NULL` on error
+ */
+static char* orientation_pathname(const char* page, const char* suffix)
+{
+  char* path = malloc(strlen(page) + sizeof(ORIENTATION_SUFFIX) + strlen(suffix));
+  if (path != NULL)
+    stpcpy(stpcpy(stpcpy(path, page), ORIENTATION_SUFFIX), suffix);
+  return path;
+}
+
+
+/**
+ * Get the orientation of a page
+ * 
+ * The orientation is the transformation that shall be applied
+ * to the page's pixels when the page is shown or exported, in
+ * the same form as `c1`, `c2`, `c3` and `c4` in crazy.c
+ * 
+ * @param   page     The pathname of the page
+ * @param   corners  Output parameter for the orientation, 1, 2, 3, 4 if the
+ *                   page does not have an orientation
+ * @return           Zero on success, -1 on error, `errno` is set to `EINVAL`
+ *                   if the orientation file is malformed
+ */
+int orientation_read(const char* page, int corners[4])
+{
+  char* path = NULL;
+  char buf[64];
+  size_t ptr = 0;
+  ssize_t got;
+  int fd = -1, saved_errno;
+  
+  corners[0] = 1, corners[1] = 2, corners[2] = 3, corners[3] = 4;
+  
+  t (!(path = orientation_pathname(page, "")));
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      t (errno != ENOENT);
+      free(path);
+      return 0;
+    }
+  
+  while (ptr < sizeof(buf) - 1)
+    {
+      got = read(fd, buf + ptr, sizeof(buf) - 1 - ptr);
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      if (got == 0)
+	break;
+      ptr += (size_t)got;
+    }
+  buf[ptr] = '\0';
+  
+  if ((sscanf(buf, "%i %i %i %i", corners + 0, corners + 1, corners + 2, corners + 3) != 4) ||
+      !transform_valid(corners[0], corners[1], corners[2], corners[3]))
+    {
+      corners[0] = 1, corners[1] = 2, corners[2] = 3, corners[3] = 4;
+      t ((errno = EINVAL));
+    }
+  
+  close(fd);
+  free(path);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  free(path);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Set the orientation of a page
+ * 
+ * The page itself is not modified, and the orientation
+ * file is replaced atomically, or removed if the
+ * orientation is 1, 2, 3, 4
+ * 
+ * @param   page     The pathname of the page
+ * @param   corners  The orientation
+ * @return           Zero on success, -1 on error
+ */
+int orientation_write(const char* page, const int corners[4])
+{
+  char* path = NULL;
+  char* temp = NULL;
+  char buf[64];
+  size_t ptr = 0, len;
+  ssize_t wrote;
+  int fd = -1, saved_errno;
+  
+  t (!(path = orientation_pathname(page, "")));
+  
+  if (orientation_is_identity(corners))
+    {
+      t (unlink(path) && (errno != ENOENT));
+      free(path);
+      return 0;
+    }
+  
+  t (!(temp = orientation_pathname(page, ".temp")));
+  t (fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666), fd < 0);
+  len = (size_t)sprintf(buf, "%i %i %i %i\n", corners[0], corners[1], corners[2], corners[3]);
+  while (ptr < len)
+    {
+      wrote = write(fd, buf + ptr, len - ptr);
+      if (wrote < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      ptr += (size_t)wrote;
+    }
+  if (close(fd) && (errno != EINTR))
+    {
+      fd = -1;
+      goto fail;
+    }
+  fd = -1;
+  t (rename(temp, path));
+  
+  free(temp);
+  free(path);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  if (temp != NULL)
+    unlink(temp);
+  free(temp);
+  free(path);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Combine two orientations
+ * 
+ * @param  corners    The orientation to update
+ * @param  transform  The orientation to apply after `corners`
+ */
+void orientation_compose(int corners[4], const int transform[4])
+{
+  int previous[4];
+  
+  memcpy(previous, corners, sizeof(previous));
+  corners[0] = previous[transform[0] - 1];
+  corners[1] = previous[transform[1] - 1];
+  corners[2] = previous[transform[2] - 1];
+  corners[3] = previous[transform[3] - 1];
+}
+
+
+/**
+ * Check whether an orientation leaves pages unchanged
+ * 
+ * @param   corners  The orientation
+ * @return           1 if the orientation is 1, 2, 3, 4, otherwise 0
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+int orientation_is_identity(const int corners[4])
+{
+  return (corners[0] == 1) && (corners[1] == 2) && (corners[2] == 3) && (corners[3] == 4);
+}
@@ -0,0 +1,82 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_ORIENTATION_H
+#define CRAZY_ORIENTATION_H
+
+
+#include <stddef.h>
+
+
+
+/**
+ * The orientation of a page is stored in a file whose
+ * pathname is the page's pathname with this suffix
+ */
+#define ORIENTATION_SUFFIX  ".orientation"
+
+
+
+/**
+ * Get the orientation of a page
+ * 
+ * The orientation is the transformation that shall be applied
+ * to the page's pixels when the page is shown or exported, in
+ * the same form as `c1`, `c2`, `c3` and `c4` in crazy.c
+ * 
+ * @param   page     The pathname of the page
+ * @param   corners  Output parameter for the orientation, 1, 2, 3, 4 if the
+ *                   page does not have an orientation
+ * @return           Zero on success, -1 on error, `errno` is set to `EINVAL`
+ *                   if the orientation file is malformed
+ */
+int orientation_read(const char* page, int corners[4]);
+
+/**
+ * Set the orientation of a page
+ * 
+ * The page itself is not modified, and the orientation
+ * file is replaced atomically, or removed if the
+ * orientation is 1, 2, 3, 4
+ * 
+ * @param   page     The pathname of the page
+ * @param   corners  The orientation
+ * @return           Zero on success, -1 on error
+ */
+int orientation_write(const char* page, const int corners[4]);
+
+/**
+ * Combine two orientations
+ * 
+ * @param  corners    The orientation to update
+ * @param  transform  The orientation to apply after `corners`
+ */
+void orientation_compose(int corners[4], const int transform[4]);
+
+/**
+ * Check whether an orientation leaves pages unchanged
+ * 
+ * @param   corners  The orientation
+ * @return           1 if the orientation is 1, 2, 3, 4, otherwise 0
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+int orientation_is_identity(const int corners[4]);
+
+
+#endif
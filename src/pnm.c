@@ -0,0 +1,235 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pnm.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* Expansion of each byte of packed lineart into 8 greyscale pixels. */
+#define P(N, BIT)  (((N) & (BIT)) ? 0 : 255)
+#define E(N)       { P(N, 128), P(N, 64), P(N, 32), P(N, 16), P(N, 8), P(N, 4), P(N, 2), P(N, 1) }
+#define R4(N)      E(N), E(N + 1), E(N + 2), E(N + 3)
+#define R16(N)     R4(N), R4(N + 4), R4(N + 8), R4(N + 12)
+#define R64(N)     R16(N), R16(N + 16), R16(N + 32), R16(N + 48)
+
+/**
+ * The 8 greyscale pixels, 0 for black and 255 for white,
+ * of each byte of packed lineart
+ */
+static const unsigned char lineart_table[256][8] = { R64(0), R64(64), R64(128), R64(192) };
+
+#undef R64
+#undef R16
+#undef R4
+#undef E
+#undef P
+
+
+
+/**
+ * Initialise the state for the PNM header-parsing
+ * 
+ * @param  state    The major state of the parser, 10 when done
+ * @param  comment  Whether the parser is in a comment section
+ * @param  type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param  maxval   The maximum value on a subpixel
+ * @param  width    The width of the image, in pixels
+ * @param  height   The height of the image, in pixels
+ */
+void pnm_init_parse_header(int* restrict state, int* restrict comment, int* restrict type,
+			   unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height)
+{
+  *state = *comment = *type = 0;
+  *maxval = 0;
+  *width = *height = 0;
+}
+
+
+/**
+ * Parse the header of a PNM file
+ * 
+ * @param   state    The major state of the parser, 10 when done
+ * @param   comment  Whether the parser is in a comment section
+ * @param   type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param   maxval   The maximum value on a subpixel
+ * @param   width    The width of the image, in pixels
+ * @param   height   The height of the image, in pixels
+ * @param   size     The bytes ready to be read from `image`
+ * @param   image    The image
+ * @return           The number of bytes read from `image`
+ */
+size_t pnm_parse_header(int* restrict state, int* restrict comment, int* restrict type,
+			unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height,
+			size_t size, const char* image)
+{
+#define X(S)  ((*state == S) || (*state == S + 1)) && ('0' <= c) && (c <= '9')
+  
+  size_t i;
+  char c;
+  
+  for (i = 0; i < size; i++)
+    if (c = image[i], *state == 9)
+      {
+	if (c == '\n')
+	  return *state = 10, i + 1;
+      }
+    else if (*comment)                     *comment = c != '\n';
+    else if (c == '#')                     *comment = 1;
+    else if ((*state == 0) && (c == 'P'))  ++*state;
+    else if (X(1))                         *state = 2, *type   = *type   * 10 + (c & 15);
+    else if (X(3))                         *state = 4, *width  = *width  * 10 + (c & 15);
+    else if (X(5))                         *state = 6, *height = *height * 10 + (c & 15);
+    else if (X(7))                         *state = 8, *maxval = *maxval * 10 + (c & 15);
+    else if ((*state % 2) == 0)
+      {
+	++*state;
+	if ((*state == 7) && (*type == 4))  *state = 9, *maxval = 1;
+	if ((*state == 9) && (c == '\n'))   return *state = 10, i + 1;
+      }
+  
+  return i;
+  
+#undef X
+}
+
+
+/**
+ * Get the number of bytes in a row of a PNM image
+ * 
+ * @param   type    The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param   maxval  The maximum value on a subpixel
+ * @param   width   The width of the image, in pixels
+ * @return          The size of a row
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+size_t pnm_row_size(int type, unsigned int maxval, size_t width)
+{
+  if (type == 4)
+    return (width + 7) / 8;
+  return width * (maxval < 0x100 ? 1 : 2) * (type == 6 ? 3 : 1);
+}
+
+
+/**
+ * Get the number of bytes in the payload of a PNM image
+ * 
+ * @param   type    The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param   maxval  The maximum value on a subpixel
+ * @param   width   The width of the image, in pixels
+ * @param   height  The height of the image, in pixels
+ * @return          The size of the payload
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+size_t pnm_payload_size(int type, unsigned int maxval, size_t width, size_t height)
+{
+  return pnm_row_size(type, maxval, width) * height;
+}
+
+
+/**
+ * Create the lookup table for converting subpixels to 8 bits,
+ * this should be done once the header has been parsed
+ * 
+ * @param   levels  Output parameter for the lookup table
+ * @param   maxval  The maximum value on a subpixel
+ * @return          Zero on success, -1 on error
+ */
+int pnm_levels_init(pnm_levels_t* restrict levels, unsigned int maxval)
+{
+  size_t i, n = maxval < 0x100 ? 0x100 : 0x10000;
+  uint32_t value;
+  
+  levels->maxval = maxval;
+  levels->table = NULL;
+  if ((maxval == 255) || (maxval == 0))
+    return 0;
+  
+  levels->table = malloc(n);
+  if (levels->table == NULL)
+    return -1;
+  
+  /* Out of range values saturate. */
+  for (i = 0; i < n; i++)
+    {
+      value = (uint32_t)i > maxval ? maxval : (uint32_t)i;
+      levels->table[i] = (unsigned char)((255 * value + maxval / 2) / maxval);
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Release the resources of a lookup table for converting subpixels to 8 bits
+ * 
+ * @param  levels  The lookup table
+ */
+void pnm_levels_destroy(pnm_levels_t* restrict levels)
+{
+  free(levels->table);
+  levels->table = NULL;
+}
+
+
+/**
+ * Convert a row of subpixels to 8 bits per subpixel
+ * 
+ * @param  levels  The lookup table, must not be for `maxval == 255`
+ * @param  dest    The output row
+ * @param  src     The input row
+ * @param  n       The number of subpixels in the row
+ */
+void pnm_levels_convert(const pnm_levels_t* restrict levels, unsigned char* restrict dest,
+			const unsigned char* restrict src, size_t n)
+{
+  const unsigned char* table = levels->table;
+  size_t i;
+  
+  if (levels->maxval < 0x100)
+    for (i = 0; i < n; i++)
+      dest[i] = table[src[i]];
+  else
+    for (i = 0; i < n; i++, src += 2)
+      dest[i] = table[(size_t)src[0] << 8 | (size_t)src[1]];
+}
+
+
+/**
+ * Expand a row of packed lineart into greyscale
+ * 
+ * @param  dest   The output row, 8 bits per pixel, 0 for black and 255 for white
+ * @param  src    The input row, most significant bit first, 1 for black
+ * @param  width  The number of pixels in the row
+ */
+void pnm_unpack_lineart(unsigned char* restrict dest, const unsigned char* restrict src, size_t width)
+{
+  size_t i, n = width / 8;
+  
+  for (i = 0; i < n; i++, dest += 8)
+    memcpy(dest, lineart_table[src[i]], 8);
+  if (width & 7)
+    memcpy(dest, lineart_table[src[i]], width & 7);
+}
+
@@ -0,0 +1,142 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_PNM_H
+#define CRAZY_PNM_H
+
+
+#include <stddef.h>
+
+
+
+/**
+ * Lookup table for converting subpixels to 8 bits
+ */
+typedef struct pnm_levels
+{
+  /**
+   * The maximum value a subpixel can have
+   */
+  unsigned int maxval;
+  
+  /**
+   * The 8-bit value of each subpixel value, `NULL` if `maxval == 255`
+   */
+  unsigned char* table;
+  
+} pnm_levels_t;
+
+
+
+/**
+ * Initialise the state for the PNM header-parsing
+ * 
+ * @param  state    The major state of the parser, 10 when done
+ * @param  comment  Whether the parser is in a comment section
+ * @param  type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param  maxval   The maximum value on a subpixel
+ * @param  width    The width of the image, in pixels
+ * @param  height   The height of the image, in pixels
+ */
+void pnm_init_parse_header(int* restrict state, int* restrict comment, int* restrict type,
+			   unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height);
+
+
+/**
+ * Parse the header of a PNM file
+ * 
+ * @param   state    The major state of the parser, 10 when done
+ * @param   comment  Whether the parser is in a comment section
+ * @param   type     The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param   maxval   The maximum value on a subpixel
+ * @param   width    The width of the image, in pixels
+ * @param   height   The height of the image, in pixels
+ * @param   size     The bytes ready to be read from `image`
+ * @param   image    The image
+ * @return           The number of bytes read from `image`
+ */
+size_t pnm_parse_header(int* restrict state, int* restrict comment, int* restrict type,
+			unsigned int* restrict maxval, size_t* restrict width, size_t* restrict height,
+			size_t size, const char* image);
+
+
+/**
+ * Get the number of bytes in the payload of a PNM image
+ * 
+ * @param   type    The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param   maxval  The maximum value on a subpixel
+ * @param   width   The width of the image, in pixels
+ * @param   height  The height of the image, in pixels
+ * @return          The size of the payload
+ */
+size_t pnm_payload_size(int type, unsigned int maxval, size_t width, size_t height);
+
+
+/**
+ * Get the number of bytes in a row of a PNM image
+ * 
+ * @param   type    The PNM type: 4 for raw lineart, 5 for raw greyscale 6 for raw RGB
+ * @param   maxval  The maximum value on a subpixel
+ * @param   width   The width of the image, in pixels
+ * @return          The size of a row
+ */
+size_t pnm_row_size(int type, unsigned int maxval, size_t width);
+
+
+/**
+ * Create the lookup table for converting subpixels to 8 bits,
+ * this should be done once the header has been parsed
+ * 
+ * @param   levels  Output parameter for the lookup table
+ * @param   maxval  The maximum value on a subpixel
+ * @return          Zero on success, -1 on error
+ */
+int pnm_levels_init(pnm_levels_t* restrict levels, unsigned int maxval);
+
+
+/**
+ * Release the resources of a lookup table for converting subpixels to 8 bits
+ * 
+ * @param  levels  The lookup table
+ */
+void pnm_levels_destroy(pnm_levels_t* restrict levels);
+
+
+/**
+ * Convert a row of subpixels to 8 bits per subpixel
+ * 
+ * @param  levels  The lookup table, must not be for `maxval == 255`
+ * @param  dest    The output row
+ * @param  src     The input row
+ * @param  n       The number of subpixels in the row
+ */
+void pnm_levels_convert(const pnm_levels_t* restrict levels, unsigned char* restrict dest,
+			const unsigned char* restrict src, size_t n);
+
+
+/**
+ * Expand a row of packed lineart into greyscale
+ * 
+ * @param  dest   The output row, 8 bits per pixel, 0 for black and 255 for white
+ * @param  src    The input row, most significant bit first, 1 for black
+ * @param  width  The number of pixels in the row
+ */
+void pnm_unpack_lineart(unsigned char* restrict dest, const unsigned char* restrict src, size_t width);
+
+
+#endif
+
@@ -0,0 +1,732 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "resize_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "crazy.h"
+#include "util.h"
+
+
+/**
+ * The number of buckets in the hash table, must be a power of two
+ */
+#define BUCKETS  256
+
+
+
+/**
+ * A resized image held in memory
+ */
+struct entry
+{
+  /**
+   * The key of the image, `key.filter` points into
+   * the same allocation as the entry
+   */
+  resize_cache_key_t key;
+  
+  /**
+   * The hash of `key`
+   */
+  size_t hash;
+  
+  /**
+   * The resized image
+   */
+  char* image;
+  
+  /**
+   * The number of bytes stored in `image`
+   */
+  size_t size;
+  
+  /**
+   * The number of bytes this entry accounts for
+   */
+  size_t cost;
+  
+  /**
+   * The next entry in the same bucket
+   */
+  struct entry* chain;
+  
+  /**
+   * The entry that was used more recently
+   */
+  struct entry* newer;
+  
+  /**
+   * The entry that was used less recently
+   */
+  struct entry* older;
+};
+
+
+
+/**
+ * Hash table of all entries held in memory
+ */
+static struct entry* buckets[BUCKETS];
+
+/**
+ * The most recently used entry
+ */
+static struct entry* newest = NULL;
+
+/**
+ * The least recently used entry
+ */
+static struct entry* oldest = NULL;
+
+/**
+ * Whether evicted images should be stored on disk
+ */
+static int spill_enabled = 0;
+
+/**
+ * The directory evicted images are stored in, `NULL` if not yet created
+ */
+static char* spill_dir = NULL;
+
+/**
+ * The number of bytes stored in `spill_dir`, as of the last time it
+ * was scanned plus what has been stored since, updated when `spill_dir`
+ * is created
+ */
+static size_t spill_used = 0;
+
+/**
+ * Protects `spill_dir` and `spill_used`, which are used from thumbnail workers
+ */
+static pthread_mutex_t spill_dir_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Cache statistics, also holds the memory limit and usage
+ */
+static resize_cache_stats_t cache_stats = { .memory_limit = RESIZE_CACHE_DEFAULT_LIMIT };
+
+
+
+/**
+ * Hash the key of a resized image
+ * 
+ * @param   key  The key
+ * @return       The hash of the key
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static size_t hash_key(const resize_cache_key_t* restrict key)
+{
+#define H(V)  (h = (h ^ (uint64_t)(V)) * 0x100000001B3ULL)
+  
+  uint64_t h = 0xCBF29CE484222325ULL;
+  const char* p;
+  
+  H(key->device), H(key->inode), H(key->size);
+  H(key->mtime.tv_sec), H(key->mtime.tv_nsec);
+  H(key->width), H(key->height);
+  for (p = key->filter; *p; p++)
+    H((unsigned char)*p);
+  
+  return (size_t)h;
+  
+#undef H
+}
+
+
+/**
+ * Check whether two keys are equal
+ * 
+ * @param   a  One of the keys
+ * @param   b  The other key
+ * @return     Whether the keys are equal
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static int key_equal(const resize_cache_key_t* restrict a, const resize_cache_key_t* restrict b)
+{
+  return (a->device        == b->device)        &&
+	 (a->inode         == b->inode)         &&
+	 (a->size          == b->size)          &&
+	 (a->mtime.tv_sec  == b->mtime.tv_sec)  &&
+	 (a->mtime.tv_nsec == b->mtime.tv_nsec) &&
+	 (a->width         == b->width)         &&
+	 (a->height        == b->height)        &&
+	 !strcmp(a->filter, b->filter);
+}
+
+
+/**
+ * Create a directory and its parents, do nothing if it already exists
+ * 
+ * @param   dir  The directory, will be edited but restored
+ * @return       Zero on success, -1 on error
+ */
+static int make_directories(char* dir)
+{
+  char* p = dir;
+  
+  while ((p = strchr(p + 1, '/')))
+    {
+      *p = '\0';
+      if (mkdir(dir, 0700) && (errno != EEXIST))
+	return *p = '/', -1;
+      *p = '/';
+    }
+  if (mkdir(dir, 0700) && (errno != EEXIST))
+    return -1;
+  
+  return 0;
+}
+
+
+/**
+ * A file in the directory evicted images are stored in
+ */
+struct spill_file
+{
+  /**
+   * The last time the file was used
+   */
+  struct timespec used;
+  
+  /**
+   * The size of the file, in bytes
+   */
+  size_t size;
+  
+  /**
+   * The name of the file
+   */
+  char* name;
+};
+
+
+/**
+ * Compare two files by when they were last used, for `qsort`
+ * 
+ * @param   a  One of the files
+ * @param   b  The other file
+ * @return     Negative if `a` was used before `b`, positive if after, otherwise zero
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static int compare_spill_files(const void* a, const void* b)
+{
+  const struct timespec* x = &(((const struct spill_file*)a)->used);
+  const struct timespec* y = &(((const struct spill_file*)b)->used);
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+
+/**
+ * Measure the directory evicted images are stored in, and if it holds
+ * more than `RESIZE_CACHE_DISK_LIMIT` bytes, remove the least recently
+ * used images until it holds at most three quarters of that, so that it
+ * is not scanned again every time an image is stored
+ * 
+ * `spill_dir_mutex` must be held, errors are ignored
+ */
+static void spill_prune(void)
+{
+  struct spill_file* files = NULL;
+  struct spill_file* new;
+  size_t i, n = 0, size = 0;
+  struct dirent* f;
+  struct stat attr;
+  DIR* dir;
+  int dfd;
+  
+  if (dir = opendir(spill_dir), dir == NULL)
+    return;
+  dfd = dirfd(dir);
+  
+  spill_used = 0;
+  while ((f = readdir(dir)))
+    {
+      if (*(f->d_name) == '.')
+	continue;
+      if (fstatat(dfd, f->d_name, &attr, AT_SYMLINK_NOFOLLOW) || !S_ISREG(attr.st_mode))
+	continue;
+      spill_used += (size_t)(attr.st_size);
+      if (n == size)
+	{
+	  t (new = realloc(files, (size = size ? size << 1 : 64) * sizeof(*files)), new == NULL);
+	  files = new;
+	}
+      t (files[n].name = strdup(f->d_name), files[n].name == NULL);
+      files[n].used = attr.st_mtim;
+      files[n++].size = (size_t)(attr.st_size);
+    }
+  
+  if (spill_used > RESIZE_CACHE_DISK_LIMIT)
+    {
+      qsort(files, n, sizeof(*files), compare_spill_files);
+      for (i = 0; (i < n) && (spill_used > RESIZE_CACHE_DISK_LIMIT / 4 * 3); i++)
+	if (!unlinkat(dfd, files[i].name, 0))
+	  spill_used -= files[i].size;
+    }
+  
+ fail:
+  while (n)
+    free(files[--n].name);
+  free(files);
+  closedir(dir);
+}
+
+
+/**
+ * Get the pathname a resized image is stored at on disk,
+ * creating the cache directory if necessary
+ * 
+ * @param   key  The key of the resized image
+ * @return       The pathname, `NULL` on error
+ */
+static char* spill_path(const resize_cache_key_t* restrict key)
+{
+  const char* base;
+  char* path = NULL;
+  
+  pthread_mutex_lock(&spill_dir_mutex);
+  if (spill_dir == NULL)
+    {
+      if ((base = getenv("XDG_CACHE_HOME")) && *base)
+	aprintf(&spill_dir, "%s/crazy/resize", base);
+      else if ((base = getenv("HOME")) && *base)
+	aprintf(&spill_dir, "%s/.cache/crazy/resize", base);
+      else
+	errno = ENOENT;
+      if ((spill_dir != NULL) && make_directories(spill_dir))
+	free(spill_dir), spill_dir = NULL;
+      if (spill_dir != NULL)
+	spill_prune();
+    }
+  
+  if (spill_dir != NULL)
+    aprintf(&path, "%s/%jx-%jx-%jd.%09li-%jd-%zux%zu-%s.pnm", spill_dir,
+	    (uintmax_t)(key->device), (uintmax_t)(key->inode), (intmax_t)(key->mtime.tv_sec),
+	    (long int)(key->mtime.tv_nsec), (intmax_t)(key->size), key->width, key->height, key->filter);
+  pthread_mutex_unlock(&spill_dir_mutex);
+  return path;
+}
+
+
+/**
+ * Store a resized image on disk, errors are ignored as
+ * the image is merely dropped from the cache in that case
+ * 
+ * @param  key    The key of the resized image
+ * @param  image  The resized image
+ * @param  size   The number of bytes stored in `image`
+ */
+static void spill_store(const resize_cache_key_t* restrict key, const char* image, size_t size)
+{
+  char* path = NULL;
+  char* temp = NULL;
+  ssize_t wrote;
+  size_t ptr = 0;
+  int fd = -1;
+  
+  t (path = spill_path(key), path == NULL);
+  aprintf(&temp, "%s.XXXXXX", path);
+  t (temp == NULL);
+  t (fd = mkstemp(temp), fd < 0);
+  
+  while (ptr < size)
+    {
+      wrote = write(fd, image + ptr, size - ptr);
+      if (wrote < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      ptr += (size_t)wrote;
+    }
+  
+  t (close(fd));
+  fd = -1;
+  t (rename(temp, path));
+  
+  pthread_mutex_lock(&spill_dir_mutex);
+  if ((spill_used += size) > RESIZE_CACHE_DISK_LIMIT)
+    spill_prune();
+  pthread_mutex_unlock(&spill_dir_mutex);
+  
+  free(path);
+  free(temp);
+  return;
+ fail:
+  if (fd >= 0)
+    close(fd);
+  if (temp != NULL)
+    unlink(temp);
+  free(path);
+  free(temp);
+}
+
+
+/**
+ * Load a resized image from disk
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       Output parameter for the resized image
+ * @param   scaled_size  Output parameter for the number of bytes stored in `scaled`
+ * @return               1 if found, 0 if not found, -1 on error
+ */
+static int spill_load(const resize_cache_key_t* restrict key, char** restrict scaled,
+		      size_t* restrict scaled_size)
+{
+  char* path;
+  struct stat attr;
+  ssize_t got;
+  size_t ptr = 0;
+  int fd = -1, saved_errno;
+  
+  *scaled = NULL;
+  
+  t (path = spill_path(key), path == NULL);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if ((fd < 0) && (errno == ENOENT))
+    return 0;
+  t (fd < 0);
+  t (fstat(fd, &attr));
+  
+  /* Mark the image as recently used, so it is not the first to be removed. */
+  futimens(fd, NULL);
+  
+  *scaled_size = (size_t)(attr.st_size);
+  t (*scaled = malloc(*scaled_size + !*scaled_size), *scaled == NULL);
+  while (ptr < *scaled_size)
+    {
+      got = read(fd, *scaled + ptr, *scaled_size - ptr);
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      t (got == 0 ? (errno = EIO) : 0);
+      ptr += (size_t)got;
+    }
+  
+  close(fd);
+  return 1;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  free(*scaled), *scaled = NULL;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Remove an entry from the least-recently-used list
+ * 
+ * @param  e  The entry
+ */
+static void lru_unlink(struct entry* restrict e)
+{
+  if (e->newer)  e->newer->older = e->older;
+  else           newest = e->older;
+  if (e->older)  e->older->newer = e->newer;
+  else           oldest = e->newer;
+  e->newer = e->older = NULL;
+}
+
+
+/**
+ * Mark an entry as the most recently used
+ * 
+ * @param  e  The entry, must not be in the least-recently-used list
+ */
+static void lru_push(struct entry* restrict e)
+{
+  e->older = newest;
+  e->newer = NULL;
+  if (newest)
+    newest->newer = e;
+  newest = e;
+  if (oldest == NULL)
+    oldest = e;
+}
+
+
+/**
+ * Remove an entry from memory, and store it on disk if configured
+ * 
+ * @param  e       The entry
+ * @param  evict   Whether the entry is evicted rather than discarded
+ */
+static void drop_entry(struct entry* restrict e, int evict)
+{
+  struct entry** p;
+  
+  for (p = buckets + (e->hash & (BUCKETS - 1)); *p != e; p = &((*p)->chain));
+  *p = e->chain;
+  lru_unlink(e);
+  
+  if (evict)
+    {
+      cache_stats.evictions++;
+      if (spill_enabled)
+	spill_store(&(e->key), e->image, e->size);
+    }
+  
+  cache_stats.memory_used -= e->cost;
+  cache_stats.entries--;
+  free(e->image);
+  free(e);
+}
+
+
+/**
+ * Find an entry held in memory
+ * 
+ * @param   key   The key of the entry
+ * @param   hash  The hash of `key`
+ * @return        The entry, `NULL` if not held in memory
+ */
+#ifdef __GNUC__
+__attribute__((pure))
+#endif
+static struct entry* find_entry(const resize_cache_key_t* restrict key, size_t hash)
+{
+  struct entry* e;
+  
+  for (e = buckets[hash & (BUCKETS - 1)]; e; e = e->chain)
+    if ((e->hash == hash) && key_equal(&(e->key), key))
+      return e;
+  
+  return NULL;
+}
+
+
+/**
+ * Configure the resize cache
+ * 
+ * @param   memory_limit  The maximum number of bytes to hold in memory, 0 to hold nothing in memory
+ * @param   spill         Whether images evicted from memory should be stored on disk,
+ *                        under $XDG_CACHE_HOME/crazy/resize, at most
+ *                        `RESIZE_CACHE_DISK_LIMIT` bytes are stored there
+ * @return                Zero on success, -1 on error
+ */
+int resize_cache_configure(size_t memory_limit, int spill)
+{
+  cache_stats.memory_limit = memory_limit;
+  spill_enabled = spill;
+  while (oldest && (cache_stats.memory_used > cache_stats.memory_limit))
+    drop_entry(oldest, 1);
+  return 0;
+}
+
+
+/**
+ * Create the key for a resized image
+ * 
+ * @param  key     Output parameter for the key
+ * @param  attr    The attributes of the original image's file
+ * @param  width   The width the image is resized to
+ * @param  height  The height the image is resized to
+ * @param  filter  The name of the filter used when resizing, must not be freed
+ *                 as long as the key is used
+ */
+void resize_cache_key(resize_cache_key_t* restrict key, const struct stat* restrict attr,
+		      size_t width, size_t height, const char* filter)
+{
+  key->device = attr->st_dev;
+  key->inode  = attr->st_ino;
+  key->mtime  = attr->st_mtim;
+  key->size   = attr->st_size;
+  key->width  = width;
+  key->height = height;
+  key->filter = filter;
+}
+
+
+/**
+ * Look up a resized image in the cache
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       Output parameter for a copy of the resized image
+ * @param   scaled_size  Output parameter for the number of bytes stored in `scaled`
+ * @return               1 if found, 0 if not found, -1 on error
+ */
+int resize_cache_lookup(const resize_cache_key_t* restrict key, char** restrict scaled,
+			size_t* restrict scaled_size)
+{
+  size_t hash = hash_key(key);
+  struct entry* e;
+  int r;
+  
+  *scaled = NULL;
+  *scaled_size = 0;
+  
+  if (e = find_entry(key, hash), e != NULL)
+    {
+      *scaled = malloc(e->size + !e->size);
+      if (*scaled == NULL)
+	return -1;
+      memcpy(*scaled, e->image, e->size);
+      *scaled_size = e->size;
+      lru_unlink(e);
+      lru_push(e);
+      cache_stats.memory_hits++;
+      return 1;
+    }
+  
+  if (spill_enabled)
+    {
+      r = spill_load(key, scaled, scaled_size);
+      if (r < 0)
+	return -1;
+      if (r > 0)
+	{
+	  cache_stats.disk_hits++;
+	  if (resize_cache_insert(key, *scaled, *scaled_size))
+	    return free(*scaled), *scaled = NULL, *scaled_size = 0, -1;
+	  return 1;
+	}
+    }
+  
+  cache_stats.misses++;
+  return 0;
+}
+
+
+/**
+ * Store a resized image in the cache
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       The resized image, will be copied
+ * @param   scaled_size  The number of bytes stored in `scaled`
+ * @return               Zero on success, -1 on error
+ */
+int resize_cache_insert(const resize_cache_key_t* restrict key, const char* scaled, size_t scaled_size)
+{
+  size_t hash = hash_key(key);
+  size_t filter_len = strlen(key->filter) + 1;
+  size_t cost = sizeof(struct entry) + filter_len + scaled_size;
+  struct entry* e;
+  
+  if ((e = find_entry(key, hash)))
+    drop_entry(e, 0);
+  
+  /* Too large to hold in memory, store it directly on disk if configured. */
+  if (cost > cache_stats.memory_limit)
+    {
+      if (spill_enabled)
+	spill_store(key, scaled, scaled_size);
+      return 0;
+    }
+  
+  while (cache_stats.memory_used + cost > cache_stats.memory_limit)
+    drop_entry(oldest, 1);
+  
+  e = malloc(sizeof(struct entry) + filter_len);
+  if (e == NULL)
+    return -1;
+  e->image = malloc(scaled_size + !scaled_size);
+  if (e->image == NULL)
+    return free(e), -1;
+  memcpy(e->image, scaled, scaled_size);
+  
+  e->key = *key;
+  e->key.filter = memcpy((char*)e + sizeof(struct entry), key->filter, filter_len);
+  e->hash = hash;
+  e->size = scaled_size;
+  e->cost = cost;
+  e->chain = buckets[hash & (BUCKETS - 1)];
+  buckets[hash & (BUCKETS - 1)] = e;
+  lru_push(e);
+  
+  cache_stats.memory_used += cost;
+  cache_stats.entries++;
+  return 0;
+}
+
+
+/**
+ * Look up a resized image on disk only, unlike `resize_cache_lookup`
+ * this may be used from any thread and does not update the statistics
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       Output parameter for the resized image
+ * @param   scaled_size  Output parameter for the number of bytes stored in `scaled`
+ * @return               1 if found, 0 if not found, -1 on error
+ */
+int resize_cache_load_file(const resize_cache_key_t* restrict key, char** restrict scaled,
+			   size_t* restrict scaled_size)
+{
+  return spill_load(key, scaled, scaled_size);
+}
+
+
+/**
+ * Store a resized image on disk only, unlike `resize_cache_insert`
+ * this may be used from any thread, errors are ignored
+ * 
+ * @param  key          The key of the resized image
+ * @param  scaled       The resized image
+ * @param  scaled_size  The number of bytes stored in `scaled`
+ */
+void resize_cache_store_file(const resize_cache_key_t* restrict key, const char* scaled, size_t scaled_size)
+{
+  spill_store(key, scaled, scaled_size);
+}
+
+
+/**
+ * Get resize cache statistics
+ * 
+ * @param  stats  Output parameter for the statistics
+ */
+void resize_cache_get_stats(resize_cache_stats_t* restrict stats)
+{
+  *stats = cache_stats;
+}
+
+
+/**
+ * Release all images held in memory by the resize cache,
+ * images stored on disk are kept
+ */
+void resize_cache_terminate(void)
+{
+  while (oldest)
+    drop_entry(oldest, 0);
+  free(spill_dir), spill_dir = NULL;
+}
+
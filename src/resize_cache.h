@@ -0,0 +1,215 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_RESIZE_CACHE_H
+#define CRAZY_RESIZE_CACHE_H
+
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * The default memory limit for the resize cache, in bytes
+ */
+#ifndef RESIZE_CACHE_DEFAULT_LIMIT
+# define RESIZE_CACHE_DEFAULT_LIMIT  (64UL << 20)
+#endif
+
+/**
+ * The maximum number of bytes stored on disk by the resize cache,
+ * when exceeded, the least recently used images are removed
+ */
+#ifndef RESIZE_CACHE_DISK_LIMIT
+# define RESIZE_CACHE_DISK_LIMIT  (512UL << 20)
+#endif
+
+
+
+/**
+ * Identity of a resized image
+ */
+typedef struct resize_cache_key
+{
+  /**
+   * The device the original image is stored on
+   */
+  dev_t device;
+  
+  /**
+   * The inode of the original image
+   */
+  ino_t inode;
+  
+  /**
+   * The last modification time of the original image
+   */
+  struct timespec mtime;
+  
+  /**
+   * The size of the original image, in bytes
+   */
+  off_t size;
+  
+  /**
+   * The width the image was resized to
+   */
+  size_t width;
+  
+  /**
+   * The height the image was resized to
+   */
+  size_t height;
+  
+  /**
+   * The name of the filter used when resizing
+   */
+  const char* filter;
+  
+} resize_cache_key_t;
+
+
+/**
+ * Resize cache statistics
+ */
+typedef struct resize_cache_stats
+{
+  /**
+   * The number of lookups that found the image in memory
+   */
+  size_t memory_hits;
+  
+  /**
+   * The number of lookups that found the image on disk
+   */
+  size_t disk_hits;
+  
+  /**
+   * The number of lookups that did not find the image
+   */
+  size_t misses;
+  
+  /**
+   * The number of images evicted from memory
+   */
+  size_t evictions;
+  
+  /**
+   * The number of images currently held in memory
+   */
+  size_t entries;
+  
+  /**
+   * The number of bytes currently held in memory
+   */
+  size_t memory_used;
+  
+  /**
+   * The maximum number of bytes that may be held in memory
+   */
+  size_t memory_limit;
+  
+} resize_cache_stats_t;
+
+
+
+/**
+ * Configure the resize cache
+ * 
+ * @param   memory_limit  The maximum number of bytes to hold in memory, 0 to hold nothing in memory
+ * @param   spill         Whether images evicted from memory should be stored on disk,
+ *                        under $XDG_CACHE_HOME/crazy/resize, at most
+ *                        `RESIZE_CACHE_DISK_LIMIT` bytes are stored there
+ * @return                Zero on success, -1 on error
+ */
+int resize_cache_configure(size_t memory_limit, int spill);
+
+/**
+ * Create the key for a resized image
+ * 
+ * @param  key     Output parameter for the key
+ * @param  attr    The attributes of the original image's file
+ * @param  width   The width the image is resized to
+ * @param  height  The height the image is resized to
+ * @param  filter  The name of the filter used when resizing, must not be freed
+ *                 as long as the key is used
+ */
+void resize_cache_key(resize_cache_key_t* restrict key, const struct stat* restrict attr,
+		      size_t width, size_t height, const char* filter);
+
+/**
+ * Look up a resized image in the cache
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       Output parameter for a copy of the resized image
+ * @param   scaled_size  Output parameter for the number of bytes stored in `scaled`
+ * @return               1 if found, 0 if not found, -1 on error
+ */
+int resize_cache_lookup(const resize_cache_key_t* restrict key, char** restrict scaled,
+			size_t* restrict scaled_size);
+
+/**
+ * Store a resized image in the cache
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       The resized image, will be copied
+ * @param   scaled_size  The number of bytes stored in `scaled`
+ * @return               Zero on success, -1 on error
+ */
+int resize_cache_insert(const resize_cache_key_t* restrict key, const char* scaled, size_t scaled_size);
+
+/**
+ * Look up a resized image on disk only, unlike `resize_cache_lookup`
+ * this may be used from any thread and does not update the statistics
+ * 
+ * @param   key          The key of the resized image
+ * @param   scaled       Output parameter for the resized image
+ * @param   scaled_size  Output parameter for the number of bytes stored in `scaled`
+ * @return               1 if found, 0 if not found, -1 on error
+ */
+int resize_cache_load_file(const resize_cache_key_t* restrict key, char** restrict scaled,
+			   size_t* restrict scaled_size);
+
+/**
+ * Store a resized image on disk only, unlike `resize_cache_insert`
+ * this may be used from any thread, errors are ignored
+ * 
+ * @param  key          The key of the resized image
+ * @param  scaled       The resized image
+ * @param  scaled_size  The number of bytes stored in `scaled`
+ */
+void resize_cache_store_file(const resize_cache_key_t* restrict key, const char* scaled, size_t scaled_size);
+
+/**
+ * Get resize cache statistics
+ * 
+ * @param  stats  Output parameter for the statistics
+ */
+void resize_cache_get_stats(resize_cache_stats_t* restrict stats);
+
+/**
+ * Release all images held in memory by the resize cache,
+ * images stored on disk are kept
+ */
+void resize_cache_terminate(void);
+
+
+#endif
+
@@ -0,0 +1,149 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ring.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+
+
+/**
+ * Initialise a ring
+ * 
+ * @param   ring       The ring
+ * @param   slots      The number of slots, will be rounded up to a power of two
+ * @param   slot_size  The number of bytes per slot
+ * @return             Zero on success, -1 on error
+ */
+int ring_initialise(ring_t* restrict ring, size_t slots, size_t slot_size)
+{
+  /* Keep the slots aligned, so that they can begin with any structure. */
+  slot_size = (slot_size + 15) & ~(size_t)15;
+  
+  for (ring->slots = 1; ring->slots < slots; ring->slots <<= 1);
+  ring->slot_size = slot_size;
+  ring->head = ring->tail = 0;
+  ring->closed = 0;
+  ring->buffer = malloc(ring->slots * slot_size);
+  if (ring->buffer == NULL)
+    return -1;
+  if (sem_init(&(ring->posted), 0, 0))
+    {
+      free(ring->buffer), ring->buffer = NULL;
+      return -1;
+    }
+  return 0;
+}
+
+
+/**
+ * Release the resources of a ring
+ * 
+ * @param  ring  The ring
+ */
+void ring_destroy(ring_t* restrict ring)
+{
+  if (ring->buffer == NULL)
+    return;
+  sem_destroy(&(ring->posted));
+  free(ring->buffer), ring->buffer = NULL;
+}
+
+
+/**
+ * Get the next free slot, for the producer
+ * 
+ * @param   ring  The ring
+ * @return        The slot, `NULL` if the ring is full
+ */
+void* ring_push_begin(ring_t* restrict ring)
+{
+  size_t tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE);
+  if (ring->head - tail == ring->slots)
+    return NULL;
+  return ring->buffer + (ring->head & (ring->slots - 1)) * ring->slot_size;
+}
+
+
+/**
+ * Publish the slot returned by `ring_push_begin`, for the producer
+ * 
+ * @param  ring  The ring
+ */
+void ring_push_end(ring_t* restrict ring)
+{
+  __atomic_store_n(&(ring->head), ring->head + 1, __ATOMIC_RELEASE);
+  sem_post(&(ring->posted));
+}
+
+
+/**
+ * Tell the consumer that no more slots will be pushed, for the producer
+ * 
+ * @param  ring  The ring
+ */
+void ring_close(ring_t* restrict ring)
+{
+  __atomic_store_n(&(ring->closed), 1, __ATOMIC_RELEASE);
+  sem_post(&(ring->posted));
+}
+
+
+/**
+ * Get the oldest published slot, for the consumer
+ * 
+ * @param   ring  The ring
+ * @return        The slot, `NULL` if the ring is empty
+ */
+const void* ring_pop_begin(ring_t* restrict ring)
+{
+  size_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+  if (head == ring->tail)
+    return NULL;
+  return ring->buffer + (ring->tail & (ring->slots - 1)) * ring->slot_size;
+}
+
+
+/**
+ * Free the slot returned by `ring_pop_begin`, for the consumer
+ * 
+ * @param  ring  The ring
+ */
+void ring_pop_end(ring_t* restrict ring)
+{
+  __atomic_store_n(&(ring->tail), ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Wait until the ring is non-empty or closed, for the consumer
+ * 
+ * @param   ring  The ring
+ * @return        Zero if a slot may be available, -1 if the ring is closed and empty
+ */
+int ring_wait(ring_t* restrict ring)
+{
+  for (;;)
+    {
+      if (__atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) != ring->tail)
+	return 0;
+      if (__atomic_load_n(&(ring->closed), __ATOMIC_ACQUIRE))
+	return __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) != ring->tail ? 0 : -1;
+      while (sem_wait(&(ring->posted)) && (errno == EINTR));
+    }
+}
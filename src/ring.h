@@ -0,0 +1,142 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_RING_H
+#define CRAZY_RING_H
+
+
+#include <stddef.h>
+#include <semaphore.h>
+
+
+/**
+ * Single-producer, single-consumer ring of fixed-size slots
+ * 
+ * The producer and the consumer do not lock each other out, the
+ * producer never waits, and the consumer only waits when the ring
+ * is empty, all memory is allocated when the ring is initialised
+ */
+typedef struct ring
+{
+  /**
+   * The slots
+   */
+  unsigned char* buffer;
+  
+  /**
+   * The number of bytes per slot
+   */
+  size_t slot_size;
+  
+  /**
+   * The number of slots, a power of two
+   */
+  size_t slots;
+  
+  /**
+   * The number of slots that have been pushed, only written by the producer
+   */
+#ifdef __GNUC__
+  __attribute__((aligned(64)))
+#endif
+  size_t head;
+  
+  /**
+   * The number of slots that have been popped, only written by the consumer
+   */
+#ifdef __GNUC__
+  __attribute__((aligned(64)))
+#endif
+  size_t tail;
+  
+  /**
+   * Whether the producer will not push any more slots
+   */
+  int closed;
+  
+  /**
+   * Posted when a slot is pushed or the ring is closed
+   */
+  sem_t posted;
+  
+} ring_t;
+
+
+/**
+ * Initialise a ring
+ * 
+ * @param   ring       The ring
+ * @param   slots      The number of slots, will be rounded up to a power of two
+ * @param   slot_size  The number of bytes per slot
+ * @return             Zero on success, -1 on error
+ */
+int ring_initialise(ring_t* restrict ring, size_t slots, size_t slot_size);
+
+/**
+ * Release the resources of a ring
+ * 
+ * @param  ring  The ring
+ */
+void ring_destroy(ring_t* restrict ring);
+
+/**
+ * Get the next free slot, for the producer
+ * 
+ * @param   ring  The ring
+ * @return        The slot, `NULL` if the ring is full
+ */
+void* ring_push_begin(ring_t* restrict ring);
+
+/**
+ * Publish the slot returned by `ring_push_begin`, for the producer
+ * 
+ * @param  ring  The ring
+ */
+void ring_push_end(ring_t* restrict ring);
+
+/**
+ * Tell the consumer that no more slots will be pushed, for the producer
+ * 
+ * @param  ring  The ring
+ */
+void ring_close(ring_t* restrict ring);
+
+/**
+ * Get the oldest published slot, for the consumer
+ * 
+ * @param   ring  The ring
+ * @return        The slot, `NULL` if the ring is empty
+ */
+const void* ring_pop_begin(ring_t* restrict ring);
+
+/**
+ * Free the slot returned by `ring_pop_begin`, for the consumer
+ * 
+ * @param  ring  The ring
+ */
+void ring_pop_end(ring_t* restrict ring);
+
+/**
+ * Wait until the ring is non-empty or closed, for the consumer
+ * 
+ * @param   ring  The ring
+ * @return        Zero if a slot may be available, -1 if the ring is closed and empty
+ */
+int ring_wait(ring_t* restrict ring);
+
+
+#endif
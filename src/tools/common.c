@@ -17,8 +17,12 @@
  */
 #define _GNU_SOURCE
 #include "common.h"
+#include "../orientation.h"
 #include <alloca.h>
+#include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -27,6 +31,65 @@
 #include <sys/stat.h>
 #include <sys/sendfile.h>
 
+#include <argparser.h>
+
+
+
+/**
+ * The maximum number of threads `run_jobs` uses
+ */
+#define MAX_JOBS  64
+
+
+
+/**
+ * Jobs being run by `run_jobs`
+ */
+struct job_pool
+{
+  /**
+   * The function that runs a job
+   */
+  job_func_t* job;
+  
+  /**
+   * Passed to `job`
+   */
+  void* data;
+  
+  /**
+   * The number of jobs
+   */
+  size_t count;
+  
+  /**
+   * The index of the next job to start
+   */
+  size_t next;
+  
+  /**
+   * The index of the first job that failed, `count` if none
+   */
+  size_t failed;
+  
+  /**
+   * The error of the job at `failed`
+   */
+  int error;
+  
+  /**
+   * Protects `failed` and `error`
+   */
+  pthread_mutex_t mutex;
+};
+
+
+
+/**
+ * The number of jobs to run at once, 0 for one per CPU
+ */
+static size_t jobs = 0;
+
 
 
 /**
@@ -148,6 +211,37 @@ static char* relpath(const char* file, const char* ref)
 }
 
 
+/**
+ * Give a page the same orientation as another page,
+ * a file that is not a page has no orientation
+ * 
+ * @param   src   The page whose orientation shall be used
+ * @param   dest  The page whose orientation shall be set
+ * @param   move  Whether the orientation shall be removed from `src`
+ * @return        Zero on success, -1 on error
+ */
+static int carry_orientation(const char* src, const char* dest, int move)
+{
+  size_t n = strlen(src), m = strlen(dest);
+  char* src_path;
+  char* dest_path;
+  
+  if ((n < 4) || strcmp(src + n - 4, ".pnm") || (m < 4) || strcmp(dest + m - 4, ".pnm"))
+    return 0;
+  
+  src_path  = alloca((n + sizeof(ORIENTATION_SUFFIX)) * sizeof(char));
+  dest_path = alloca((m + sizeof(ORIENTATION_SUFFIX)) * sizeof(char));
+  stpcpy(stpcpy(src_path,  src),  ORIENTATION_SUFFIX);
+  stpcpy(stpcpy(dest_path, dest), ORIENTATION_SUFFIX);
+  
+  if (unlink(dest_path) && (errno != ENOENT))
+    return -1;
+  if (access(src_path, F_OK))
+    return 0;
+  return move ? movefile(src_path, dest_path) : copyfile(src_path, dest_path);
+}
+
+
 /**
  * Copy a file
  * 
@@ -177,7 +271,7 @@ int copyfile(const char* src, const char* dest)
   
   while (close(fsrc)  && (errno == EINTR));
   while (close(fdest) && (errno == EINTR));
-  return 0;
+  return carry_orientation(src, dest, 0);
  fail:
   saved_errno = errno;
   if (fsrc  >= 0)  while (close(fsrc)  && (errno == EINTR));
@@ -203,6 +297,7 @@ int symlfile(const char* src, const char* dest)
   t (target == NULL);
   
   t (symlink(target, dest));
+  t (carry_orientation(src, dest, 0));
   
   free(target);
   return 0;
@@ -223,7 +318,9 @@ int symlfile(const char* src, const char* dest)
  */
 int linkfile(const char* src, const char* dest)
 {
-  return link(src, dest);
+  if (link(src, dest))
+    return -1;
+  return carry_orientation(src, dest, 0);
 }
 
 
@@ -236,10 +333,12 @@ int linkfile(const char* src, const char* dest)
  */
 int movefile(const char* src, const char* dest)
 {
-  if (!rename(src, dest))   return 0;
+  if (!rename(src, dest))   return carry_orientation(src, dest, 1);
   if (errno != EXDEV)       return -1;
   if (copyfile(src, dest))  return -1;
-  return unlink(src);
+  if (unlink(src))          return -1;
+  /* `copyfile` has copied the orientation, remove the original. */
+  return carry_orientation(src, src, 1);
 }
 
 
@@ -282,3 +381,315 @@ int mkdirs(const char* dir)
   return -1;
 }
 
+
+/**
+ * Read a file into memory
+ * 
+ * @param   file     The file
+ * @param   content  Output parameter for the content of the file,
+ *                   shall be freed by the caller
+ * @param   size     Output parameter for the size of the file
+ * @return           Zero on success, -1 on error
+ */
+int readfile(const char* file, char** content, size_t* size)
+{
+  int fd = -1;
+  int saved_errno;
+  ssize_t got;
+  struct stat attr;
+  
+  *content = NULL;
+  t (fd = open(file, O_RDONLY), fd < 0);
+  t (fstat(fd, &attr));
+  t (!(*content = malloc((size_t)attr.st_size + 1)));
+  
+  for (*size = 0; *size < (size_t)attr.st_size; *size += (size_t)got)
+    {
+      got = read(fd, *content + *size, (size_t)attr.st_size - *size);
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  got = 0;
+	}
+      else if (got == 0)
+	break;
+    }
+  
+  while (close(fd) && (errno == EINTR));
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)  while (close(fd) && (errno == EINTR));
+  free(*content), *content = NULL;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Create or truncate a file and write to it
+ * 
+ * @param   file     The file
+ * @param   content  The new content of the file
+ * @param   size     The size of `content`
+ * @return           Zero on success, -1 on error
+ */
+int writefile(const char* file, const char* content, size_t size)
+{
+  int fd = -1;
+  int saved_errno;
+  ssize_t wrote;
+  
+  t (fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666), fd < 0);
+  
+  while (size)
+    {
+      wrote = write(fd, content, size);
+      if (wrote < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      content += wrote, size -= (size_t)wrote;
+    }
+  
+  if (close(fd) && (errno != EINTR))
+    return -1;
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)  while (close(fd) && (errno == EINTR));
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Add the -j option, that selects how many jobs `run_jobs` runs at once
+ */
+void add_jobs_option(void)
+{
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Waggregate-return"
+# pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+  args_add_option(args_new_argumented(NULL, (char*)"N", 0, (char*)"-j", (char*)"--jobs", NULL),
+		  (char*)"Process N images at once, the default is one per CPU");
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+}
+
+
+/**
+ * Read the -j option, must be called after the
+ * command line has been parsed
+ * 
+ * @return  Zero on success, -1 if the option is invalid
+ */
+int parse_jobs_option(void)
+{
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+  char** args;
+  char* end;
+  
+  if (!args_opts_used((char*)"--jobs"))
+    return 0;
+  args = args_opts_get((char*)"--jobs");
+  if ((args_opts_get_count((char*)"--jobs") != 1) || (*args == NULL))
+    return -1;
+  if (!isdigit((unsigned char)**args))
+    return -1;
+  errno = 0;
+  jobs = (size_t)strtoumax(*args, &end, 10);
+  return (errno || *end || !jobs) ? -1 : 0;
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+}
+
+
+/**
+ * Run jobs from a pool until all have been started
+ * 
+ * @param   arg  The pool
+ * @return       `NULL`
+ */
+static void* job_worker(void* arg)
+{
+  struct job_pool* pool = arg;
+  size_t i;
+  
+  for (;;)
+    {
+      /* The indices are handed out in order, so when one is past a failed job, all later ones are. */
+      i = __atomic_fetch_add(&(pool->next), 1, __ATOMIC_RELAXED);
+      if ((i >= pool->count) || (i > __atomic_load_n(&(pool->failed), __ATOMIC_RELAXED)))
+	return NULL;
+      
+      if (pool->job(i, pool->data))
+	{
+	  pthread_mutex_lock(&(pool->mutex));
+	  if (i < pool->failed)
+	    {
+	      pool->error = errno;
+	      __atomic_store_n(&(pool->failed), i, __ATOMIC_RELAXED);
+	    }
+	  pthread_mutex_unlock(&(pool->mutex));
+	}
+    }
+}
+
+
+/**
+ * Run jobs on the threads selected with the -j option
+ * 
+ * The jobs are started in order, and after a job has failed,
+ * no more jobs are started, so the reported error is the same
+ * regardless of the number of threads, however, jobs after the
+ * failed job may already have been run, so which of them have
+ * been run depends on the number of threads
+ * 
+ * @param   count  The number of jobs
+ * @param   job    The function that runs a job
+ * @param   data   Passed to `job`
+ * @return         Zero on success, -1 on error, `errno` is
+ *                 set by the first job, by index, that failed
+ */
+int run_jobs(size_t count, job_func_t* job, void* data)
+{
+  pthread_t threads[MAX_JOBS - 1];
+  struct job_pool pool;
+  size_t i, n = jobs;
+  long int cpus;
+  
+  if (n == 0)
+    {
+      cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      n = cpus < 1 ? 1 : (size_t)cpus;
+    }
+  n = n < MAX_JOBS ? n : MAX_JOBS;
+  n = n < count ? n : count;
+  
+  pool.job = job;
+  pool.data = data;
+  pool.count = count;
+  pool.next = 0;
+  pool.failed = count;
+  pool.error = 0;
+  pthread_mutex_init(&(pool.mutex), NULL);
+  
+  /* This thread is one of the workers, if threads cannot be created, fewer are used. */
+  for (i = 0; i + 1 < n; i++)
+    if (pthread_create(threads + i, NULL, job_worker, &pool))
+      break;
+  job_worker(&pool);
+  while (i--)
+    pthread_join(threads[i], NULL);
+  
+  pthread_mutex_destroy(&(pool.mutex));
+  if (pool.failed < count)
+    return errno = pool.error, -1;
+  return 0;
+}
+
+
+/**
+ * Add a file to copy, link or move
+ * 
+ * @param   transfers  The files to copy, link or move
+ * @param   src        The file
+ * @param   dest       The new file
+ * @return             Zero on success, -1 on error
+ */
+int add_transfer(struct transfers* transfers, const char* src, const char* dest)
+{
+  char** new;
+  size_t i = 2 * transfers->count;
+  
+  if (transfers->count == transfers->size)
+    {
+      transfers->size = transfers->size ? 2 * transfers->size : 64;
+      new = realloc(transfers->pathnames, 2 * transfers->size * sizeof(char*));
+      if (new == NULL)
+	return transfers->size = transfers->count, -1;
+      transfers->pathnames = new;
+    }
+  
+  if (!(transfers->pathnames[i + 0] = strdup(src)))
+    return -1;
+  if (!(transfers->pathnames[i + 1] = strdup(dest)))
+    return free(transfers->pathnames[i]), -1;
+  transfers->count++;
+  return 0;
+}
+
+
+/**
+ * Copy, link or move a file
+ * 
+ * @param   index  The index of the file
+ * @param   data   The files to copy, link or move
+ * @return         Zero on success, -1 on error
+ */
+static int transfer_job(size_t index, void* data)
+{
+  struct transfers* transfers = data;
+  const char* src  = transfers->pathnames[2 * index + 0];
+  const char* dest = transfers->pathnames[2 * index + 1];
+  
+  switch (transfers->mode)
+    {
+    case MODE_COPY:     return copyfile(src, dest);
+    case MODE_SYMLINK:  return symlfile(src, dest);
+    case MODE_LINK:     return linkfile(src, dest);
+    case MODE_MOVE:     return movefile(src, dest);
+    default:
+      return abort(), -1;
+    }
+}
+
+
+/**
+ * Copy, link or move files, in parallel unless they are moved
+ * 
+ * Files are moved one at a time, in order, so that when a move
+ * fails, the files that have been moved are the ones before it,
+ * regardless of the number of threads
+ * 
+ * @param   transfers  The files to copy, link or move
+ * @return             Zero on success, -1 on error
+ */
+int run_transfers(struct transfers* transfers)
+{
+  size_t i;
+  
+  if (transfers->mode != MODE_MOVE)
+    return run_jobs(transfers->count, transfer_job, transfers);
+  
+  for (i = 0; i < transfers->count; i++)
+    if (transfer_job(i, transfers))
+      return -1;
+  return 0;
+}
+
+
+/**
+ * Release the resources of a list of files to copy, link or move
+ * 
+ * @param  transfers  The files to copy, link or move
+ */
+void free_transfers(struct transfers* transfers)
+{
+  size_t i;
+  
+  for (i = 0; i < 2 * transfers->count; i++)
+    free(transfers->pathnames[i]);
+  free(transfers->pathnames);
+  transfers->pathnames = NULL;
+  transfers->count = transfers->size = 0;
+}
@@ -19,6 +19,9 @@
 #define CRAZY_TOOLS_COMMON_H
 
 
+#include <stddef.h>
+
+
 
 /**
  * Go to the label `fail` unless the given expression
@@ -29,6 +32,64 @@
 #define t(...)  do { if (__VA_ARGS__) goto fail; } while (0)
 
 
+/**
+ * Copy files
+ */
+#define MODE_COPY  0
+
+/**
+ * Symbolically link files
+ */
+#define MODE_SYMLINK  1
+
+/**
+ * Link files
+ */
+#define MODE_LINK  2
+
+/**
+ * Move files
+ */
+#define MODE_MOVE  3
+
+
+/**
+ * A job that can be run by `run_jobs`
+ * 
+ * @param   index  The index of the job
+ * @param   data   The `data` argument of `run_jobs`
+ * @return         Zero on success, -1 on error
+ */
+typedef int job_func_t(size_t index, void* data);
+
+
+/**
+ * Files to copy, link or move
+ */
+struct transfers
+{
+  /**
+   * Each file followed by its new pathname
+   */
+  char** pathnames;
+  
+  /**
+   * The number of files
+   */
+  size_t count;
+  
+  /**
+   * The number of files `pathnames` has room for
+   */
+  size_t size;
+  
+  /**
+   * `MODE_COPY`, `MODE_SYMLINK`, `MODE_LINK`, or `MODE_MOVE`
+   */
+  int mode;
+};
+
+
 /**
  * Copy a file
  * 
@@ -75,6 +136,86 @@ int movefile(const char* src, const char* dest);
  */
 int mkdirs(const char* dir);
 
+/**
+ * Read a file into memory
+ * 
+ * @param   file     The file
+ * @param   content  Output parameter for the content of the file,
+ *                   shall be freed by the caller
+ * @param   size     Output parameter for the size of the file
+ * @return           Zero on success, -1 on error
+ */
+int readfile(const char* file, char** content, size_t* size);
+
+/**
+ * Create or truncate a file and write to it
+ * 
+ * @param   file     The file
+ * @param   content  The new content of the file
+ * @param   size     The size of `content`
+ * @return           Zero on success, -1 on error
+ */
+int writefile(const char* file, const char* content, size_t size);
+
+/**
+ * Add the -j option, that selects how many jobs `run_jobs` runs at once
+ */
+void add_jobs_option(void);
+
+/**
+ * Read the -j option, must be called after the
+ * command line has been parsed
+ * 
+ * @return  Zero on success, -1 if the option is invalid
+ */
+int parse_jobs_option(void);
+
+/**
+ * Run jobs on the threads selected with the -j option
+ * 
+ * The jobs are started in order, and after a job has failed,
+ * no more jobs are started, so the reported error is the same
+ * regardless of the number of threads, however, jobs after the
+ * failed job may already have been run, so which of them have
+ * been run depends on the number of threads
+ * 
+ * @param   count  The number of jobs
+ * @param   job    The function that runs a job
+ * @param   data   Passed to `job`
+ * @return         Zero on success, -1 on error, `errno` is
+ *                 set by the first job, by index, that failed
+ */
+int run_jobs(size_t count, job_func_t* job, void* data);
+
+/**
+ * Add a file to copy, link or move
+ * 
+ * @param   transfers  The files to copy, link or move
+ * @param   src        The file
+ * @param   dest       The new file
+ * @return             Zero on success, -1 on error
+ */
+int add_transfer(struct transfers* transfers, const char* src, const char* dest);
+
+/**
+ * Copy, link or move files, in parallel unless they are moved
+ * 
+ * Files are moved one at a time, in order, so that when a move
+ * fails, the files that have been moved are the ones before it,
+ * regardless of the number of threads
+ * 
+ * @param   transfers  The files to copy, link or move
+ * @return             Zero on success, -1 on error
+ */
+int run_transfers(struct transfers* transfers);
+
+/**
+ * Release the resources of a list of files to copy, link or move
+ * 
+ * @param  transfers  The files to copy, link or move
+ */
+void free_transfers(struct transfers* transfers);
+
 
 
 #endif
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "common.h"
+#include "../manifest.h"
 #include <alloca.h>
 #include <string.h>
 #include <errno.h>
@@ -24,28 +25,6 @@
 
 
 
-/**
- * Copy files
- */
-#define MODE_COPY  0
-
-/**
- * Symbolically link files
- */
-#define MODE_SYMLINK  1
-
-/**
- * Link files
- */
-#define MODE_LINK  2
-
-/**
- * Move files
- */
-#define MODE_MOVE  3
-
-
-
 /**
  * Buffer for pathnames
  */
@@ -69,29 +48,38 @@ static char* buffer2;
  */
 static int perform_cat(char** input_dirs, size_t input_dirs_n, char* output_dir, int mode)
 {
-  size_t in, out = 1, dir;
+  struct transfers transfers = { .pathnames = NULL, .count = 0, .size = 0, .mode = mode };
+  struct manifest manifest = { .pages = NULL, .count = 0 };
+  size_t in, n, out = 1, dir;
+  int saved_errno;
   
   for (dir = 0; dir < input_dirs_n; dir++)
-    for (in = 1;; in++)
-      {
-	sprintf(buffer1, "%s/%zu.pnm", input_dirs[dir], in);
-	if (access(buffer1, F_OK))
-	  break;
-	
-	sprintf(buffer2, "%s/%zu.pnm", output_dir, out++);
-	switch (mode)
-	  {
-	  case MODE_COPY:     t (copyfile(buffer1, buffer2));  break;
-	  case MODE_SYMLINK:  t (symlfile(buffer1, buffer2));  break;
-	  case MODE_LINK:     t (linkfile(buffer1, buffer2));  break;
-	  case MODE_MOVE:     t (movefile(buffer1, buffer2));  break;
-	  default:
-	    return abort(), -1;
-	  }
-      }
+    {
+      t (manifest_load(input_dirs[dir], &manifest));
+      n = manifest_run(&manifest, 1, 1);
+      manifest_destroy(&manifest);
+      for (in = 1; in <= n; in++)
+	{
+	  sprintf(buffer1, "%s/%zu.pnm", input_dirs[dir], in);
+	  sprintf(buffer2, "%s/%zu.pnm", output_dir, out++);
+	  t (add_transfer(&transfers, buffer1, buffer2));
+	}
+    }
+  
+  t (run_transfers(&transfers));
+  
+  manifest_update(output_dir);
+  if (mode == MODE_MOVE)
+    for (dir = 0; dir < input_dirs_n; dir++)
+      manifest_update(input_dirs[dir]);
   
+  free_transfers(&transfers);
   return 0;
  fail:
+  saved_errno = errno;
+  manifest_destroy(&manifest);
+  free_transfers(&transfers);
+  errno = saved_errno;
   return -1;
 }
 
@@ -117,7 +105,7 @@ int main(int argc, char* argv[])
   
   
   args_init((char*)"Concatenate-merge directories",
-	    (char*)"crazy-cat [-s | -h | -m] [--] <input-dir>... <output-dir>",
+	    (char*)"crazy-cat [-s | -h | -m] [-j N] [--] <input-dir>... <output-dir>",
 	    NULL, NULL, 1, 0, args_standard_abbreviations);
   
   
@@ -133,6 +121,8 @@ int main(int argc, char* argv[])
   args_add_option(args_new_argumentless(NULL, 0, (char*)"-m", (char*)"--move", NULL),
 		  (char*)"Move files rather than create copies");
   
+  add_jobs_option();
+  
   
   args_parse(argc, argv);
   args_support_alternatives();
@@ -151,6 +141,8 @@ int main(int argc, char* argv[])
   f_move     = !!args_opts_used((char*)"--move");
   if (f_symlink + f_hardlink + f_move > 1)
     goto invalid_opts;
+  if (parse_jobs_option())
+    goto invalid_opts;
   
   
   for (i = 0; i < (size_t)args_files_count; i++)
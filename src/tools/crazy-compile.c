@@ -15,9 +15,18 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "common.h"
+#include "../manifest.h"
+#include "../orientation.h"
+#include "../transform.h"
 #include <string.h>
 #include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <argparser.h>
 
@@ -28,6 +37,13 @@
  */
 static char buffer[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
 
+/**
+ * Directory for the pages that have an orientation,
+ * they are rotated before they are compiled, it is
+ * created under $TMPDIR, or /tmp if it is not set
+ */
+static char* tempdir = NULL;
+
 
 
 #ifdef __GNUC__
@@ -37,30 +53,115 @@ static char buffer[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
 #endif
 
 
+/**
+ * Pages to rotate before they are compiled
+ */
+struct orientations
+{
+  /**
+   * The numbers of the pages
+   */
+  size_t* pages;
+  
+  /**
+   * The pathname of the rotated copy of each page,
+   * indexed by page number
+   */
+  char** copies;
+};
+
+
+
+/**
+ * Create a rotated copy of a page that has an orientation
+ * 
+ * @param   index  The index of the page among the pages to rotate
+ * @param   data   The pages to rotate
+ * @return         Zero on success, -1 on error
+ */
+static int orient_page(size_t index, void* data)
+{
+  const struct orientations* orientations = data;
+  char page[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
+  char* image = NULL;
+  char* oriented = NULL;
+  size_t size, oriented_size;
+  int corners[4], saved_errno;
+  
+  sprintf(page, "%zu.pnm", orientations->pages[index]);
+  t (orientation_read(page, corners));
+  t (readfile(page, &image, &size));
+  t (transform_image(image, size, corners[0], corners[1], corners[2], corners[3], &oriented, &oriented_size));
+  t (writefile(orientations->copies[orientations->pages[index]], oriented, oriented_size));
+  
+  free(image);
+  free(oriented);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(image);
+  free(oriented);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Remove the rotated copies of the pages
+ * 
+ * @param  pages  The pathnames of the pages, `NULL` for pages not yet added
+ * @param  n      The number of elements in `pages`
+ */
+static void remove_copies(char* const* pages, size_t n)
+{
+  size_t i;
+  
+  for (i = 0; i < n; i++)
+    if ((pages[i] != NULL) && !strncmp(pages[i], tempdir, strlen(tempdir)))
+      unlink(pages[i]);
+  rmdir(tempdir);
+}
+
+
 /**
  * Perform compilation
  * 
+ * Pages that have an orientation are rotated into
+ * temporary files, other pages are used directly
+ * 
  * @return  Zero on success, -1 on error
  */
 static int perform_compile(void)
 {
-  size_t i, n, len = 0;
-  char** command;
-  char* buf;
+  struct orientations orientations = { .pages = NULL, .copies = NULL };
+  struct manifest manifest;
+  size_t i, n, len = 0, oriented = 0;
+  char** command = NULL;
+  char* buf = NULL;
   char* arg;
+  const char* tmp;
   ssize_t arglen;
-  int saved_errno;
+  int corners[4], have_tempdir = 0, status, saved_errno;
+  pid_t pid;
+  
+  if (!(tmp = getenv("TMPDIR")) || !*tmp)
+    tmp = "/tmp";
+  t (!(tempdir = malloc(strlen(tmp) + sizeof("/crazy-compile-XXXXXX"))));
+  stpcpy(stpcpy(tempdir, tmp), "/crazy-compile-XXXXXX");
   
-  for (n = 1;; n++)
+  t (manifest_load(".", &manifest));
+  n = manifest_run(&manifest, 1, 1) + 1;
+  manifest_destroy(&manifest);
+  for (i = 1; i < n; i++)
     {
-      sprintf(buffer, "%zu.pnm", n);
-      if (access(buffer, F_OK))
-	break;
-      len += strlen(buffer) + 1;
+      sprintf(buffer, "%zu.pnm", i);
+      len += strlen(tempdir) + 1 + strlen(buffer) + 1;
     }
   
-  command = malloc((4 + n) * sizeof(char*));
-  arg = buf = malloc(len * sizeof(char));
+  t (!(command = calloc(4 + n, sizeof(char*))));
+  t (!(arg = buf = malloc(len * sizeof(char))));
+  t (!(orientations.pages = malloc(n * sizeof(size_t))));
+  orientations.copies = command + 2;
   
   command[0] = (char*)"gm";
   command[1] = (char*)"convert";
@@ -69,15 +170,48 @@ static int perform_compile(void)
     {
       command[i + 2] = arg;
       sprintf(arg, "%zu.pnm%zn", i, &arglen);
+      t (orientation_read(arg, corners));
+      if (!orientation_is_identity(corners))
+	{
+	  if (!have_tempdir)
+	    {
+	      t (!mkdtemp(tempdir));
+	      have_tempdir = 1;
+	    }
+	  sprintf(arg, "%s/%zu.pnm%zn", tempdir, i, &arglen);
+	  orientations.pages[oriented++] = i;
+	}
       arg += (size_t)arglen + 1;
     }
   command[n + 2] = (char*)"pdf:-";
   command[n + 3] = NULL;
   
-  execvp(*command, command);
+  t (run_jobs(oriented, orient_page, &orientations));
+  
+  if (!have_tempdir)
+    {
+      execvp(*command, command);
+      goto fail;
+    }
+  
+  t ((errno = posix_spawnp(&pid, *command, NULL, NULL, command, environ)));
+  while (waitpid(pid, &status, 0) < 0)
+    t (errno != EINTR);
+  
+  remove_copies(command + 3, n - 1);
+  free(orientations.pages);
+  free(command);
+  free(buf);
+  free(tempdir), tempdir = NULL;
+  return status ? (errno = 0, -1) : 0;
+ fail:
   saved_errno = errno;
+  if (have_tempdir)
+    remove_copies(command + 3, n - 1);
+  free(orientations.pages);
   free(command);
   free(buf);
+  free(tempdir), tempdir = NULL;
   errno = saved_errno;
   return -1;
 }
@@ -96,13 +230,15 @@ int main(int argc, char* argv[])
   
   
   args_init((char*)"Compile a multipage-document from a directory of images",
-	    (char*)"crazy-compile > <output-file>",
+	    (char*)"crazy-compile [-j N] > <output-file>",
 	    NULL, NULL, 1, 0, args_standard_abbreviations);
   
   
   args_add_option(args_new_argumentless(NULL, 0, (char*)"--help", NULL),
 		  (char*)"Prints this help message");
   
+  add_jobs_option();
+  
   
   args_parse(argc, argv);
   args_support_alternatives();
@@ -115,6 +251,8 @@ int main(int argc, char* argv[])
     }
   if (args_unrecognised_count || args_files_count)
     goto invalid_opts;
+  if (parse_jobs_option())
+    goto invalid_opts;
   
   
   args_dispose(), dispose = 0;
@@ -129,6 +267,8 @@ int main(int argc, char* argv[])
  invalid_opts:
   args_help();
  fail:
+  if (errno)
+    perror(*argv);
   rc = 1;
   goto exit;
 }
@@ -16,8 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "common.h"
-#include <dirent.h>
-#include <inttypes.h>
+#include "../manifest.h"
 #include <string.h>
 #include <errno.h>
 
@@ -44,43 +43,31 @@ static char buffer2[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
  */
 static int perform_join(void)
 {
-  DIR* dir;
-  struct dirent* file;
-  size_t in, out = 1, n = 0;
-  char* p;
+  struct manifest manifest;
+  size_t i, in, out = 1;
+  int saved_errno;
   
-  dir = opendir(".");
-  t (dir == NULL);
+  t (manifest_load(".", &manifest));
   
-  while ((file = readdir(dir)) != NULL)
+  /* The pages are sorted, so no page is moved onto a page that has not been moved yet. */
+  for (i = 0; i < manifest.count; i++)
     {
-      in = (size_t)strtoumax(file->d_name, &p, 10);
-      if (strcmp(p, ".pnm"))
-	continue;
-      sprintf(buffer1, "%zu.pnm", in);
-      if ((strcmp(buffer1, file->d_name)) || (in == SIZE_MAX))
-	t ((errno = ERANGE));
-      n = n < in ? in : n;
-    }
-  
-  for (in = 1, n++; in < n; in++)
-    {
-      sprintf(buffer1, "%zu.pnm", in);
-      sprintf(buffer2, "%zu.pnm", out);
-      if (access(buffer1, F_OK))
-	continue;
-      
+      in = manifest.pages[i].number;
       if (in == out++)
 	continue;
       
+      sprintf(buffer1, "%zu.pnm", in);
+      sprintf(buffer2, "%zu.pnm", out - 1);
       t (movefile(buffer1, buffer2));
     }
   
-  closedir(dir);
+  manifest_destroy(&manifest);
+  manifest_update(".");
   return 0;
  fail:
-  if (dir)
-    closedir(dir);
+  saved_errno = errno;
+  manifest_destroy(&manifest);
+  errno = saved_errno;
   return -1;
 }
 
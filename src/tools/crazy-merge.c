@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "common.h"
+#include "../manifest.h"
 #include <alloca.h>
 #include <string.h>
 #include <errno.h>
@@ -24,28 +25,6 @@
 
 
 
-/**
- * Copy files
- */
-#define MODE_COPY  0
-
-/**
- * Symbolically link files
- */
-#define MODE_SYMLINK  1
-
-/**
- * Link files
- */
-#define MODE_LINK  2
-
-/**
- * Move files
- */
-#define MODE_MOVE  3
-
-
-
 /**
  * Buffer for pathnames
  */
@@ -69,18 +48,29 @@ static char* buffer2;
  */
 static int perform_merge(char** input_dirs, size_t input_dirs_n, char* output_dir, int mode)
 {
+  struct transfers transfers = { .pathnames = NULL, .count = 0, .size = 0, .mode = mode };
+  struct manifest manifest = { .pages = NULL, .count = 0 };
   char* stopped = alloca(input_dirs_n * sizeof(char));
+  size_t* counts = alloca(input_dirs_n * sizeof(size_t));
   size_t in = 1, out = 1, dir = 0, stop_count = 0;
+  int saved_errno;
   
   memset(stopped, 0, input_dirs_n * sizeof(char));
   
-  for (; stop_count < input_dirs_n; in += !(dir = (dir + 1) % input_dirs_n))
+  for (dir = 0; dir < input_dirs_n; dir++)
+    {
+      t (manifest_load(input_dirs[dir], &manifest));
+      counts[dir] = manifest_run(&manifest, 1, 1);
+      manifest_destroy(&manifest);
+    }
+  
+  for (dir = 0; stop_count < input_dirs_n; in += !(dir = (dir + 1) % input_dirs_n))
     {
       if (stopped[dir])
 	continue;
       
       sprintf(buffer1, "%s/%zu.pnm", input_dirs[dir], in);
-      if (access(buffer1, F_OK))
+      if (in > counts[dir])
 	{
 	  stopped[dir] = 1;
 	  stop_count++;
@@ -88,19 +78,23 @@ static int perform_merge(char** input_dirs, size_t input_dirs_n, char* output_di
 	}
       
       sprintf(buffer2, "%s/%zu.pnm", output_dir, out++);
-      switch (mode)
-	{
-	case MODE_COPY:     t (copyfile(buffer1, buffer2));
-	case MODE_SYMLINK:  t (symlfile(buffer1, buffer2));
-	case MODE_LINK:     t (linkfile(buffer1, buffer2));
-	case MODE_MOVE:     t (movefile(buffer1, buffer2));
-	default:
-	  return abort(), -1;
-	}
+      t (add_transfer(&transfers, buffer1, buffer2));
     }
   
+  t (run_transfers(&transfers));
+  
+  manifest_update(output_dir);
+  if (mode == MODE_MOVE)
+    for (dir = 0; dir < input_dirs_n; dir++)
+      manifest_update(input_dirs[dir]);
+  
+  free_transfers(&transfers);
   return 0;
  fail:
+  saved_errno = errno;
+  manifest_destroy(&manifest);
+  free_transfers(&transfers);
+  errno = saved_errno;
   return -1;
 }
 
@@ -126,7 +120,7 @@ int main(int argc, char* argv[])
   
   
   args_init((char*)"Zigzag-merge directories",
-	    (char*)"crazy-merge [-s | -h | -m] [--] <input-dir>... <output-dir>",
+	    (char*)"crazy-merge [-s | -h | -m] [-j N] [--] <input-dir>... <output-dir>",
 	    NULL, NULL, 1, 0, args_standard_abbreviations);
   
   
@@ -142,6 +136,8 @@ int main(int argc, char* argv[])
   args_add_option(args_new_argumentless(NULL, 0, (char*)"-m", (char*)"--move", NULL),
 		  (char*)"Move files rather than create copies");
   
+  add_jobs_option();
+  
   
   args_parse(argc, argv);
   args_support_alternatives();
@@ -160,6 +156,8 @@ int main(int argc, char* argv[])
   f_move     = !!args_opts_used((char*)"--move");
   if (f_symlink + f_hardlink + f_move > 1)
     goto invalid_opts;
+  if (parse_jobs_option())
+    goto invalid_opts;
   
   
   for (i = 0; i < (size_t)args_files_count; i++)
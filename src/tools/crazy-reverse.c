@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "common.h"
+#include "../manifest.h"
 #include <errno.h>
 
 #include <argparser.h>
@@ -41,14 +42,17 @@ static char buffer2[sizeof(".temp.pnm") / sizeof(char) + 3 * sizeof(size_t)];
  */
 static int perform_reverse(void)
 {
+  struct manifest manifest;
   size_t i, n;
   
-  for (n = 1;; n++)
+  t (manifest_load(".", &manifest));
+  n = manifest_run(&manifest, 1, 1) + 1;
+  manifest_destroy(&manifest);
+  
+  for (i = 1; i < n; i++)
     {
-      sprintf(buffer1, "%zu.pnm", n);
-      sprintf(buffer2, "%zu.temp.pnm", n);
-      if (access(buffer1, F_OK))
-	break;
+      sprintf(buffer1, "%zu.pnm", i);
+      sprintf(buffer2, "%zu.temp.pnm", i);
       t (movefile(buffer1, buffer2));
     }
   
@@ -59,6 +63,7 @@ static int perform_reverse(void)
       t (movefile(buffer1, buffer2));
     }
   
+  manifest_update(".");
   return 0;
  fail:
   return -1;
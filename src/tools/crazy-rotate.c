@@ -15,25 +15,45 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "common.h"
+#include "../manifest.h"
+#include "../orientation.h"
+#include "../transform.h"
 #include <errno.h>
 #include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <argparser.h>
 
 
 
 /**
- * Buffer for pathnames
+ * The images to rotate
  */
-static char buffer1[sizeof(".temp.pnm") / sizeof(char) + 3 * sizeof(size_t)];
-
-/**
- * Buffer for pathnames
- */
-static char buffer2[sizeof(".temp.pnm") / sizeof(char) + 3 * sizeof(size_t)];
+struct rotation
+{
+  /**
+   * The first image
+   */
+  size_t first;
+  
+  /**
+   * The index difference between successive images
+   */
+  size_t diff;
+  
+  /**
+   * Whether to rotate the pixels rather than record the orientation
+   */
+  int physical;
+};
 
 
 
@@ -45,52 +65,118 @@ static char buffer2[sizeof(".temp.pnm") / sizeof(char) + 3 * sizeof(size_t)];
 #endif
 
 /**
- * Perform rotation
+ * Rotate an image 180 degrees in place, by mapping it into
+ * memory and reversing its pixels, without a temporary file
+ * 
+ * @param   page  The pathname of the image
+ * @return        Zero on success, -1 on error
+ */
+static int rotate_in_place(const char* page)
+{
+  char* image = MAP_FAILED;
+  struct stat attr;
+  size_t size = 0;
+  int fd = -1, saved_errno;
+  
+  t (fd = open(page, O_RDWR), fd < 0);
+  t (fstat(fd, &attr));
+  size = (size_t)(attr.st_size);
+  t (image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0), image == MAP_FAILED);
+  t (transform_half_turn(image, size));
+  t (munmap(image, size));
+  image = MAP_FAILED;
+  return close(fd);
+ fail:
+  saved_errno = errno;
+  if (image != MAP_FAILED)
+    munmap(image, size);
+  if (fd >= 0)
+    close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Rotate one image
  * 
- * @param   first  The first image
- * @param   diff   The index difference between successive images
- * @param   end    The image after the last image
+ * @param   index  The index of the image among the images to rotate
+ * @param   data   The images to rotate
  * @return         Zero on success, -1 on error
  */
-static int perform_rotate(size_t first, size_t diff, size_t end)
+static int rotate_image(size_t index, void* data)
 {
-  char* command[] = { (char*)"gm", (char*)"convert", buffer1,
-		      (char*)"-flip", (char*)"-flop", buffer2, NULL };
-  size_t i;
-  pid_t pid;
-  int status;
+  static const int half_turn[4] = { 4, 3, 2, 1 };
+  const struct rotation* rotation = data;
+  char page[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
+  char temp[sizeof(".temp.pnm") / sizeof(char) + 3 * sizeof(size_t)];
+  char* image = NULL;
+  char* rotated = NULL;
+  struct stat attr;
+  size_t size, rotated_size, i = rotation->first + index * rotation->diff;
+  int corners[4], saved_errno;
   
-  for (i = first; i < end; i += diff)
-    {
-      sprintf(buffer1, "%zu.pnm", i);
-      sprintf(buffer2, "%zu.temp.pnm", i);
-      if (access(buffer1, F_OK))
-	break;
-      
-      pid = fork();
-      t (pid < 0);
-      
-      if (pid == 0)
-	execvp(*command, command), perror(*command), exit(1);
-      
-    rewait:
-      if (waitpid(pid, &status, 0) < 0)
-	{
-	  t (errno != EINTR);
-	  goto rewait;
-	}
-      if (status)
-	return errno = 0, -1;
-      
-      t (unlink(buffer1) || movefile(buffer2, buffer1));
-    }
+  sprintf(page, "%zu.pnm", i);
+  sprintf(temp, "%zu.temp.pnm", i);
+  
+  t (orientation_read(page, corners));
+  orientation_compose(corners, half_turn);
+  if (!rotation->physical || orientation_is_identity(corners))
+    return orientation_write(page, corners);
+  
+  /* A page without an orientation can be turned in place, it has no orientation file to
+   * remove, unless it is hard linked, the other links shall not be turned with it. */
+  if (!memcmp(corners, half_turn, sizeof(half_turn)) && !stat(page, &attr) && (attr.st_nlink == 1))
+    return rotate_in_place(page);
   
+  /* The orientation file is removed when the rotated page replaces the page,
+   * the page is replaced atomically, so it is never missing. */
+  t (readfile(page, &image, &size));
+  t (transform_image(image, size, corners[0], corners[1], corners[2], corners[3],
+		     &rotated, &rotated_size));
+  free(image), image = NULL;
+  t (writefile(temp, rotated, rotated_size));
+  free(rotated), rotated = NULL;
+  
+  t (movefile(temp, page));
   return 0;
  fail:
+  saved_errno = errno;
+  free(image);
+  free(rotated);
+  errno = saved_errno;
   return -1;
 }
 
 
+/**
+ * Perform rotation
+ * 
+ * @param   first     The first image
+ * @param   diff      The index difference between successive images
+ * @param   end       The image after the last image
+ * @param   physical  Whether to rotate the pixels rather than record the orientation
+ * @return            Zero on success, -1 on error
+ */
+static int perform_rotate(size_t first, size_t diff, size_t end, int physical)
+{
+  struct rotation rotation = { .first = first, .diff = diff, .physical = physical };
+  struct manifest manifest;
+  size_t n, max = end > first ? (end - first - 1) / diff + 1 : 0;
+  int r;
+  
+  if (manifest_load(".", &manifest))
+    return -1;
+  n = manifest_run(&manifest, first, diff);
+  n = n < max ? n : max;
+  manifest_destroy(&manifest);
+  
+  r = run_jobs(n, rotate_image, &rotation);
+  manifest_update(".");
+  return r;
+}
+
+
 /**
  * Convert a `char*` to `a size_t`
  * 
@@ -119,18 +205,23 @@ static size_t parse_size(const char* str)
  */
 int main(int argc, char* argv[])
 {
-  int rc = 0;
+  int rc = 0, f_physical = 0;
   size_t first, diff, end;
   
   
   args_init((char*)"Rotate images in a pattern",
-	    (char*)"crazy-rotate [--] <first> <gaps+1> [<last>]",
+	    (char*)"crazy-rotate [-p] [-j N] [--] <first> <gaps+1> [<last>]",
 	    NULL, NULL, 1, 0, args_standard_abbreviations);
   
   
   args_add_option(args_new_argumentless(NULL, 0, (char*)"--help", NULL),
 		  (char*)"Prints this help message");
   
+  args_add_option(args_new_argumentless(NULL, 0, (char*)"-p", (char*)"--physical", NULL),
+		  (char*)"Rotate the pixels rather than record the orientation of the images");
+  
+  add_jobs_option();
+  
   
   args_parse(argc, argv);
   args_support_alternatives();
@@ -143,6 +234,9 @@ int main(int argc, char* argv[])
     }
   if (args_unrecognised_count || (args_files_count < 2) || (args_files_count > 3))
     goto invalid_opts;
+  f_physical = !!args_opts_used((char*)"--physical");
+  if (parse_jobs_option())
+    goto invalid_opts;
   
   
   first = parse_size(args_files[0]);
@@ -154,7 +248,7 @@ int main(int argc, char* argv[])
   if (end++ == SIZE_MAX)
     t ((errno = ERANGE));
   
-  t (perform_rotate(first, diff, end));
+  t (perform_rotate(first, diff, end, f_physical));
   
   
  exit:
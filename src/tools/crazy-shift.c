@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "common.h"
+#include "../manifest.h"
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
@@ -45,14 +46,12 @@ static char buffer2[sizeof(".pnm") / sizeof(char) + 3 * sizeof(size_t)];
  */
 static int perform_shift(size_t first, size_t shift)
 {
-  size_t i = first;
+  struct manifest manifest;
+  size_t i;
   
-  for (;; i++)
-    {
-      sprintf(buffer1, "%zu.pnm", i);
-      if (access(buffer1, F_OK))
-	break;
-    }
+  t (manifest_load(".", &manifest));
+  i = first + manifest_run(&manifest, first, 1);
+  manifest_destroy(&manifest);
   
   while (i-- > first)
     {
@@ -61,6 +60,7 @@ static int perform_shift(size_t first, size_t shift)
       t (movefile(buffer1, buffer2));
     }
   
+  manifest_update(".");
   return 0;
  fail:
   return -1;
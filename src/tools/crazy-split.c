@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "common.h"
+#include "../manifest.h"
 #include <alloca.h>
 #include <errno.h>
 #include <string.h>
@@ -25,28 +26,6 @@
 
 
 
-/**
- * Copy files
- */
-#define MODE_COPY  0
-
-/**
- * Symbolically link files
- */
-#define MODE_SYMLINK  1
-
-/**
- * Link files
- */
-#define MODE_LINK  2
-
-/**
- * Move files
- */
-#define MODE_MOVE  3
-
-
-
 /**
  * Buffer for pathnames
  */
@@ -97,8 +76,10 @@ struct split
  */
 static int perform_split(struct split* splits, size_t count, int mode)
 {
+  struct transfers transfers = { .pathnames = NULL, .count = 0, .size = 0, .mode = mode };
   struct split s;
-  size_t in, out;
+  size_t in, out, i, n = count;
+  int saved_errno;
   
   while (count--)
     {
@@ -108,20 +89,23 @@ static int perform_split(struct split* splits, size_t count, int mode)
 	{
 	  sprintf(buffer1, "%zu.pnm", in);
 	  sprintf(buffer2, "%s/%zu.pnm", s.dir, out++);
-	  switch (mode)
-	    {
-	    case MODE_COPY:     t (copyfile(buffer1, buffer2));
-	    case MODE_SYMLINK:  t (symlfile(buffer1, buffer2));
-	    case MODE_LINK:     t (linkfile(buffer1, buffer2));
-	    case MODE_MOVE:     t (movefile(buffer1, buffer2));
-	    default:
-	      return abort(), -1;
-	    }
+	  t (add_transfer(&transfers, buffer1, buffer2));
 	}
     }
   
+  t (run_transfers(&transfers));
+  
+  for (i = 0; i < n; i++)
+    manifest_update(splits[i].dir);
+  if (mode == MODE_MOVE)
+    manifest_update(".");
+  
+  free_transfers(&transfers);
   return 0;
  fail:
+  saved_errno = errno;
+  free_transfers(&transfers);
+  errno = saved_errno;
   return -1;
 }
 
@@ -167,7 +151,7 @@ int main(int argc, char* argv[])
   
   
   args_init((char*)"Split a directory of images in a pattern",
-	    (char*)"crazy-split [-s | -h | -m] [--] (<first> <gaps+1> <last> <output-dir>)...",
+	    (char*)"crazy-split [-s | -h | -m] [-j N] [--] (<first> <gaps+1> <last> <output-dir>)...",
 	    NULL, NULL, 1, 0, args_standard_abbreviations);
   
   
@@ -183,6 +167,8 @@ int main(int argc, char* argv[])
   args_add_option(args_new_argumentless(NULL, 0, (char*)"-m", (char*)"--move", NULL),
 		  (char*)"Move files rather than create copies");
   
+  add_jobs_option();
+  
   
   args_parse(argc, argv);
   args_support_alternatives();
@@ -201,6 +187,8 @@ int main(int argc, char* argv[])
   f_move     = !!args_opts_used((char*)"--move");
   if (f_symlink + f_hardlink + f_move > 1)
     goto invalid_opts;
+  if (parse_jobs_option())
+    goto invalid_opts;
   
   
   splits = alloca(((size_t)args_files_count >> 2) * sizeof(struct split));
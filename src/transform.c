@@ -0,0 +1,694 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "transform.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+#endif
+
+#include "pnm.h"
+
+
+
+/* Reversal of the bits in each byte. */
+#define R2(N)  N, N + 2 * 64, N + 1 * 64, N + 3 * 64
+#define R4(N)  R2(N), R2(N + 2 * 16), R2(N + 1 * 16), R2(N + 3 * 16)
+#define R6(N)  R4(N), R4(N + 2 * 4), R4(N + 1 * 4), R4(N + 3 * 4)
+
+/**
+ * Each byte with the order of its bits reversed
+ */
+static const unsigned char reverse_table[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+#undef R6
+#undef R4
+#undef R2
+
+
+
+/**
+ * Copy a row of pixels in reverse order
+ * 
+ * @param  dest        The output row
+ * @param  src         The input row
+ * @param  width       The number of pixels in the row
+ * @param  pixel_size  The number of bytes per pixel: 1, 2, 3 or 6
+ */
+static void transform_reverse_pixels(unsigned char* restrict dest, const unsigned char* restrict src,
+				     size_t width, size_t pixel_size)
+{
+#define X(N)  case N: for (; width--; dest += N) src -= N, memcpy(dest, src, N); break
+  
+  src += width * pixel_size;
+  switch (pixel_size)
+    {
+      X(1);
+      X(2);
+      X(3);
+      X(6);
+    default:
+      abort();
+    }
+    
+#undef X
+}
+
+
+/**
+ * Reverse the order of the pixels in a payload in place, one pixel at a time
+ * 
+ * @param  payload     The pixels
+ * @param  pixels      The number of pixels in `payload`
+ * @param  pixel_size  The number of bytes per pixel: 1, 2, 3 or 6
+ */
+static void transform_reverse_in_place_scalar(unsigned char* restrict payload, size_t pixels, size_t pixel_size)
+{
+#define X(N)								\
+  case N:								\
+    for (i = 0, j = pixels; i + 1 < j; i++)				\
+      {									\
+	j--;								\
+	memcpy(c, payload + i * N, N);					\
+	memcpy(payload + i * N, payload + j * N, N);			\
+	memcpy(payload + j * N, c, N);					\
+      }									\
+    break
+  
+  unsigned char c[6];
+  size_t i, j;
+  
+  switch (pixel_size)
+    {
+      X(1);
+      X(2);
+      X(3);
+      X(6);
+    default:
+      abort();
+    }
+    
+#undef X
+}
+
+
+/**
+ * Mirror a row of packed lineart in place
+ * 
+ * @param  row    The row, most significant bit first
+ * @param  width  The number of pixels in the row
+ */
+static void transform_mirror_lineart(unsigned char* restrict row, size_t width)
+{
+  size_t n = (width + 7) / 8, i, j;
+  unsigned int pad = (unsigned int)(n * 8 - width);
+  unsigned char c;
+  
+  if (n == 0)
+    return;
+  
+  for (i = 0, j = n - 1; i < j; i++, j--)
+    c = row[i], row[i] = reverse_table[row[j]], row[j] = reverse_table[c];
+  if (i == j)
+    row[i] = reverse_table[row[i]];
+  
+  /* The padding is now at the beginning of the row, move it back to the end. */
+  if (pad)
+    {
+      for (i = 0; i + 1 < n; i++)
+	row[i] = (unsigned char)((row[i] << pad) | (row[i + 1] >> (8 - pad)));
+      row[i] = (unsigned char)(row[i] << pad);
+    }
+}
+
+
+/**
+ * Transpose a block of pixels, one pixel at a time
+ * 
+ * Pixel (`i`, `j`), that is column `j` on row `i`, in `src`
+ * is copied to pixel (`j`, `i`) in `dest`
+ * 
+ * @param  dest         The first output row
+ * @param  dest_stride  The number of bytes between the start of successive rows in `dest`
+ * @param  src          The first input row
+ * @param  src_stride   The number of bytes between the start of successive rows in `src`
+ * @param  rows         The number of rows in `src`
+ * @param  columns      The number of columns in `src`
+ * @param  pixel_size   The number of bytes per pixel: 1, 2, 3 or 6
+ */
+static void transform_transpose_scalar(unsigned char* restrict dest, ptrdiff_t dest_stride,
+				       const unsigned char* restrict src, ptrdiff_t src_stride,
+				       size_t rows, size_t columns, size_t pixel_size)
+{
+#define X(N)								\
+  case N:								\
+    for (i = 0; i < rows; i++, src += src_stride, dest += N)		\
+      for (j = 0; j < columns; j++)					\
+	memcpy(dest + (ptrdiff_t)j * dest_stride, src + j * N, N);	\
+    break
+  
+  size_t i, j;
+  
+  switch (pixel_size)
+    {
+      X(1);
+      X(2);
+      X(3);
+      X(6);
+    default:
+      abort();
+    }
+    
+#undef X
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS
+
+
+/**
+ * Transpose a block of 16 by 16 bytes, using SSE2
+ * 
+ * Four rounds of interleaving row `i` with row `i + 8`
+ * transposes the block
+ * 
+ * @param  dest         The first output row
+ * @param  dest_stride  The number of bytes between the start of successive rows in `dest`
+ * @param  src          The first input row
+ * @param  src_stride   The number of bytes between the start of successive rows in `src`
+ */
+__attribute__((target("sse2")))
+static void transform_transpose16_sse2(unsigned char* restrict dest, ptrdiff_t dest_stride,
+				       const unsigned char* restrict src, ptrdiff_t src_stride)
+{
+  __m128i a[16], b[16];
+  int i, round;
+  
+  for (i = 0; i < 16; i++)
+    a[i] = _mm_loadu_si128((const __m128i*)(const void*)(src + i * src_stride));
+  
+  for (round = 0; round < 4; round++)
+    {
+      for (i = 0; i < 8; i++)
+	{
+	  b[2 * i + 0] = _mm_unpacklo_epi8(a[i], a[i + 8]);
+	  b[2 * i + 1] = _mm_unpackhi_epi8(a[i], a[i + 8]);
+	}
+      memcpy(a, b, sizeof(a));
+    }
+  
+  for (i = 0; i < 16; i++)
+    _mm_storeu_si128((__m128i*)(void*)(dest + i * dest_stride), a[i]);
+}
+
+
+/**
+ * Transpose a block of 8 by 8 16-bit pixels, using SSE2
+ * 
+ * Three rounds of interleaving row `i` with row `i + 4`
+ * transposes the block
+ * 
+ * @param  dest         The first output row
+ * @param  dest_stride  The number of bytes between the start of successive rows in `dest`
+ * @param  src          The first input row
+ * @param  src_stride   The number of bytes between the start of successive rows in `src`
+ */
+__attribute__((target("sse2")))
+static void transform_transpose8_sse2(unsigned char* restrict dest, ptrdiff_t dest_stride,
+				      const unsigned char* restrict src, ptrdiff_t src_stride)
+{
+  __m128i a[8], b[8];
+  int i, round;
+  
+  for (i = 0; i < 8; i++)
+    a[i] = _mm_loadu_si128((const __m128i*)(const void*)(src + i * src_stride));
+  
+  for (round = 0; round < 3; round++)
+    {
+      for (i = 0; i < 4; i++)
+	{
+	  b[2 * i + 0] = _mm_unpacklo_epi16(a[i], a[i + 4]);
+	  b[2 * i + 1] = _mm_unpackhi_epi16(a[i], a[i + 4]);
+	}
+      memcpy(a, b, sizeof(a));
+    }
+  
+  for (i = 0; i < 8; i++)
+    _mm_storeu_si128((__m128i*)(void*)(dest + i * dest_stride), a[i]);
+}
+
+
+/**
+ * Reverse the order of the pixels in a payload in place, using SSSE3,
+ * the ends are swapped 48 bytes at a time, which is a whole number
+ * of pixels for all pixel sizes, so RGB triplets and 16-bit samples
+ * are never split up
+ * 
+ * @param   payload     The pixels
+ * @param   pixels      The number of pixels in `payload`
+ * @param   pixel_size  The number of bytes per pixel: 1, 2, 3 or 6
+ * @return              The number of pixels that have been swapped at each end,
+ *                      the pixels between them remain to be reversed
+ */
+__attribute__((target("ssse3")))
+static size_t transform_reverse_in_place_ssse3(unsigned char* restrict payload, size_t pixels, size_t pixel_size)
+{
+  unsigned char masks[3][3][16];
+  __m128i m[3][3], a[3], b[3], ra, rb;
+  size_t n = 48 / pixel_size, i, j, k, src;
+  int r, q;
+  
+  /* Byte k of the reversed block is byte `src` of the block, which is in register
+   * `src / 16`, all other registers contribute zero to it. */
+  for (k = 0; k < 48; k++)
+    {
+      src = (n - 1 - k / pixel_size) * pixel_size + k % pixel_size;
+      for (q = 0; q < 3; q++)
+	masks[k / 16][q][k % 16] = (unsigned char)(src / 16 == (size_t)q ? src % 16 : 0x80);
+    }
+  for (r = 0; r < 3; r++)
+    for (q = 0; q < 3; q++)
+      m[r][q] = _mm_loadu_si128((const __m128i*)(const void*)(masks[r][q]));
+  
+  for (i = 0, j = pixels * pixel_size; i + 2 * 48 <= j; i += 48)
+    {
+      j -= 48;
+      for (q = 0; q < 3; q++)
+	{
+	  a[q] = _mm_loadu_si128((const __m128i*)(const void*)(payload + i + 16 * q));
+	  b[q] = _mm_loadu_si128((const __m128i*)(const void*)(payload + j + 16 * q));
+	}
+      for (r = 0; r < 3; r++)
+	{
+	  ra = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a[0], m[r][0]),
+					 _mm_shuffle_epi8(a[1], m[r][1])),
+			    _mm_shuffle_epi8(a[2], m[r][2]));
+	  rb = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b[0], m[r][0]),
+					 _mm_shuffle_epi8(b[1], m[r][1])),
+			    _mm_shuffle_epi8(b[2], m[r][2]));
+	  _mm_storeu_si128((__m128i*)(void*)(payload + i + 16 * r), rb);
+	  _mm_storeu_si128((__m128i*)(void*)(payload + j + 16 * r), ra);
+	}
+    }
+  
+  return i / pixel_size;
+}
+
+
+#endif
+
+
+/**
+ * Transpose a block of pixels, with SIMD kernels for
+ * 8-bit and 16-bit greyscale if available
+ * 
+ * Pixel (`i`, `j`), that is column `j` on row `i`, in `src`
+ * is copied to pixel (`j`, `i`) in `dest`
+ * 
+ * @param  dest         The first output row
+ * @param  dest_stride  The number of bytes between the start of successive rows in `dest`
+ * @param  src          The first input row
+ * @param  src_stride   The number of bytes between the start of successive rows in `src`
+ * @param  rows         The number of rows in `src`
+ * @param  columns      The number of columns in `src`
+ * @param  pixel_size   The number of bytes per pixel: 1, 2, 3 or 6
+ */
+static void transform_transpose_block(unsigned char* restrict dest, ptrdiff_t dest_stride,
+				      const unsigned char* restrict src, ptrdiff_t src_stride,
+				      size_t rows, size_t columns, size_t pixel_size)
+{
+#ifdef HAVE_X86_KERNELS
+  static int sse2 = -1;
+  size_t n, i, j;
+  
+  if (sse2 < 0)
+    {
+      __builtin_cpu_init();
+      sse2 = __builtin_cpu_supports("sse2") != 0;
+    }
+  if (sse2 && ((pixel_size == 1) || (pixel_size == 2)))
+    {
+      n = pixel_size == 1 ? 16 : 8;
+      for (i = 0; i + n <= rows; i += n)
+	for (j = 0; j + n <= columns; j += n)
+	  (pixel_size == 1 ? transform_transpose16_sse2 : transform_transpose8_sse2)
+	    (dest + (ptrdiff_t)j * dest_stride + i * pixel_size, dest_stride,
+	     src + (ptrdiff_t)i * src_stride + j * pixel_size, src_stride);
+      
+      /* The columns on the right and the rows at the bottom that did not fill a block. */
+      j = columns - columns % n;
+      transform_transpose_scalar(dest + (ptrdiff_t)j * dest_stride, dest_stride,
+				 src + j * pixel_size, src_stride, i, columns - j, pixel_size);
+      transform_transpose_scalar(dest + i * pixel_size, dest_stride,
+				 src + (ptrdiff_t)i * src_stride, src_stride,
+				 rows - i, columns, pixel_size);
+      return;
+    }
+#endif
+  
+  transform_transpose_scalar(dest, dest_stride, src, src_stride, rows, columns, pixel_size);
+}
+
+
+/**
+ * Transpose 8 by 8 bits
+ * 
+ * @param   x  The bits, the most significant byte is the first row,
+ *             and the most significant bit in a byte is the first column
+ * @return     The bits transposed, in the same format
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+static uint64_t transform_transpose_bits(uint64_t x)
+{
+  uint64_t t;
+  
+  t = (x ^ (x >>  7)) & 0x00AA00AA00AA00AAULL,  x ^= t ^ (t <<  7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL,  x ^= t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL,  x ^= t ^ (t << 28);
+  
+  return x;
+}
+
+
+/**
+ * Rotate and mirror the payload of an image in a way that transposes it
+ * 
+ * @param  dest        The output payload
+ * @param  src         The input payload
+ * @param  type        The PNM type: 5 for raw greyscale 6 for raw RGB
+ * @param  maxval      The maximum value on a subpixel
+ * @param  width       The width of the input image, in pixels
+ * @param  height      The height of the input image, in pixels
+ * @param  right_left  Whether the output rows shall be taken from the input columns from right to left
+ * @param  bottom_up   Whether the output columns shall be taken from the input rows from bottom to top
+ */
+static void transform_transpose(unsigned char* restrict dest, const unsigned char* restrict src,
+				int type, unsigned int maxval, size_t width, size_t height,
+				int right_left, int bottom_up)
+{
+  size_t row_size = pnm_row_size(type, maxval, width);
+  size_t out_row_size = pnm_row_size(type, maxval, height);
+  size_t pixel_size = row_size / width;
+  size_t x, y, columns, rows;
+  const unsigned char* s;
+  unsigned char* d;
+  
+  /* Output pixel (x, y) is input pixel (y, x), or a mirror of it. */
+  for (y = 0; y < width; y += TRANSFORM_TILE)
+    for (x = 0; x < height; x += TRANSFORM_TILE)
+      {
+	rows    = height - x < TRANSFORM_TILE ? height - x : TRANSFORM_TILE;
+	columns = width  - y < TRANSFORM_TILE ? width  - y : TRANSFORM_TILE;
+	s  = src  + (bottom_up  ? height - 1 - x : x) * row_size;
+	s += (right_left ? width - y - columns : y) * pixel_size;
+	d  = dest + (right_left ? y + columns - 1 : y) * out_row_size + x * pixel_size;
+	transform_transpose_block(d, right_left ? -(ptrdiff_t)out_row_size : (ptrdiff_t)out_row_size,
+				  s, bottom_up  ? -(ptrdiff_t)row_size     : (ptrdiff_t)row_size,
+				  rows, columns, pixel_size);
+      }
+}
+
+
+/**
+ * Rotate and mirror the payload of a lineart image in a way that transposes it
+ * 
+ * @param  dest        The output payload
+ * @param  src         The input payload
+ * @param  width       The width of the input image, in pixels
+ * @param  height      The height of the input image, in pixels
+ * @param  right_left  Whether the output rows shall be taken from the input columns from right to left
+ * @param  bottom_up   Whether the output columns shall be taken from the input rows from bottom to top
+ */
+static void transform_transpose_lineart(unsigned char* restrict dest, const unsigned char* restrict src,
+					size_t width, size_t height, int right_left, int bottom_up)
+{
+  size_t row_size = (width + 7) / 8, out_row_size = (height + 7) / 8;
+  size_t byte, group, byte_end, group_end, i, r, k;
+  uint64_t x;
+  
+  /* Each group of 8 input rows and 8 input ks is one 8 by 8 bit transposition,
+   * missing rows are zero so that the padding of the output rows is cleared. */
+  for (byte = 0; byte < row_size; byte = byte_end)
+    {
+      byte_end = byte + TRANSFORM_TILE / 8 < row_size ? byte + TRANSFORM_TILE / 8 : row_size;
+      for (group = 0; group < out_row_size; group = group_end)
+	{
+	  group_end = group + TRANSFORM_TILE / 8 < out_row_size ? group + TRANSFORM_TILE / 8 : out_row_size;
+	  for (i = byte; i < byte_end; i++)
+	    for (r = group; r < group_end; r++)
+	      {
+		for (x = 0, k = 0; k < 8; k++)
+		  {
+		    x <<= 8;
+		    if (r * 8 + k < height)
+		      x |= src[(bottom_up ? height - 1 - (r * 8 + k) : r * 8 + k) * row_size + i];
+		  }
+		x = transform_transpose_bits(x);
+		for (k = 0; (k < 8) && (i * 8 + k < width); k++)
+		  dest[(right_left ? width - 1 - (i * 8 + k) : i * 8 + k) * out_row_size + r]
+		    = (unsigned char)(x >> (56 - 8 * k));
+	      }
+	}
+    }
+}
+
+
+/**
+ * Reverse the order of the pixels in a payload in place, with
+ * a SIMD kernel if available
+ * 
+ * @param  payload     The pixels
+ * @param  pixels      The number of pixels in `payload`
+ * @param  pixel_size  The number of bytes per pixel: 1, 2, 3 or 6
+ */
+static void transform_reverse_in_place(unsigned char* restrict payload, size_t pixels, size_t pixel_size)
+{
+#ifdef HAVE_X86_KERNELS
+  static int ssse3 = -1;
+  size_t n;
+  
+  if (ssse3 < 0)
+    {
+      __builtin_cpu_init();
+      ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    }
+  if (ssse3)
+    {
+      n = transform_reverse_in_place_ssse3(payload, pixels, pixel_size);
+      payload += n * pixel_size, pixels -= 2 * n;
+    }
+#endif
+  
+  transform_reverse_in_place_scalar(payload, pixels, pixel_size);
+}
+
+
+/**
+ * Rotate the payload of a lineart image 180 degrees in place
+ * 
+ * @param  payload  The payload
+ * @param  width    The width of the image, in pixels
+ * @param  height   The height of the image, in pixels
+ */
+static void transform_half_turn_lineart(unsigned char* restrict payload, size_t width, size_t height)
+{
+  size_t row_size = (width + 7) / 8, y, i;
+  unsigned char* top;
+  unsigned char* bottom;
+  unsigned char c;
+  
+  /* Rows are padded to whole bytes, so the rows are swapped and mirrored one by one. */
+  for (y = 0; y < height / 2; y++)
+    {
+      top = payload + y * row_size;
+      bottom = payload + (height - 1 - y) * row_size;
+      transform_mirror_lineart(top, width);
+      transform_mirror_lineart(bottom, width);
+      for (i = 0; i < row_size; i++)
+	c = top[i], top[i] = bottom[i], bottom[i] = c;
+    }
+  if (height & 1)
+    transform_mirror_lineart(payload + y * row_size, width);
+}
+
+
+/**
+ * Check that four corners describe a rotation and mirroring
+ * 
+ * @param   c1  The input corner that shall be the top left corner
+ * @param   c2  The input corner that shall be the top right corner
+ * @param   c3  The input corner that shall be the bottom left corner
+ * @param   c4  The input corner that shall be the bottom right corner
+ * @return      1 if the corners are valid, otherwise 0
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+int transform_valid(int c1, int c2, int c3, int c4)
+{
+  /* With corners numbered from 0, bit 0 is set for the right edge, and bit 1 for the bottom edge. */
+  c1--, c2--, c3--, c4--;
+  if (((unsigned int)c1 | (unsigned int)c2 | (unsigned int)c3) > 3)
+    return 0;
+  return (c1 ^ c2) && (c1 ^ c3) && ((c1 ^ c2) + (c1 ^ c3) == 3) && (c4 == (c1 ^ 3));
+}
+
+
+/**
+ * Rotate and mirror a PNM image, raw lineart, greyscale and RGB
+ * are supported
+ * 
+ * The transformation is described in the same way as `c1`, `c2`,
+ * `c3` and `c4` in crazy.c: 1 is the top left corner, 2 is the top
+ * right corner, 3 is the bottom left corner, and 4 is the bottom
+ * right corner, and `cN` is the corner in the input image that
+ * shall be corner N in the output image, for example, 4, 3, 2, 1
+ * rotates the image 180 degrees, and 3, 1, 4, 2 rotates the image
+ * 90 degrees clockwise
+ * 
+ * @param   image     The input image, including the header
+ * @param   size      The size of `image`
+ * @param   c1        The input corner that shall be the top left corner
+ * @param   c2        The input corner that shall be the top right corner
+ * @param   c3        The input corner that shall be the bottom left corner
+ * @param   c4        The input corner that shall be the bottom right corner
+ * @param   out       Output parameter for the output image, including the header,
+ *                    shall be freed by the caller, `NULL` on error
+ * @param   out_size  Output parameter for the size of `*out`
+ * @return            Zero on success, -1 on error, `errno` is set to `EINVAL`
+ *                    if the image is not supported or is truncated, or if the
+ *                    corners do not describe a rotation and mirroring
+ */
+int transform_image(const char* restrict image, size_t size, int c1, int c2, int c3, int c4,
+		    char** restrict out, size_t* restrict out_size)
+{
+  int state, comment, type, right_left, bottom_up;
+  unsigned int maxval;
+  size_t width, height, offset, payload, row_size, pixel_size, header, y;
+  const unsigned char* src;
+  unsigned char* dest;
+  
+  *out = NULL;
+  
+  if (!transform_valid(c1, c2, c3, c4))
+    return errno = EINVAL, -1;
+  
+  /* With corners numbered from 0, bit 0 is set for the right edge, and bit 1 for the bottom edge. */
+  c1--, c2--;
+  right_left = c1 & 1;
+  bottom_up  = c1 & 2;
+  
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
+  offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, size, image);
+  if ((state != 10) || (type < 4) || (type > 6) || !maxval || !width || !height)
+    return errno = EINVAL, -1;
+  payload = pnm_payload_size(type, maxval, width, height);
+  if (size - offset < payload)
+    return errno = EINVAL, -1;
+  src = (const unsigned char*)image + offset;
+  row_size = pnm_row_size(type, maxval, width);
+  pixel_size = row_size / width;
+  
+  /* The output has the same type, but the width and height are swapped if it is transposed. */
+  if ((c1 ^ c2) == 2)
+    y = width, width = height, height = y;
+  if (type == 4)
+    header = (size_t)snprintf(NULL, 0, "P4\n%zu %zu\n", width, height);
+  else
+    header = (size_t)snprintf(NULL, 0, "P%i\n%zu %zu\n%u\n", type, width, height, maxval);
+  payload = pnm_payload_size(type, maxval, width, height);
+  *out = malloc(header + payload + 1);
+  if (*out == NULL)
+    return -1;
+  if (type == 4)
+    sprintf(*out, "P4\n%zu %zu\n", width, height);
+  else
+    sprintf(*out, "P%i\n%zu %zu\n%u\n", type, width, height, maxval);
+  dest = (unsigned char*)*out + header;
+  *out_size = header + payload;
+  
+  if ((c1 ^ c2) == 2)
+    {
+      if (type == 4)
+	transform_transpose_lineart(dest, src, height, width, right_left, bottom_up);
+      else
+	transform_transpose(dest, src, type, maxval, height, width, right_left, bottom_up);
+      return 0;
+    }
+  
+  for (y = 0; y < height; y++, dest += row_size)
+    if (!right_left)
+      memcpy(dest, src + (bottom_up ? height - 1 - y : y) * row_size, row_size);
+    else if (type == 4)
+      {
+	memcpy(dest, src + (bottom_up ? height - 1 - y : y) * row_size, row_size);
+	transform_mirror_lineart(dest, width);
+      }
+    else
+      transform_reverse_pixels(dest, src + (bottom_up ? height - 1 - y : y) * row_size, width, pixel_size);
+  
+  return 0;
+}
+
+
+/**
+ * Rotate a PNM image 180 degrees in place, raw lineart, greyscale
+ * and RGB are supported
+ * 
+ * This is the same as `transform_image` with the corners 4, 3, 2, 1,
+ * but without a second copy of the image, so `image` can be a file
+ * mapped into memory
+ * 
+ * @param   image  The image, including the header
+ * @param   size   The size of `image`
+ * @return         Zero on success, -1 on error, `errno` is set to `EINVAL`
+ *                 if the image is not supported or is truncated
+ */
+int transform_half_turn(char* restrict image, size_t size)
+{
+  int state, comment, type;
+  unsigned int maxval;
+  size_t width, height, offset, pixel_size;
+  unsigned char* payload;
+  
+  pnm_init_parse_header(&state, &comment, &type, &maxval, &width, &height);
+  offset = pnm_parse_header(&state, &comment, &type, &maxval, &width, &height, size, image);
+  if ((state != 10) || (type < 4) || (type > 6) || !maxval || !width || !height)
+    return errno = EINVAL, -1;
+  if (size - offset < pnm_payload_size(type, maxval, width, height))
+    return errno = EINVAL, -1;
+  payload = (unsigned char*)image + offset;
+  
+  /* Without padding, reversing the rows and the pixels in each row reverses all pixels. */
+  if (type == 4)
+    transform_half_turn_lineart(payload, width, height);
+  else
+    {
+      pixel_size = pnm_row_size(type, maxval, width) / width;
+      transform_reverse_in_place(payload, width * height, pixel_size);
+    }
+  
+  return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_TRANSFORM_H
+#define CRAZY_TRANSFORM_H
+
+
+#include <stddef.h>
+
+
+
+/**
+ * The number of pixels along each side of the tiles an image is
+ * transposed in, a tile of the largest pixels (48-bit RGB) is
+ * 24 kB in the source and 24 kB in the destination, so the
+ * source tile stays in the L1 cache and both stay in the L2 cache
+ */
+#define TRANSFORM_TILE  64
+
+
+
+/**
+ * Check that four corners describe a rotation and mirroring
+ * 
+ * @param   c1  The input corner that shall be the top left corner
+ * @param   c2  The input corner that shall be the top right corner
+ * @param   c3  The input corner that shall be the bottom left corner
+ * @param   c4  The input corner that shall be the bottom right corner
+ * @return      1 if the corners are valid, otherwise 0
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+int transform_valid(int c1, int c2, int c3, int c4);
+
+/**
+ * Rotate and mirror a PNM image, raw lineart, greyscale and RGB
+ * are supported
+ * 
+ * The transformation is described in the same way as `c1`, `c2`,
+ * `c3` and `c4` in crazy.c: 1 is the top left corner, 2 is the top
+ * right corner, 3 is the bottom left corner, and 4 is the bottom
+ * right corner, and `cN` is the corner in the input image that
+ * shall be corner N in the output image, for example, 4, 3, 2, 1
+ * rotates the image 180 degrees, and 3, 1, 4, 2 rotates the image
+ * 90 degrees clockwise
+ * 
+ * @param   image     The input image, including the header
+ * @param   size      The size of `image`
+ * @param   c1        The input corner that shall be the top left corner
+ * @param   c2        The input corner that shall be the top right corner
+ * @param   c3        The input corner that shall be the bottom left corner
+ * @param   c4        The input corner that shall be the bottom right corner
+ * @param   out       Output parameter for the output image, including the header,
+ *                    shall be freed by the caller, `NULL` on error
+ * @param   out_size  Output parameter for the size of `*out`
+ * @return            Zero on success, -1 on error, `errno` is set to `EINVAL`
+ *                    if the image is not supported or is truncated, or if the
+ *                    corners do not describe a rotation and mirroring
+ */
+int transform_image(const char* restrict image, size_t size, int c1, int c2, int c3, int c4,
+		    char** restrict out, size_t* restrict out_size);
+
+
+/**
+ * Rotate a PNM image 180 degrees in place, raw lineart, greyscale
+ * and RGB are supported
+ * 
+ * This is the same as `transform_image` with the corners 4, 3, 2, 1,
+ * but without a second copy of the image, so `image` can be a file
+ * mapped into memory
+ * 
+ * @param   image  The image, including the header
+ * @param   size   The size of `image`
+ * @return         Zero on success, -1 on error, `errno` is set to `EINVAL`
+ *                 if the image is not supported or is truncated
+ */
+int transform_half_turn(char* restrict image, size_t size);
+
+
+#endif
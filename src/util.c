@@ -15,72 +15,316 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "util.h"
 #include "crazy.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 
 
 
 /**
- * Create a subprocess and read it's stdout
+ * `idtype_t` value for `waitid` to wait on a PID file descriptor
+ */
+#ifndef P_PIDFD
+# define P_PIDFD  3
+#endif
+
+
+
+/**
+ * Get a copy of the environment with $LANG set to "C"
  * 
- * @param   file    The filename of the command to start
- * @param   argv    The command line arguments for the new process
- * @param   lang_c  Whether to set $LANG to "C"
- * @param   pid     Output parameter for the new process's PID
- * @return          The file descriptor of the new process's stdout, -1 on error
+ * @return  The environment, `NULL` on error, only the array shall be freed
  */
-int subprocess_rd(const char* file, const char* const argv[], int lang_c, pid_t* pid)
+static char** lang_c_environ(void)
 {
-  int pipe_rw[2];
+  size_t i, n = 0;
+  char** env;
   
-  if (pipe(pipe_rw) < 0)
-    {
-      perror(execname);
-      errno = 0;
-      return -1;
-    }
+  while (environ[n])
+    n++;
+  
+  env = malloc((n + 2) * sizeof(char*));
+  if (env == NULL)
+    return NULL;
+  
+  for (i = n = 0; environ[i]; i++)
+    if (strncmp(environ[i], "LANG=", sizeof("LANG=") - 1))
+      env[n++] = environ[i];
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+  env[n++] = (char*)"LANG=C";
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+  env[n] = NULL;
+  
+  return env;
+}
+
+
+/**
+ * Create a subprocess, without duplicating the address space of this process
+ * 
+ * @param   proc   Output parameter for the new process
+ * @param   file   The filename of the command to start
+ * @param   argv   The command line arguments for the new process
+ * @param   flags  `SUBPROCESS_STDIN`, `SUBPROCESS_STDOUT` and `SUBPROCESS_LANG_C`, combined with OR
+ * @return         Zero on success, -1 on error
+ */
+int subprocess_spawn(subprocess_t* restrict proc, const char* file, const char* const argv[], int flags)
+{
+  int in_rw[2] = { -1, -1 };
+  int out_rw[2] = { -1, -1 };
+  posix_spawn_file_actions_t actions;
+  int actions_initialised = 0;
+  char** env = environ;
+  int r, saved_errno;
+  
+  proc->pid = -1;
+  proc->pidfd = proc->stdin_fd = proc->stdout_fd = -1;
+  
+  /* Create pipes, the new process's ends are duplicated onto stdin and stdout
+   * (which clears close-on-exec), every other end is closed by exec. */
+  t ((flags & SUBPROCESS_STDIN)  && pipe2(in_rw,  O_CLOEXEC));
+  t ((flags & SUBPROCESS_STDOUT) && pipe2(out_rw, O_CLOEXEC));
+  
+  t ((errno = posix_spawn_file_actions_init(&actions)));
+  actions_initialised = 1;
+  if (flags & SUBPROCESS_STDIN)
+    t ((errno = posix_spawn_file_actions_adddup2(&actions, in_rw[0], STDIN_FILENO)));
+  if (flags & SUBPROCESS_STDOUT)
+    t ((errno = posix_spawn_file_actions_adddup2(&actions, out_rw[1], STDOUT_FILENO)));
+  
+  if (flags & SUBPROCESS_LANG_C)
+    t (env = lang_c_environ(), env == NULL);
+  
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+  r = posix_spawnp(&(proc->pid), file, &actions, NULL, (char* const*)argv, env);
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+  if (r)
+    proc->pid = -1;
+  t ((errno = r));
+  
+  /* Get a file descriptor for the process, so we only ever reap our own child.
+   * This is not racy because the PID cannot be reused before we reap it. */
+#ifdef SYS_pidfd_open
+  proc->pidfd = (int)syscall(SYS_pidfd_open, proc->pid, 0);
+  if (proc->pidfd >= 0)
+    fcntl(proc->pidfd, F_SETFD, FD_CLOEXEC);
+#endif
+  
+  if (env != environ)
+    free(env);
+  posix_spawn_file_actions_destroy(&actions);
+  if (flags & SUBPROCESS_STDIN)
+    close(in_rw[0]), proc->stdin_fd = in_rw[1];
+  if (flags & SUBPROCESS_STDOUT)
+    close(out_rw[1]), proc->stdout_fd = out_rw[0];
+  return 0;
   
-  *pid = fork();
-  if (*pid < 0)
+ fail:
+  saved_errno = errno;
+  if (env != environ)
+    free(env);
+  if (actions_initialised)
+    posix_spawn_file_actions_destroy(&actions);
+  if (in_rw[0] >= 0)   close(in_rw[0]);
+  if (in_rw[1] >= 0)   close(in_rw[1]);
+  if (out_rw[0] >= 0)  close(out_rw[0]);
+  if (out_rw[1] >= 0)  close(out_rw[1]);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Wait for a subprocess to exit, its pipes are not closed
+ * 
+ * @param   proc  The process, will be marked as reaped
+ * @return        Zero if the process exited successfully, -1 otherwise,
+ *                `errno` will be set to zero if the process failed
+ */
+int subprocess_reap(subprocess_t* restrict proc)
+{
+  siginfo_t info;
+  int status, saved_errno;
+  
+  t (proc->pid < 0 ? (errno = ECHILD) : 0);
+  
+  if (proc->pidfd >= 0)
     {
-      perror(execname);
-      close(pipe_rw[0]);
-      close(pipe_rw[1]);
-      errno = 0;
-      return -1;
+      for (;;)
+	{
+	  info.si_pid = 0;
+	  if (!waitid((idtype_t)P_PIDFD, (id_t)(proc->pidfd), &info, WEXITED))
+	    break;
+	  t (errno != EINTR);
+	}
+      status = ((info.si_code == CLD_EXITED) && (info.si_status == 0)) ? 0 : 1;
+      close(proc->pidfd), proc->pidfd = -1;
     }
-  else if (*pid == 0)
+  else
+    while (waitpid(proc->pid, &status, 0) < 0)
+      t (errno != EINTR);
+  
+  proc->pid = -1;
+  if (status)
+    return errno = 0, -1;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  if (proc->pidfd >= 0)
+    close(proc->pidfd), proc->pidfd = -1;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Feed data to a subprocess's stdin while reading its stdout, from this thread
+ * 
+ * When the kernel supports it, the pages of `input` are spliced into
+ * the pipe rather than copied, so `input` must not be modified before
+ * the process has been reaped.
+ * 
+ * @param   proc         The process, both its stdin and its stdout must be piped,
+ *                       they are closed when the input has been written and the
+ *                       output has been read, respectively
+ * @param   input        The data to write to the process's stdin
+ * @param   input_size   The number of bytes stored in `input`
+ * @param   output       Output parameter for the data read from the process's stdout
+ * @param   output_size  Output parameter for the number of bytes stored in `output`
+ * @return               Zero on success, -1 on error
+ */
+int subprocess_pump(subprocess_t* restrict proc, const char* input, size_t input_size,
+		    char** restrict output, size_t* restrict output_size)
+{
+  struct pollfd fds[2];
+  struct iovec iov;
+  sigset_t sigpipe, saved_mask;
+  struct timespec no_wait = { 0, 0 };
+  size_t written = 0, size = 8 << 10;
+  int use_vmsplice = 1, got_epipe = 0, saved_errno;
+  ssize_t r;
+  char* new;
+  
+  *output = NULL;
+  *output_size = 0;
+  
+  /* Do not get killed if the process exits before reading all input. */
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &saved_mask);
+  
+  t (fcntl(proc->stdin_fd,  F_SETFL, fcntl(proc->stdin_fd,  F_GETFL) | O_NONBLOCK) < 0);
+  t (fcntl(proc->stdout_fd, F_SETFL, fcntl(proc->stdout_fd, F_GETFL) | O_NONBLOCK) < 0);
+  
+  *output = malloc(size);
+  t (*output == NULL);
+  
+  while (proc->stdout_fd >= 0)
     {
-      if (lang_c)
-	setenv("LANG", "C", 1);
-      if (pipe_rw[1] != STDOUT_FILENO)
+      /* Close stdin when all input has been written. */
+      if ((proc->stdin_fd >= 0) && (written == input_size))
+	close(proc->stdin_fd), proc->stdin_fd = -1;
+      
+      fds[0].fd = proc->stdin_fd,  fds[0].events = POLLOUT;
+      fds[1].fd = proc->stdout_fd, fds[1].events = POLLIN;
+      if (poll(fds, 2, -1) < 0)
 	{
-	  close(STDOUT_FILENO);
-	  dup2(pipe_rw[1], STDOUT_FILENO);
-	  close(pipe_rw[1]);
+	  t (errno != EINTR);
+	  continue;
 	}
-      close(pipe_rw[0]);
       
+      /* Feed stdin. */
+      if (fds[0].revents)
+	{
 #ifdef __GNUC__
 # pragma GCC diagnostic push
 # pragma GCC diagnostic ignored "-Wcast-qual"
 #endif
-      execvp(file, (char* const*)argv);
+	  iov.iov_base = (void*)(input + written);
 #ifdef __GNUC__
 # pragma GCC diagnostic pop
 #endif
-      perror(execname);
-      exit(1);
+	  iov.iov_len = input_size - written;
+	  r = -1;
+	  if (use_vmsplice)
+	    {
+	      r = vmsplice(proc->stdin_fd, &iov, 1, SPLICE_F_NONBLOCK);
+	      if ((r < 0) && ((errno == EINVAL) || (errno == ENOSYS)))
+		use_vmsplice = 0;
+	    }
+	  if (!use_vmsplice)
+	    r = write(proc->stdin_fd, iov.iov_base, iov.iov_len);
+	  if (r >= 0)
+	    written += (size_t)r;
+	  else if (errno == EPIPE)
+	    got_epipe = 1, written = input_size;
+	  else
+	    t ((errno != EINTR) && (errno != EAGAIN));
+	}
+      
+      /* Drain stdout. */
+      if (fds[1].revents)
+	{
+	  if (size - *output_size < 1024)
+	    {
+	      new = realloc(*output, size <<= 1);
+	      t (new == NULL);
+	      *output = new;
+	    }
+	  r = read(proc->stdout_fd, *output + *output_size, size - *output_size);
+	  if (r == 0)
+	    close(proc->stdout_fd), proc->stdout_fd = -1;
+	  else if (r > 0)
+	    *output_size += (size_t)r;
+	  else
+	    t ((errno != EINTR) && (errno != EAGAIN));
+	}
     }
   
-  close(pipe_rw[1]);
-  return pipe_rw[0];
+  if (proc->stdin_fd >= 0)
+    close(proc->stdin_fd), proc->stdin_fd = -1;
+  if (got_epipe)
+    while ((sigtimedwait(&sigpipe, NULL, &no_wait) < 0) && (errno == EINTR));
+  pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  if (proc->stdin_fd >= 0)
+    close(proc->stdin_fd), proc->stdin_fd = -1;
+  if (proc->stdout_fd >= 0)
+    close(proc->stdout_fd), proc->stdout_fd = -1;
+  if (got_epipe)
+    while ((sigtimedwait(&sigpipe, NULL, &no_wait) < 0) && (errno == EINTR));
+  pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+  free(*output), *output = NULL;
+  *output_size = 0;
+  errno = saved_errno;
+  return -1;
 }
 
 
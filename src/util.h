@@ -45,15 +45,87 @@
 
 
 /**
- * Create a subprocess and read it's stdout
+ * Flag for `subprocess_spawn`: create a pipe to the new process's stdin
+ */
+#define SUBPROCESS_STDIN  1
+
+/**
+ * Flag for `subprocess_spawn`: create a pipe from the new process's stdout
+ */
+#define SUBPROCESS_STDOUT  2
+
+/**
+ * Flag for `subprocess_spawn`: set $LANG to "C" in the new process
+ */
+#define SUBPROCESS_LANG_C  4
+
+
+/**
+ * A subprocess
+ */
+typedef struct subprocess
+{
+  /**
+   * The process's PID
+   */
+  pid_t pid;
+  
+  /**
+   * File descriptor referring to the process, -1 if not supported by the kernel
+   */
+  int pidfd;
+  
+  /**
+   * The file descriptor of the process's stdin, -1 if not piped
+   */
+  int stdin_fd;
+  
+  /**
+   * The file descriptor of the process's stdout, -1 if not piped
+   */
+  int stdout_fd;
+  
+} subprocess_t;
+
+
+/**
+ * Create a subprocess, without duplicating the address space of this process
+ * 
+ * @param   proc   Output parameter for the new process
+ * @param   file   The filename of the command to start
+ * @param   argv   The command line arguments for the new process
+ * @param   flags  `SUBPROCESS_STDIN`, `SUBPROCESS_STDOUT` and `SUBPROCESS_LANG_C`, combined with OR
+ * @return         Zero on success, -1 on error
+ */
+int subprocess_spawn(subprocess_t* restrict proc, const char* file, const char* const argv[], int flags);
+
+/**
+ * Wait for a subprocess to exit, its pipes are not closed
+ * 
+ * @param   proc  The process, will be marked as reaped
+ * @return        Zero if the process exited successfully, -1 otherwise,
+ *                `errno` will be set to zero if the process failed
+ */
+int subprocess_reap(subprocess_t* restrict proc);
+
+/**
+ * Feed data to a subprocess's stdin while reading its stdout, from this thread
+ * 
+ * When the kernel supports it, the pages of `input` are spliced into
+ * the pipe rather than copied, so `input` must not be modified before
+ * the process has been reaped.
  * 
- * @param   file    The filename of the command to start
- * @param   argv    The command line arguments for the new process
- * @param   lang_c  Whether to set $LANG to "C"
- * @param   pid     Output parameter for the new process's PID
- * @return          The file descriptor of the new process's stdout, -1 on error
+ * @param   proc         The process, both its stdin and its stdout must be piped,
+ *                       they are closed when the input has been written and the
+ *                       output has been read, respectively
+ * @param   input        The data to write to the process's stdin
+ * @param   input_size   The number of bytes stored in `input`
+ * @param   output       Output parameter for the data read from the process's stdout
+ * @param   output_size  Output parameter for the number of bytes stored in `output`
+ * @return               Zero on success, -1 on error
  */
-int subprocess_rd(const char* file, const char* const argv[], int lang_c, pid_t* pid);
+int subprocess_pump(subprocess_t* restrict proc, const char* input, size_t input_size,
+		    char** restrict output, size_t* restrict output_size);
 
 /**
  * Get the next line from a file
@@ -0,0 +1,387 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "viewer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "crazy.h"
+#include "orientation.h"
+#include "pnm.h"
+
+
+
+/**
+ * The highest zoom level, the image is magnified 32 times
+ */
+#define MAX_ZOOM  5
+
+/**
+ * The lowest zoom level, the image is reduced 64 times
+ */
+#define MIN_ZOOM  (-6)
+
+
+
+/**
+ * A memory mapped PNM image
+ */
+typedef struct viewer_image
+{
+  /**
+   * The pixel data
+   */
+  const unsigned char* payload;
+  
+  /**
+   * 4: raw lineart, 5: raw greyscale, 6: raw colour
+   */
+  int type;
+  
+  /**
+   * The maximum value on a subpixel
+   */
+  unsigned int maxval;
+  
+  /**
+   * The width of the image, in pixels, as shown
+   */
+  size_t width;
+  
+  /**
+   * The height of the image, in pixels, as shown
+   */
+  size_t height;
+  
+  /**
+   * Whether the rows of the image, as shown, are columns in the file
+   */
+  int transposed;
+  
+  /**
+   * Whether the image, as shown, is mirrored horizontally, this is
+   * applied before the transposition when pixels are looked up
+   */
+  int mirror_x;
+  
+  /**
+   * Whether the image, as shown, is mirrored vertically, this is
+   * applied before the transposition when pixels are looked up
+   */
+  int mirror_y;
+  
+  /**
+   * The number of bytes per row
+   */
+  size_t row_size;
+  
+  /**
+   * The number of bytes per pixel, 0 for lineart
+   */
+  size_t pixel_size;
+  
+} viewer_image_t;
+
+
+
+/**
+ * Scale a length from image pixels to screen pixels
+ * 
+ * @param   n     The length in image pixels
+ * @param   zoom  The zoom level, the image is magnified by 2 to the power of `zoom`
+ * @return        The length in screen pixels
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+static size_t to_screen(size_t n, int zoom)
+{
+  return zoom >= 0 ? n << zoom : (n + ((size_t)1 << -zoom) - 1) >> -zoom;
+}
+
+
+/**
+ * Scale a length from screen pixels to image pixels
+ * 
+ * @param   n     The length in screen pixels
+ * @param   zoom  The zoom level, the image is magnified by 2 to the power of `zoom`
+ * @return        The length in image pixels
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+static size_t to_image(size_t n, int zoom)
+{
+  return zoom >= 0 ? n >> zoom : n << -zoom;
+}
+
+
+/**
+ * Get the left or top edge of the viewport, in screen pixels
+ * 
+ * @param   centre   The position of the centre of the viewport, in image pixels
+ * @param   visible  The size of the viewport, in screen pixels
+ * @param   total    The size of the image, in screen pixels
+ * @param   zoom     The zoom level
+ * @return           The position of the edge
+ */
+#ifdef __GNUC__
+__attribute__((const))
+#endif
+static size_t viewport_edge(size_t centre, size_t visible, size_t total, int zoom)
+{
+  size_t edge = zoom >= 0 ? centre << zoom : centre >> -zoom;
+  edge = edge > visible / 2 ? edge - visible / 2 : 0;
+  return edge + visible > total ? total - visible : edge;
+}
+
+
+/**
+ * Draw the visible part of an image, sampling only the pixels that are shown
+ * 
+ * @param   image          The image
+ * @param   zoom           The zoom level
+ * @param   cx             The X-position of the centre of the viewport, in image pixels
+ * @param   cy             The Y-position of the centre of the viewport, in image pixels
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @param   levels         Lookup table for the viewport's maxval
+ * @param   draw           Function that draws the viewport onto the screen
+ * @return                 Zero on success, -1 on error
+ */
+static int viewer_render(const viewer_image_t* restrict image, int zoom, size_t cx, size_t cy,
+			 size_t screen_width, size_t screen_height, const pnm_levels_t* restrict levels,
+			 display_draw_func_t* draw)
+{
+  size_t total_width  = to_screen(image->width,  zoom);
+  size_t total_height = to_screen(image->height, zoom);
+  size_t width  = total_width  < screen_width  ? total_width  : screen_width;
+  size_t height = total_height < screen_height ? total_height : screen_height;
+  size_t left = viewport_edge(cx, width,  total_width,  zoom);
+  size_t top  = viewport_edge(cy, height, total_height, zoom);
+  size_t pixel_size = image->pixel_size ? image->pixel_size : 1;
+  size_t* columns = NULL;
+  unsigned char* viewport = NULL;
+  unsigned char* d;
+  const unsigned char* row;
+  size_t x, y, i, sx;
+  int r, saved_errno;
+  
+  t (columns = malloc(width * sizeof(size_t)), columns == NULL);
+  t (viewport = malloc(width * height * pixel_size), viewport == NULL);
+  
+  for (x = 0; x < width; x++)
+    {
+      columns[x] = to_image(left + x, zoom);
+      if (columns[x] >= image->width)
+	columns[x] = image->width - 1;
+      if (image->mirror_x)
+	columns[x] = image->width - 1 - columns[x];
+    }
+  
+  for (y = 0, d = viewport; y < height; y++)
+    {
+      i = to_image(top + y, zoom);
+      i = i < image->height ? i : image->height - 1;
+      i = image->mirror_y ? image->height - 1 - i : i;
+      if (image->transposed)
+	{
+	  /* Row `y` on the screen is column `i` in the file, and `columns` are rows in the file. */
+	  if (image->type == 4)
+	    for (x = 0; x < width; x++)
+	      {
+		row = image->payload + columns[x] * image->row_size;
+		*d++ = (row[i >> 3] >> (7 - (i & 7)) & 1) ? 0 : 255;
+	      }
+	  else
+	    for (x = 0; x < width; x++)
+	      {
+		row = image->payload + columns[x] * image->row_size + i * pixel_size;
+		for (sx = 0; sx < pixel_size; sx++)
+		  *d++ = row[sx];
+	      }
+	  continue;
+	}
+      row = image->payload + i * image->row_size;
+      if (image->type == 4)
+	for (x = 0; x < width; x++)
+	  sx = columns[x], *d++ = (row[sx >> 3] >> (7 - (sx & 7)) & 1) ? 0 : 255;
+      else
+	for (x = 0; x < width; x++)
+	  for (i = 0, sx = columns[x] * pixel_size; i < pixel_size; i++)
+	    *d++ = row[sx + i];
+    }
+  
+  r = draw((screen_width - width) / 2, (screen_height - height) / 2, width, height,
+	   levels, image->type == 4 ? 5 : image->type, viewport);
+  t (r);
+  
+  free(columns);
+  free(viewport);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(columns);
+  free(viewport);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Let the user zoom and pan around an image at full resolution
+ * 
+ * Only the part of the image that is visible is read, so the
+ * image is never resized as a whole, the keys are:
+ * 
+ *   +, =              Zoom in
+ *   -                 Zoom out
+ *   0                 Show the image at its actual size
+ *   arrows, h/j/k/l   Pan
+ *   q, escape, enter  Exit
+ * 
+ * @param   pathname       The pathname of the image, must be a raw PNM image
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @param   draw           Function that draws the viewport onto the screen
+ * @param   keys           Where the keys pressed by the user are read from
+ * @return                 Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+int viewer_run(const char* pathname, size_t screen_width, size_t screen_height, display_draw_func_t* draw,
+	       const display_keys_t* restrict keys)
+{
+  int fd = -1, saved_errno, have_stty = 0, zoom = 0;
+  void* map = MAP_FAILED;
+  size_t size = 0, offset, cx, cy, step;
+  int state, comment;
+  viewer_image_t image;
+  pnm_levels_t levels = { .maxval = 0, .table = NULL };
+  struct termios stty;
+  struct termios saved_stty;
+  struct stat attr;
+  char pressed[16];
+  ssize_t got, k;
+  int corners[4];
+  
+  /* Map the image. */
+  t (fd = open(pathname, O_RDONLY | O_CLOEXEC), fd < 0);
+  t (fstat(fd, &attr));
+  size = (size_t)(attr.st_size);
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+  t (map == MAP_FAILED);
+  close(fd), fd = -1;
+  madvise(map, size, MADV_RANDOM);
+  
+  /* Parse headers. */
+  pnm_init_parse_header(&state, &comment, &image.type, &image.maxval, &image.width, &image.height);
+  offset = pnm_parse_header(&state, &comment, &image.type, &image.maxval, &image.width, &image.height,
+			    size, map);
+  if ((state < 10) || (image.type < 4) || (image.type > 6) || (image.maxval < 1) ||
+      !image.width || !image.height ||
+      (size - offset < pnm_payload_size(image.type, image.maxval, image.width, image.height)))
+    {
+      fprintf(stderr, "%s: %s: not a complete raw PNM image\n", execname, pathname);
+      errno = 0;
+      goto fail;
+    }
+  image.payload    = (const unsigned char*)map + offset;
+  image.row_size   = pnm_row_size(image.type, image.maxval, image.width);
+  image.pixel_size = image.type == 4 ? 0 : pnm_row_size(image.type, image.maxval, 1);
+  t (pnm_levels_init(&levels, image.type == 4 ? 255 : image.maxval));
+  
+  /* The orientation is applied when the visible pixels are looked up. */
+  t (orientation_read(pathname, corners));
+  image.transposed = (corners[0] - 1) / 2 != (corners[1] - 1) / 2;
+  image.mirror_x = ((corners[0] - 1) & (image.transposed ? 2 : 1)) != 0;
+  image.mirror_y = ((corners[0] - 1) & (image.transposed ? 1 : 2)) != 0;
+  if (image.transposed)
+    cx = image.width, image.width = image.height, image.height = cx;
+  
+  /* Read keys one at a time, if they are typed in the terminal. */
+  if (!tcgetattr(keys->fd, &stty))
+    {
+      saved_stty = stty, have_stty = 1;
+      stty.c_lflag &= (tcflag_t)~(ICANON | ECHO | ISIG);
+      tcsetattr(keys->fd, TCSAFLUSH, &stty);
+    }
+  
+  cx = image.width / 2;
+  cy = image.height / 2;
+  for (;;)
+    {
+      t (viewer_render(&image, zoom, cx, cy, screen_width, screen_height, &levels, draw));
+      
+      got = display_wait_keys(keys, pressed, sizeof(pressed), -1);
+      if (got < 0)
+	{
+	  t (errno != EINTR);
+	  continue;
+	}
+      if ((got == 0) || ((got == 1) && (*pressed == '\033')))
+	break;
+      
+      step = to_image(screen_width < screen_height ? screen_width / 4 : screen_height / 4, zoom);
+      step = step ? step : 1;
+      for (k = 0; k < got; k++)
+	{
+	  if ((pressed[k] == '\033') && (k + 2 < got) && (pressed[k + 1] == '['))
+	    k += 2, pressed[k] = "kjlh"[(pressed[k] - 'A') & 3];
+	  switch (pressed[k])
+	    {
+	    case '+':
+	    case '=':  zoom += zoom < MAX_ZOOM;  break;
+	    case '-':  zoom -= zoom > MIN_ZOOM;  break;
+	    case '0':  zoom = 0;                 break;
+	    case 'h':  cx = cx > step ? cx - step : 0;  break;
+	    case 'k':  cy = cy > step ? cy - step : 0;  break;
+	    case 'l':  cx = cx + step < image.width  ? cx + step : image.width  - 1;  break;
+	    case 'j':  cy = cy + step < image.height ? cy + step : image.height - 1;  break;
+	    case 'q':
+	    case '\n':
+	      goto done;
+	    default:
+	      break;
+	    }
+	}
+    }
+  
+ done:
+  if (have_stty)
+    tcsetattr(keys->fd, TCSAFLUSH, &saved_stty);
+  pnm_levels_destroy(&levels);
+  munmap(map, size);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (have_stty)
+    tcsetattr(keys->fd, TCSAFLUSH, &saved_stty);
+  pnm_levels_destroy(&levels);
+  if (map != MAP_FAILED)
+    munmap(map, size);
+  if (fd >= 0)
+    close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
@@ -0,0 +1,51 @@
+/**
+ * crazy — A crazy simple and usable scanning utility
+ * Copyright © 2015, 2016  Mattias Andrée (m@maandree.se)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRAZY_VIEWER_H
+#define CRAZY_VIEWER_H
+
+
+#include <stddef.h>
+
+#include "display.h"
+
+
+/**
+ * Let the user zoom and pan around an image at full resolution
+ * 
+ * Only the part of the image that is visible is read, so the
+ * image is never resized as a whole, the keys are:
+ * 
+ *   +, =              Zoom in
+ *   -                 Zoom out
+ *   0                 Show the image at its actual size
+ *   arrows, h/j/k/l   Pan
+ *   q, escape, enter  Exit
+ * 
+ * @param   pathname       The pathname of the image, must be a raw PNM image
+ * @param   screen_width   The width of the screen
+ * @param   screen_height  The height of the screen
+ * @param   draw           Function that draws the viewport onto the screen
+ * @param   keys           Where the keys pressed by the user are read from
+ * @return                 Zero on success, -1 on error, `errno` will be set appropriately (may be zero)
+ */
+int viewer_run(const char* pathname, size_t screen_width, size_t screen_height, display_draw_func_t* draw,
+	       const display_keys_t* restrict keys);
+
+
+#endif
+